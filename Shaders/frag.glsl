@@ -1,8 +1,946 @@
-#version 330 core
+#version 430 core
+
+// This file also gets precompiled to SPIR-V by glslang (see CMakeLists.txt), which does its own #include //
+// Material textures are bindless wherever the driver can do it, & in one big array texture where it can't //
+// (Source/textures.cpp checks for the same extension, & defines ARRAY_TEXTURES when it went with the array anyway) //
+// SPIR-V always goes with the array, since bindless textures aren't a thing there (see loadTraceSPIRV) //
+#ifdef GL_SPIRV
+#extension GL_GOOGLE_include_directive : require
+#else
+#extension GL_ARB_bindless_texture : enable
+#if defined(GL_ARB_bindless_texture) && !defined(ARRAY_TEXTURES)
+#define BINDLESS_TEXTURES
+#endif
+#endif
+
+// Uniforms //
+// Everything that can change from frame to frame comes in one block, which gets streamed through Source/resources.h's //
+// upload ring (it's laid out exactly like FrameUniforms in Source/renderer.cpp) //
+// (Like everything in the scene buffers, the camera's position is relative to the scene's floating origin, see //
+// Source/scene.h's SceneBuffers, so it stays small however far out in the world the camera is) //
+layout(std140, binding = 0) uniform FrameUniforms {
+	mat3 uCameraRotationMatrix;
+	vec3 uCameraPosition;
+	float uWidth;
+	float uHeight;
+	float uAspectRatio;
+	uint uFrame;
+	uint uSamples;
+	uint uInstanceCount;
+	uint uPlaneCount;
+	uint uPrimitiveCount;
+	uint uPrimitiveRoot;
+	uint uLightCount;
+	float uEnvironmentChance;
+	uint uEnvironmentWidth;
+	uint uEnvironmentHeight;
+	float uEnvironmentRotation;
+	uint uMinBounces;
+	uint uMaxBounces;
+	uint uBounceStats;
+};
+
+// Samplers can't go in a block, so they get locations of their own (SPIR-V doesn't have to keep their names) //
+// & are bound to the same units Source/renderer.cpp puts their textures on //
+layout(location = 0, binding = 1) uniform sampler2D uEnvironment;
+#ifndef BINDLESS_TEXTURES
+layout(location = 1, binding = 2) uniform sampler2DArray uMaterialTextures;
+#endif
+layout(location = 2, binding = 3) uniform sampler2D uTilePool;
+
+// Which features the scene actually uses (this file gets compiled once per scene, see Source/shaders.h) //
+#include "specialization.glsl"
 
 // Output //
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+
+// Scene //
+// (These line up with the structs in Source/bvh.h & Source/scene.h) //
+struct Node {
+	vec3 min;
+	uint leftOrFirst;
+	vec3 max;
+	uint count;
+};
+
+struct Instance {
+	vec4 worldToObject[3];
+	uint rootNode;
+	uint material;
+	uint compressed;
+	uint lightBase;
+};
+
+// handle is the texture's bindless handle, if there is one (texture's NoTexture if not) //
+// Streamed textures have StreamedTexture set, & are numbered separately from the rest //
+struct Material {
+	vec4 albedo;
+	vec4 emission;
+	uint texture;
+	float tiling;
+	uvec2 handle;
+};
+
+const uint NoTexture = 0xFFFFFFFFu;
+const uint StreamedTexture = 0x80000000u;
+
+// Vertices' w holds their UV, as two half floats //
+layout(std430, binding = 0) readonly buffer VertexBuffer { vec4 Vertices[]; };
+layout(std430, binding = 1) readonly buffer TriangleBuffer { uvec4 Triangles[]; };
+layout(std430, binding = 2) readonly buffer NodeBuffer { Node Nodes[]; };
+layout(std430, binding = 3) readonly buffer InstanceNodeBuffer { Node InstanceNodes[]; };
+layout(std430, binding = 4) readonly buffer InstanceBuffer { Instance Instances[]; };
+layout(std430, binding = 5) readonly buffer MaterialBuffer { Material Materials[]; };
+
+// Compressed nodes are 5 uvec4s each (see WideBVHNode in Source/bvh.h): //
+// [0] corner as float bits, then the 3 step exponents & the interior child mask, a byte each //
+// [1] first interior child, first primitive, then a meta byte per child //
+// [2..4] low x, low y, low z, high x, high y, high z, a byte per child each //
+layout(std430, binding = 6) readonly buffer WideNodeBuffer { uvec4 WideNodes[]; };
+
+// Primitives are split into one array per field (see Primitive in Source/scene.h for what goes where) //
+// The first uPlaneCount are planes, which get tested on every ray, and the rest sit in a BVH in Nodes //
+layout(std430, binding = 7) readonly buffer PrimitiveShapeBuffer { vec4 PrimitiveShapes[]; };
+layout(std430, binding = 8) readonly buffer PrimitiveExtraBuffer { vec4 PrimitiveExtras[]; };
+layout(std430, binding = 9) readonly buffer PrimitiveKindBuffer { uint PrimitiveKinds[]; };
+
+// Everything emissive that can be aimed at directly (see GPULight in Source/scene.h for what goes where) //
+// trail is the way down the light tree to it: which child to take at each level, ending at the highest set bit //
+struct Light {
+	vec4 a;
+	vec4 b;
+	vec4 c;
+	vec3 emission;
+	uint trail;
+};
+
+// Lights are picked by walking down a BVH over them, choosing between children by how much they'd light up //
+// the shading point. power, cosSpread & cosEmit describe everything under the node, all in one bounding cone //
+struct LightNode {
+	vec3 min;
+	float power;
+	vec3 max;
+	float cosSpread;
+	vec3 axis;
+	float cosEmit;
+	uint leftOrLight;
+	uint leaf;
+	uvec2 padding;
+};
+
+layout(std430, binding = 10) readonly buffer LightBuffer { Light Lights[]; };
+layout(std430, binding = 11) readonly buffer LightNodeBuffer { LightNode LightNodes[]; };
+
+const uint TRIANGLE_LIGHT = 0u;
+const uint SPHERE_LIGHT = 1u;
+const uint DISK_LIGHT = 2u;
+
+const uint SPHERE = 0u;
+const uint BOX = 1u;
+const uint PLANE = 2u;
+const uint DISK = 3u;
+
+// Settings //
+const int StackSize = 32;
+const int WideStackSize = 64;
+const float Infinity = 1e30;
+const float Epsilon = 1e-4;
+const float PI = 3.14159265358979;
+
+// Random Numbers //
+uint RandomState = 0u;
+uint hash(uint x) {
+	x ^= x >> 16u; x *= 0x7feb352du;
+	x ^= x >> 15u; x *= 0x846ca68bu;
+	x ^= x >> 16u;
+	return x;
+}
+float random() {
+	RandomState = hash(RandomState);
+	return float(RandomState) / 4294967296.0;
+}
+
+// Bounce Statistics //
+// While uBounceStats is on, every path counts itself once for each depth it reaches (uMaxBounces stays under 32) //
+// (These are storage buffer atomics rather than atomic_uints, since those can't be indexed by something that varies per path) //
+layout(std430, binding = 13) buffer BounceStatsBuffer { uint PathsAlive[32]; };
+
+// Streamed Textures //
+// The page table starts with 4 uints per streamed texture (width, height, mip count & first entry), then has an entry per tile: //
+// 0 if it isn't in uTilePool, or ResidentPage plus which slot it's in (x in the bottom 12 bits, y in the 12 above) //
+// Whichever tiles get wanted go in the feedback, so the CPU knows what to load (see Source/textures.h) //
+layout(std430, binding = 14) readonly buffer PageTableBuffer { uint PageTable[]; };
+layout(std430, binding = 15) buffer FeedbackBuffer { uint FeedbackCount; uint Feedback[]; };
+
+// Sky //
+// Either a gradient, or an equirectangular environment map (uEnvironmentWidth is 0 if there isn't one) //
+// The map's texels get picked by brightness using alias tables (see AliasEntry in Source/scene.h): //
+// first uEnvironmentHeight entries for the rows, then a row's worth of entries for each row //
+struct AliasEntry {
+	float threshold;
+	uint alias;
+	float pdf;
+};
+
+layout(std430, binding = 12) readonly buffer EnvironmentBuffer { AliasEntry EnvironmentTable[]; };
+
+// Which texel a direction lands on //
+ivec2 environmentTexel(vec3 direction) {
+	float u = fract((atan(direction.z, direction.x) + uEnvironmentRotation) / (2.0 * PI));
+	float v = acos(clamp(direction.y, -1.0, 1.0)) / PI;
+	return ivec2(min(uint(u * float(uEnvironmentWidth)), uEnvironmentWidth - 1u), min(uint(v * float(uEnvironmentHeight)), uEnvironmentHeight - 1u));
+}
+
+vec3 sky(vec3 direction) {
+	if (!HAS_ENVIRONMENT_MAP || uEnvironmentWidth == 0u) return mix(vec3(1.0), vec3(0.5, 0.7, 1.0), 0.5 * direction.y + 0.5);
+	return texelFetch(uEnvironment, environmentTexel(direction), 0).rgb;
+}
+
+//////////////////
+// Intersection //
+//////////////////
+
+// Primitives aren't instanced, so hitting one sets instance to PrimitiveHit & triangle to the primitive //
+struct Hit {
+	float t;
+	uint instance;
+	uint triangle;
+};
+
+const uint PrimitiveHit = 0xFFFFFFFFu;
+
+// Tangent, bitangent & normal, for turning directions around a normal into world space //
+mat3 basis(vec3 normal) {
+	vec3 tangent = normalize(cross(abs(normal.x) > 0.5 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), normal));
+	return mat3(tangent, cross(normal, tangent), normal);
+}
+
+// Distance along the ray to a box, or Infinity if it misses (or is further than tMax) //
+float intersectBox(vec3 origin, vec3 inverseDirection, vec3 boxMin, vec3 boxMax, float tMax) {
+	vec3 t0 = (boxMin - origin) * inverseDirection;
+	vec3 t1 = (boxMax - origin) * inverseDirection;
+	vec3 near = min(t0, t1), far = max(t0, t1);
+	float tNear = max(max(near.x, near.y), near.z);
+	float tFar = min(min(far.x, far.y), far.z);
+	return (tNear <= tFar && tFar > 0.0 && tNear < tMax) ? tNear : Infinity;
+}
+
+// Möller-Trumbore, returning the distance to the triangle or Infinity //
+float intersectTriangle(vec3 origin, vec3 direction, uint triangle) {
+	uvec4 indices = Triangles[triangle];
+	vec3 v0 = Vertices[indices.x].xyz;
+	vec3 edge1 = Vertices[indices.y].xyz - v0;
+	vec3 edge2 = Vertices[indices.z].xyz - v0;
+
+	vec3 p = cross(direction, edge2);
+	float determinant = dot(edge1, p);
+	if (abs(determinant) < 1e-12) return Infinity;
+	float inverseDeterminant = 1.0 / determinant;
+
+	vec3 s = origin - v0;
+	float u = dot(s, p) * inverseDeterminant;
+	if (u < 0.0 || u > 1.0) return Infinity;
+	vec3 q = cross(s, edge1);
+	float v = dot(direction, q) * inverseDeterminant;
+	if (v < 0.0 || u + v > 1.0) return Infinity;
+
+	float t = dot(edge2, q) * inverseDeterminant;
+	return t > Epsilon ? t : Infinity;
+}
+
+// Distance to a primitive (in world space), or Infinity if the ray misses //
+float intersectPrimitive(vec3 origin, vec3 direction, uint primitive) {
+	vec4 shape = PrimitiveShapes[primitive];
+	uint type = PrimitiveKinds[primitive] & 3u;
+
+	if (HAS_SPHERES && type == SPHERE) {
+		vec3 offset = origin - shape.xyz;
+		float b = dot(offset, direction), a = dot(direction, direction);
+		float discriminant = b * b - a * (dot(offset, offset) - shape.w * shape.w);
+		if (discriminant < 0.0) return Infinity;
+		float root = sqrt(discriminant);
+		float t = (-b - root) / a;
+		if (t <= Epsilon) t = (-b + root) / a;
+		return t > Epsilon ? t : Infinity;
+	}
+
+	if (HAS_BOXES && type == BOX) {
+		// Like intersectBox, except from inside it's the far side we hit //
+		vec3 t0 = (shape.xyz - origin) / direction;
+		vec3 t1 = (PrimitiveExtras[primitive].xyz - origin) / direction;
+		vec3 near = min(t0, t1), far = max(t0, t1);
+		float tNear = max(max(near.x, near.y), near.z);
+		float tFar = min(min(far.x, far.y), far.z);
+		if (tNear > tFar) return Infinity;
+		if (tNear > Epsilon) return tNear;
+		return tFar > Epsilon ? tFar : Infinity;
+	}
+
+	// Planes & disks both start with the ray hitting a plane //
+	if (!HAS_PLANES && !HAS_DISKS) return Infinity;
+	vec3 normal = type == PLANE ? shape.xyz : PrimitiveExtras[primitive].xyz;
+	float denominator = dot(normal, direction);
+	if (abs(denominator) < 1e-12) return Infinity;
+	float offset = type == PLANE ? shape.w : dot(normal, shape.xyz);
+	float t = (offset - dot(normal, origin)) / denominator;
+	if (t <= Epsilon) return Infinity;
+	if (HAS_DISKS && type == DISK) {
+		vec3 fromCentre = origin + direction * t - shape.xyz;
+		if (dot(fromCentre, fromCentre) > shape.w * shape.w) return Infinity;
+	}
+	return t;
+}
+
+// Tests every plane, then walks the BVH over the rest of the primitives //
+void traversePrimitives(vec3 origin, vec3 direction, inout Hit hit) {
+	if (HAS_PLANES) {
+		for (uint i = 0u; i < uPlaneCount; i++) {
+			float t = intersectPrimitive(origin, direction, i);
+			if (t < hit.t) { hit.t = t; hit.instance = PrimitiveHit; hit.triangle = i; }
+		}
+	}
+	if (!HAS_PRIMITIVE_BVH || uPrimitiveCount == uPlaneCount) return;
+
+	vec3 inverseDirection = 1.0 / direction;
+	uint stack[StackSize];
+	int stackSize = 0;
+	uint node = uPrimitiveRoot;
+	if (intersectBox(origin, inverseDirection, Nodes[node].min, Nodes[node].max, hit.t) == Infinity) return;
+
+	while (true) {
+		if (Nodes[node].count > 0u) {
+			uint first = Nodes[node].leftOrFirst;
+			for (uint i = first; i < first + Nodes[node].count; i++) {
+				float t = intersectPrimitive(origin, direction, i);
+				if (t < hit.t) { hit.t = t; hit.instance = PrimitiveHit; hit.triangle = i; }
+			}
+		} else {
+			uint left = Nodes[node].leftOrFirst, right = left + 1u;
+			float tLeft = intersectBox(origin, inverseDirection, Nodes[left].min, Nodes[left].max, hit.t);
+			float tRight = intersectBox(origin, inverseDirection, Nodes[right].min, Nodes[right].max, hit.t);
+			if (tLeft > tRight) { float t = tLeft; tLeft = tRight; tRight = t; uint n = left; left = right; right = n; }
+
+			if (tLeft < Infinity) {
+				if (tRight < Infinity && stackSize < StackSize) stack[stackSize++] = right;
+				node = left;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) break;
+		node = stack[--stackSize];
+	}
+}
+
+// Walks one mesh's BVH (in object space), updating hit if anything closer turns up //
+void traverseMesh(vec3 origin, vec3 direction, uint root, uint instance, inout Hit hit) {
+	vec3 inverseDirection = 1.0 / direction;
+	uint stack[StackSize];
+	int stackSize = 0;
+	uint node = root;
+
+	while (true) {
+		if (Nodes[node].count > 0u) {
+			// Leaf: test every triangle in it //
+			uint first = Nodes[node].leftOrFirst;
+			for (uint i = first; i < first + Nodes[node].count; i++) {
+				float t = intersectTriangle(origin, direction, i);
+				if (t < hit.t) { hit.t = t; hit.instance = instance; hit.triangle = i; }
+			}
+		} else {
+			// Interior: visit the closer child first, save the other one for later //
+			uint left = Nodes[node].leftOrFirst, right = left + 1u;
+			float tLeft = intersectBox(origin, inverseDirection, Nodes[left].min, Nodes[left].max, hit.t);
+			float tRight = intersectBox(origin, inverseDirection, Nodes[right].min, Nodes[right].max, hit.t);
+			if (tLeft > tRight) { float t = tLeft; tLeft = tRight; tRight = t; uint n = left; left = right; right = n; }
+
+			if (tLeft < Infinity) {
+				if (tRight < Infinity && stackSize < StackSize) stack[stackSize++] = right;
+				node = left;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) break;
+		node = stack[--stackSize];
+	}
+}
+
+// Same as traverseMesh, but for meshes stored as compressed wide nodes //
+void traverseWideMesh(vec3 origin, vec3 direction, uint root, uint instance, inout Hit hit) {
+	vec3 inverseDirection = 1.0 / direction;
+	uint stack[WideStackSize];
+	int stackSize = 0;
+	uint node = root;
+
+	while (true) {
+		uvec4 header = WideNodes[node * 5u];
+		uvec4 links = WideNodes[node * 5u + 1u];
+		uvec4 bounds0 = WideNodes[node * 5u + 2u];
+		uvec4 bounds1 = WideNodes[node * 5u + 3u];
+		uvec4 bounds2 = WideNodes[node * 5u + 4u];
+
+		// A float with just an exponent is exactly a power of two, which is what the steps are //
+		vec3 corner = uintBitsToFloat(header.xyz);
+		vec3 step = uintBitsToFloat((uvec3(header.w, header.w >> 8u, header.w >> 16u) & 0xFFu) << 23u);
+		uint interiorMask = header.w >> 24u;
+
+		// Test every child's box, running leaves straight away & sorting interior children by distance //
+		uint children[8];
+		float distances[8];
+		int childCount = 0;
+		for (uint child = 0u; child < 8u; child++) {
+			uint word = child >> 2u, shift = (child & 3u) * 8u;
+			uint meta = (links[2u + word] >> shift) & 0xFFu;
+			bool interior = ((interiorMask >> child) & 1u) != 0u;
+			if (!interior && meta == 0u) continue;
+
+			uvec3 low = (uvec3(bounds0[word], bounds0[2u + word], bounds1[word]) >> shift) & 0xFFu;
+			uvec3 high = (uvec3(bounds1[2u + word], bounds2[word], bounds2[2u + word]) >> shift) & 0xFFu;
+			float t = intersectBox(origin, inverseDirection, corner + vec3(low) * step, corner + vec3(high) * step, hit.t);
+			if (t == Infinity) continue;
+
+			if (interior) {
+				uint index = links.x + uint(bitCount(interiorMask & ((1u << child) - 1u)));
+				int slot = childCount++;
+				while (slot > 0 && distances[slot - 1] > t) { children[slot] = children[slot - 1]; distances[slot] = distances[slot - 1]; slot--; }
+				children[slot] = index;
+				distances[slot] = t;
+			} else {
+				uint first = links.y + (meta & 31u);
+				for (uint i = first; i < first + (meta >> 5u); i++) {
+					float tTriangle = intersectTriangle(origin, direction, i);
+					if (tTriangle < hit.t) { hit.t = tTriangle; hit.instance = instance; hit.triangle = i; }
+				}
+			}
+		}
+
+		// Visit the closest child next, & save the rest for later (furthest at the bottom) //
+		if (childCount > 0) {
+			for (int i = childCount - 1; i > 0; i--) if (stackSize < WideStackSize) stack[stackSize++] = children[i];
+			node = children[0];
+			continue;
+		}
+
+		if (stackSize == 0) break;
+		node = stack[--stackSize];
+	}
+}
+
+// Checks the primitives, then walks the instance BVH & the BVH of every instance the ray gets near //
+// Anything further than tMax is ignored, so shadow rays can stop at their light //
+Hit intersectScene(vec3 origin, vec3 direction, float tMax) {
+	Hit hit = Hit(tMax, 0u, 0u);
+	traversePrimitives(origin, direction, hit);
+	if (!HAS_MESHES || uInstanceCount == 0u) return hit;
+
+	vec3 inverseDirection = 1.0 / direction;
+	uint stack[StackSize];
+	int stackSize = 0;
+	uint node = 0u;
+	if (intersectBox(origin, inverseDirection, InstanceNodes[0].min, InstanceNodes[0].max, hit.t) == Infinity) return hit;
+
+	while (true) {
+		if (InstanceNodes[node].count > 0u) {
+			// Leaf: move the ray into each instance's object space & look at its mesh //
+			// (The direction isn't renormalized, so distances still line up with world space) //
+			uint first = InstanceNodes[node].leftOrFirst;
+			for (uint i = first; i < first + InstanceNodes[node].count; i++) {
+				mat4x3 worldToObject = transpose(mat3x4(Instances[i].worldToObject[0], Instances[i].worldToObject[1], Instances[i].worldToObject[2]));
+				vec3 localOrigin = worldToObject * vec4(origin, 1.0);
+				vec3 localDirection = worldToObject * vec4(direction, 0.0);
+				if (HAS_WIDE_NODES && (!HAS_FULL_NODES || Instances[i].compressed != 0u)) traverseWideMesh(localOrigin, localDirection, Instances[i].rootNode, i, hit);
+				else traverseMesh(localOrigin, localDirection, Instances[i].rootNode, i, hit);
+			}
+		} else {
+			uint left = InstanceNodes[node].leftOrFirst, right = left + 1u;
+			float tLeft = intersectBox(origin, inverseDirection, InstanceNodes[left].min, InstanceNodes[left].max, hit.t);
+			float tRight = intersectBox(origin, inverseDirection, InstanceNodes[right].min, InstanceNodes[right].max, hit.t);
+			if (tLeft > tRight) { float t = tLeft; tLeft = tRight; tRight = t; uint n = left; left = right; right = n; }
+
+			if (tLeft < Infinity) {
+				if (tRight < Infinity && stackSize < StackSize) stack[stackSize++] = right;
+				node = left;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) break;
+		node = stack[--stackSize];
+	}
+
+	return hit;
+}
+
+uint hitMaterial(Hit hit) {
+	return hit.instance == PrimitiveHit ? PrimitiveKinds[hit.triangle] >> 2u : Instances[hit.instance].material;
+}
+
+// World space normal of whatever got hit //
+vec3 hitNormal(Hit hit, vec3 position) {
+	if (hit.instance == PrimitiveHit) {
+		vec4 shape = PrimitiveShapes[hit.triangle];
+		uint type = PrimitiveKinds[hit.triangle] & 3u;
+		if (HAS_SPHERES && type == SPHERE) return normalize(position - shape.xyz);
+		if (HAS_PLANES && type == PLANE) return shape.xyz;
+		if (HAS_DISKS && type == DISK) return PrimitiveExtras[hit.triangle].xyz;
+
+		// Boxes: whichever face the point is closest to, relative to the box's size //
+		vec3 centre = (shape.xyz + PrimitiveExtras[hit.triangle].xyz) * 0.5;
+		vec3 local = (position - centre) / max((PrimitiveExtras[hit.triangle].xyz - shape.xyz) * 0.5, vec3(1e-6));
+		vec3 distance = abs(local);
+		if (distance.x > distance.y && distance.x > distance.z) return vec3(sign(local.x), 0.0, 0.0);
+		if (distance.y > distance.z) return vec3(0.0, sign(local.y), 0.0);
+		return vec3(0.0, 0.0, sign(local.z));
+	}
+
+	uvec4 indices = Triangles[hit.triangle];
+	vec3 v0 = Vertices[indices.x].xyz;
+	vec3 normal = cross(Vertices[indices.y].xyz - v0, Vertices[indices.z].xyz - v0);
+
+	// Normals go through the inverse transpose, and we've already got the inverse //
+	mat3 worldToObject = transpose(mat3(Instances[hit.instance].worldToObject[0].xyz, Instances[hit.instance].worldToObject[1].xyz, Instances[hit.instance].worldToObject[2].xyz));
+	return normalize(transpose(worldToObject) * normal);
+}
+
+//////////////
+// Textures //
+//////////////
+
+// Rays stand in for a cone of rays, as wide as the pixel they came from, which gets wider the further it goes //
+// Hits then read whichever mip has texels about as big as the cone's footprint (Akenine-Möller et al.'s ray cones) //
+// so far away & bounced textures read a few small mips instead of thrashing the cache with the biggest one //
+// A diffuse bounce spreads out far more than a pixel, but its hits get averaged over so many paths that a //
+// blurrier texture can't be seen, so it just gets a wider cone //
+const float DiffuseConeSpread = 0.1;
+
+#ifdef BINDLESS_TEXTURES
+vec4 readMaterialTexture(Material material, vec2 uv, float lod) {
+	return textureLod(sampler2D(material.handle), uv, lod);
+}
+
+vec2 materialTextureSize(Material material) {
+	return vec2(textureSize(sampler2D(material.handle), 0));
+}
+#else
+vec4 readMaterialTexture(Material material, vec2 uv, float lod) {
+	return textureLod(uMaterialTextures, vec3(uv, float(material.texture)), lod);
+}
+
+vec2 materialTextureSize(Material material) {
+	return vec2(textureSize(uMaterialTextures, 0).xy);
+}
+#endif
+
+// Streamed textures are cut into tiles (these line up with Source/tiles.h), which sit wherever there was room in uTilePool //
+// Only one pixel in FeedbackSparsity writes feedback (a different one every frame), since that's plenty to find every tile on screen //
+const uint TileSize = 128u;
+const uint TileBorder = 4u;
+const uint TilePayload = TileSize - 2u * TileBorder;
+const uint FeedbackSparsity = 64u;
+bool FeedbackPixel = false;
+
+void requestPage(uint page) {
+	if (!HAS_STREAMED_TEXTURES || !FeedbackPixel) return;
+	uint slot = atomicAdd(FeedbackCount, 1u);
+	if (slot < uint(Feedback.length())) Feedback[slot] = page;
+}
+
+vec2 streamedTextureSize(uint texture) {
+	return vec2(PageTable[texture * 4u], PageTable[texture * 4u + 1u]);
+}
+
+// Picks between the two nearest mips at random rather than blending them, so it's only ever one lookup //
+// If the tile isn't loaded yet, the next mip up gets a go, all the way up to the smallest one (which is always there) //
+vec4 readStreamedTexture(uint texture, vec2 uv, float lod) {
+	uvec4 description = uvec4(PageTable[texture * 4u], PageTable[texture * 4u + 1u], PageTable[texture * 4u + 2u], PageTable[texture * 4u + 3u]);
+	float level = clamp(lod, 0.0, float(description.z - 1u));
+	uint wanted = uint(level) + (random() < fract(level) ? 1u : 0u);
+
+	uv = fract(uv);
+	uint first = description.w;
+	for (uint l = 0u; l < description.z; l++) {
+		uvec2 size = max(description.xy >> l, uvec2(1u));
+		uvec2 tiles = (size + TilePayload - 1u) / TilePayload;
+		if (l >= wanted) {
+			vec2 texel = uv * vec2(size);
+			uvec2 tile = min(uvec2(texel) / TilePayload, tiles - 1u);
+			uint page = first + tile.y * tiles.x + tile.x;
+			uint entry = PageTable[page];
+			if (l == wanted) requestPage(page);
+			if (entry != 0u || l + 1u == description.z) {
+				vec2 slot = vec2(entry & 0xFFFu, (entry >> 12u) & 0xFFFu);
+				vec2 pool = slot * float(TileSize) + float(TileBorder) + texel - vec2(tile * TilePayload);
+				return textureLod(uTilePool, pool / vec2(textureSize(uTilePool, 0)), 0.0);
+			}
+		}
+		first += tiles.x * tiles.y;
+	}
+	return vec4(1.0);
+}
+
+// The albedo wherever a ray hit, with the texture (if there is one) filtered over the cone's footprint //
+// Only triangles have UVs, so primitives just get the plain albedo //
+vec3 hitAlbedo(Material material, Hit hit, vec3 position, vec3 direction, float coneWidth) {
+	if ((!HAS_TEXTURES && !HAS_STREAMED_TEXTURES) || material.texture == NoTexture || hit.instance == PrimitiveHit) return material.albedo.rgb;
+
+	// Barycentrics, in object space where the corners are //
+	mat4x3 worldToObject = transpose(mat3x4(Instances[hit.instance].worldToObject[0], Instances[hit.instance].worldToObject[1], Instances[hit.instance].worldToObject[2]));
+	uvec4 indices = Triangles[hit.triangle];
+	vec4 a = Vertices[indices.x], b = Vertices[indices.y], c = Vertices[indices.z];
+	vec3 edge1 = b.xyz - a.xyz, edge2 = c.xyz - a.xyz, offset = worldToObject * vec4(position, 1.0) - a.xyz;
+	float d11 = dot(edge1, edge1), d12 = dot(edge1, edge2), d22 = dot(edge2, edge2);
+	float d1 = dot(offset, edge1), d2 = dot(offset, edge2);
+	float denominator = max(d11 * d22 - d12 * d12, 1e-30);
+	float v = (d22 * d1 - d12 * d2) / denominator, w = (d11 * d2 - d12 * d1) / denominator;
+
+	vec2 uvA = unpackHalf2x16(floatBitsToUint(a.w)) * material.tiling;
+	vec2 uvB = unpackHalf2x16(floatBitsToUint(b.w)) * material.tiling;
+	vec2 uvC = unpackHalf2x16(floatBitsToUint(c.w)) * material.tiling;
+	vec2 uv = uvA * (1.0 - v - w) + uvB * v + uvC * w;
+
+	// How many texels the triangle covers per unit of world space area, then how much area the cone covers //
+	// (World space area comes from the object space normal, the same way hitNormal transforms it, over the scale's determinant) //
+	// (Without any ordinary textures, every texture has to be streamed) //
+	bool streamed = !HAS_TEXTURES || (HAS_STREAMED_TEXTURES && (material.texture & StreamedTexture) != 0u);
+	vec2 size = streamed ? streamedTextureSize(material.texture & ~StreamedTexture) : materialTextureSize(material);
+	vec2 uvEdge1 = uvB - uvA, uvEdge2 = uvC - uvA;
+	float texelArea = abs(uvEdge1.x * uvEdge2.y - uvEdge1.y * uvEdge2.x) * size.x * size.y;
+	mat3 linear = mat3(worldToObject);
+	vec3 normal = transpose(linear) * cross(edge1, edge2) / max(abs(determinant(linear)), 1e-30);
+	float area = max(length(normal), 1e-30);
+	float cosine = max(abs(dot(normal, direction)) / area, 1e-6);
+	float lod = 0.5 * log2(max(texelArea, 1e-30) / area) + log2(max(coneWidth, 1e-30) / cosine);
+
+	vec4 texel = streamed ? readStreamedTexture(material.texture & ~StreamedTexture, uv, lod) : readMaterialTexture(material, uv, lod);
+	return material.albedo.rgb * texel.rgb;
+}
+
+////////////////////
+// Light Sampling //
+////////////////////
+
+// Every sample comes from either bouncing off a surface or aiming at a light, and both could have found the //
+// same light. Weighting each by how likely it was to find it (the power heuristic) keeps the best of both //
+float powerHeuristic(float pdf, float otherPdf) {
+	pdf *= pdf;
+	otherPdf *= otherPdf;
+	return pdf / max(pdf + otherPdf, 1e-30);
+}
+
+// Picks one of count alias table entries starting at first, reusing the leftover bits of u for the coin flip //
+uint sampleAlias(uint first, uint count, float u) {
+	float scaled = u * float(count);
+	uint entry = min(uint(scaled), count - 1u);
+	AliasEntry alias = EnvironmentTable[first + entry];
+	return scaled - float(entry) < alias.threshold ? entry : alias.alias;
+}
+
+// The gradient's sampled evenly in every direction, & environment maps by how bright each texel is //
+vec3 sampleEnvironment() {
+	if (!HAS_ENVIRONMENT_MAP || uEnvironmentWidth == 0u) {
+		float z = 1.0 - 2.0 * random(), phi = 2.0 * PI * random();
+		float r = sqrt(max(0.0, 1.0 - z * z));
+		return vec3(r * cos(phi), z, r * sin(phi));
+	}
+
+	uint row = sampleAlias(0u, uEnvironmentHeight, random());
+	uint column = sampleAlias(uEnvironmentHeight + row * uEnvironmentWidth, uEnvironmentWidth, random());
+	float theta = PI * (float(row) + random()) / float(uEnvironmentHeight);
+	float phi = 2.0 * PI * (float(column) + random()) / float(uEnvironmentWidth) - uEnvironmentRotation;
+	return vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+// Texels are picked evenly over their (u, v) square, which gets stretched over 2 pi^2 sin(theta) of solid angle //
+float environmentPdf(vec3 direction) {
+	if (!HAS_ENVIRONMENT_MAP || uEnvironmentWidth == 0u) return 1.0 / (4.0 * PI);
+
+	ivec2 texel = environmentTexel(direction);
+	float sinTheta = sqrt(max(0.0, 1.0 - direction.y * direction.y));
+	if (sinTheta <= 0.0) return 0.0;
+	float pdf = EnvironmentTable[texel.y].pdf * EnvironmentTable[uEnvironmentHeight + uint(texel.y) * uEnvironmentWidth + uint(texel.x)].pdf;
+	return pdf / (2.0 * PI * PI * sinTheta);
+}
+
+// cos(max(0, a - b)) & sin(max(0, a - b)), from the sines & cosines of a & b //
+float cosMinus(float sinA, float cosA, float sinB, float cosB) {
+	return cosA > cosB ? 1.0 : cosA * cosB + sinA * sinB;
+}
+
+float sinMinus(float sinA, float cosA, float sinB, float cosB) {
+	return cosA > cosB ? 0.0 : sinA * cosB - cosA * sinB;
+}
+
+// A guess at how much a light tree node lights up a point, which never says 0 if it could be more //
+// Works out the smallest angle any of the node's lights could be at, both from their normals & from the surface's //
+float lightNodeImportance(LightNode node, vec3 position, vec3 normal) {
+	vec3 centre = (node.min + node.max) * 0.5;
+	vec3 toPoint = position - centre;
+	float distanceSquared = dot(toPoint, toPoint);
+	float radiusSquared = dot(node.max - centre, node.max - centre);
+	vec3 direction = toPoint / sqrt(max(distanceSquared, 1e-30));
+
+	// How wide the node's bounds look from the point (all directions if it's inside them) //
+	float sinBoundsSquared = radiusSquared / max(distanceSquared, 1e-30);
+	float cosBounds = sinBoundsSquared < 1.0 ? sqrt(1.0 - sinBoundsSquared) : -1.0;
+	float sinBounds = sqrt(max(0.0, 1.0 - cosBounds * cosBounds));
+
+	// The lights are two sided, so the point is as far from the cone as it is from the nearer of axis & -axis //
+	float cosAxis = abs(dot(node.axis, direction));
+	float sinAxis = sqrt(max(0.0, 1.0 - cosAxis * cosAxis));
+	float sinSpread = sqrt(max(0.0, 1.0 - node.cosSpread * node.cosSpread));
+	float cosOutside = cosMinus(sinAxis, cosAxis, sinSpread, node.cosSpread);
+	float sinOutside = sinMinus(sinAxis, cosAxis, sinSpread, node.cosSpread);
+	float cosLight = cosMinus(sinOutside, cosOutside, sinBounds, cosBounds);
+	if (cosLight <= node.cosEmit) return 0.0;
+
+	float cosSurface = dot(normal, -direction);
+	float sinSurface = sqrt(max(0.0, 1.0 - cosSurface * cosSurface));
+	cosSurface = cosMinus(sinSurface, cosSurface, sinBounds, cosBounds);
+
+	// Don't let points right next to (or inside) the node blow up //
+	return max(0.0, node.power * cosLight * cosSurface / max(distanceSquared, radiusSquared));
+}
+
+// Walks down the light tree, picking each child in proportion to its importance //
+// chance ends up as how likely the light was to be picked (or 0 if nothing nearby can light the point) //
+uint pickLight(vec3 position, vec3 normal, float u, out float chance) {
+	uint node = 0u;
+	chance = 1.0;
+	while (LightNodes[node].leaf == 0u) {
+		uint left = LightNodes[node].leftOrLight;
+		float leftImportance = lightNodeImportance(LightNodes[left], position, normal);
+		float rightImportance = lightNodeImportance(LightNodes[left + 1u], position, normal);
+		float total = leftImportance + rightImportance;
+		if (total <= 0.0) { chance = 0.0; return 0u; }
+
+		// Reuse u for the next level down, by stretching whichever part of it was used back out to [0, 1) //
+		float leftChance = leftImportance / total;
+		if (u < leftChance) {
+			node = left;
+			u = min(u / leftChance, 0.99999994);
+			chance *= leftChance;
+		} else {
+			node = left + 1u;
+			u = min((u - leftChance) / (1.0 - leftChance), 0.99999994);
+			chance *= 1.0 - leftChance;
+		}
+	}
+	return LightNodes[node].leftOrLight;
+}
+
+// How likely pickLight is to pick a light, found by following its trail back down the tree //
+float lightPickChance(uint light, vec3 position, vec3 normal) {
+	uint trail = Lights[light].trail;
+	if (trail == 0u || uEnvironmentChance >= 1.0) return 0.0;
+
+	uint node = 0u;
+	float chance = 1.0 - uEnvironmentChance;
+	for (; trail > 1u; trail >>= 1u) {
+		uint left = LightNodes[node].leftOrLight;
+		float leftImportance = lightNodeImportance(LightNodes[left], position, normal);
+		float rightImportance = lightNodeImportance(LightNodes[left + 1u], position, normal);
+		float total = leftImportance + rightImportance;
+		if (total <= 0.0) return 0.0;
+
+		node = left + (trail & 1u);
+		chance *= ((trail & 1u) == 0u ? leftImportance : rightImportance) / total;
+	}
+	return chance;
+}
+
+// How much of the view a sphere takes up, as 1 - the cosine of the cone around it (0 from inside it) //
+// (Written this way so tiny far away spheres don't round down to nothing) //
+float sphereConeWidth(vec3 position, vec4 sphere) {
+	vec3 toCentre = sphere.xyz - position;
+	float sinSquared = sphere.w * sphere.w / dot(toCentre, toCentre);
+	if (sinSquared >= 1.0) return 0.0;
+	return sinSquared / (1.0 + sqrt(1.0 - sinSquared));
+}
+
+// The chance (per unit solid angle) of light sampling from position (facing shadingNormal) landing on point, with the given normal //
+float lightPdf(uint light, vec3 position, vec3 shadingNormal, vec3 point, vec3 normal) {
+	Light l = Lights[light];
+	float chance = lightPickChance(light, position, shadingNormal);
+	if (HAS_SPHERE_LIGHTS && uint(l.b.w) == SPHERE_LIGHT) {
+		float width = sphereConeWidth(position, l.a);
+		return width > 0.0 ? chance / (2.0 * PI * width) : 0.0;
+	}
+
+	// Triangles & disks are sampled evenly over their area, which gets squashed by distance & angle //
+	vec3 toPoint = point - position;
+	float distanceSquared = dot(toPoint, toPoint);
+	float cosine = abs(dot(normal, toPoint)) / sqrt(distanceSquared);
+	return cosine > 0.0 ? chance * distanceSquared / (l.c.w * cosine) : 0.0;
+}
+
+// Same as lightPdf, but for something a bounce happened to hit (0 if it's not something we ever aim at) //
+float hitLightPdf(Hit hit, vec3 origin, vec3 originNormal, vec3 position, vec3 normal) {
+	if (!HAS_LIGHTS || uLightCount == 0u) return 0.0;
+	uint light;
+	if (hit.instance == PrimitiveHit) {
+		float index = PrimitiveExtras[hit.triangle].w;
+		if (index < 0.0) return 0.0;
+		light = uint(index);
+	} else {
+		light = Instances[hit.instance].lightBase + hit.triangle;
+	}
+	return lightPdf(light, origin, originNormal, position, normal);
+}
+
+// Picks somewhere on a light (or the sky) to aim at from position //
+bool sampleLight(vec3 position, vec3 shadingNormal, out vec3 direction, out float distance, out vec3 radiance, out float pdf) {
+	if (!HAS_LIGHTS || uLightCount == 0u || random() < uEnvironmentChance) {
+		direction = sampleEnvironment();
+		distance = Infinity;
+		radiance = sky(direction);
+		pdf = uEnvironmentChance * environmentPdf(direction);
+		return pdf > 0.0;
+	}
+
+	float chance;
+	uint light = pickLight(position, shadingNormal, random(), chance);
+	if (chance <= 0.0) return false;
+	chance *= 1.0 - uEnvironmentChance;
+	Light l = Lights[light];
+	uint type = uint(l.b.w);
+	radiance = l.emission.rgb;
+
+	// Spheres: pick a direction inside the cone they cover, so none get wasted on the far side //
+	if (HAS_SPHERE_LIGHTS && type == SPHERE_LIGHT) {
+		float width = sphereConeWidth(position, l.a);
+		if (width <= 0.0) return false;
+		float cosTheta = 1.0 - random() * width, phi = 2.0 * PI * random();
+		float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+		direction = basis(normalize(l.a.xyz - position)) * vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+
+		vec3 offset = position - l.a.xyz;
+		float b = dot(offset, direction);
+		distance = -b - sqrt(max(0.0, b * b - dot(offset, offset) + l.a.w * l.a.w));
+		pdf = chance / (2.0 * PI * width);
+		return true;
+	}
+
+	vec3 point, normal;
+	if (HAS_TRIANGLE_LIGHTS && (!HAS_DISK_LIGHTS || type == TRIANGLE_LIGHT)) {
+		float s = sqrt(random()), t = random();
+		point = l.a.xyz * (1.0 - s) + l.b.xyz * (s * (1.0 - t)) + l.c.xyz * (s * t);
+		normal = normalize(cross(l.b.xyz - l.a.xyz, l.c.xyz - l.a.xyz));
+	} else {
+		float r = l.a.w * sqrt(random()), phi = 2.0 * PI * random();
+		point = l.a.xyz + basis(l.b.xyz) * vec3(r * cos(phi), r * sin(phi), 0.0);
+		normal = l.b.xyz;
+	}
+
+	vec3 toPoint = point - position;
+	distance = length(toPoint);
+	direction = toPoint / distance;
+	float distanceSquared = distance * distance;
+	float cosine = abs(dot(normal, direction));
+	pdf = cosine > 0.0 ? chance * distanceSquared / (l.c.w * cosine) : 0.0;
+	return pdf > 0.0;
+}
+
+/////////////
+// Shading //
+/////////////
+
+// Picks a direction around the normal, more likely the closer it is to the normal //
+vec3 cosineDirection(vec3 normal) {
+	float r = sqrt(random()), phi = 2.0 * PI * random();
+	return normalize(basis(normal) * vec3(r * cos(phi), r * sin(phi), sqrt(max(0.0, 1.0 - r * r))));
+}
+
+// Next event estimation: aim straight at a light, & count it if nothing's in the way //
+vec3 directLight(vec3 position, vec3 normal, vec3 albedo) {
+	vec3 direction, radiance;
+	float distance, pdf;
+	if (!sampleLight(position, normal, direction, distance, radiance, pdf)) return vec3(0.0);
+
+	float cosine = dot(normal, direction);
+	if (cosine <= 0.0) return vec3(0.0);
+
+	// Stop the shadow ray just short of the light, so it doesn't count as its own blocker //
+	float tMax = distance * (1.0 - 1e-3);
+	if (intersectScene(position, direction, tMax).t < tMax) return vec3(0.0);
+
+	return albedo / PI * radiance * cosine / pdf * powerHeuristic(pdf, cosine / PI);
+}
+
+vec3 trace(vec3 origin, vec3 direction) {
+	vec3 color = vec3(0.0), throughput = vec3(1.0);
+
+	// How likely the last bounce was to pick this direction (0 for camera rays, which always count in full) //
+	// The light tree picks differently depending on the surface's normal, so that has to be kept too //
+	float bouncePdf = 0.0;
+	vec3 bounceNormal = vec3(0.0);
+
+	// Camera rays start out as a point, spreading out by a pixel's worth (uv goes from -1 to 1 over uHeight pixels) //
+	float coneWidth = 0.0, coneSpread = 2.0 / uHeight;
+
+	for (uint bounce = 0u; bounce <= MAX_BOUNCES; bounce++) {
+		if (uBounceStats != 0u) atomicAdd(PathsAlive[bounce], 1u);
+
+		Hit hit = intersectScene(origin, direction, Infinity);
+		if (hit.t == Infinity) {
+			float weight = bouncePdf > 0.0 ? powerHeuristic(bouncePdf, uEnvironmentChance * environmentPdf(direction)) : 1.0;
+			color += throughput * sky(direction) * weight;
+			break;
+		}
+
+		Material material = Materials[hitMaterial(hit)];
+		vec3 position = origin + direction * hit.t;
+		vec3 normal = hitNormal(hit, position);
+		coneWidth += coneSpread * hit.t;
+
+		// Light sampling might have found this already, so only count the bounce's share //
+		if (dot(material.emission.rgb, vec3(1.0)) > 0.0) {
+			float weight = bouncePdf > 0.0 ? powerHeuristic(bouncePdf, hitLightPdf(hit, origin, bounceNormal, position, normal)) : 1.0;
+			color += throughput * material.emission.rgb * weight;
+		}
+
+		// The last bounce doesn't go anywhere, so it doesn't sample lights either (or they'd be counted without their other half) //
+		if (bounce == MAX_BOUNCES) break;
+
+		// Everything's two sided, so flip the normal to face the ray //
+		if (dot(normal, direction) > 0.0) normal = -normal;
+		origin = position + normal * Epsilon;
+		vec3 albedo = hitAlbedo(material, hit, position, direction, coneWidth);
+		color += throughput * directLight(origin, normal, albedo);
+
+		// Diffuse bounce (cosine sampling cancels out the cosine & the pdf, leaving just the albedo) //
+		direction = cosineDirection(normal);
+		bouncePdf = max(dot(normal, direction), 0.0) / PI;
+		bounceNormal = normal;
+		coneSpread = max(coneSpread, DiffuseConeSpread);
+		throughput *= albedo;
+
+		// Russian roulette: past the minimum depth, paths only keep going with a chance matching how much they can //
+		// still add, & the ones that do get brighter to make up for the ones that didn't (so it all averages out) //
+		if (bounce >= MIN_BOUNCES) {
+			float survival = min(max(throughput.r, max(throughput.g, throughput.b)), 1.0);
+			if (random() >= survival) break;
+			throughput /= survival;
+		}
+	}
+
+	return color;
+}
 
 void main() {
-	
+	// Seed the random numbers with the pixel & frame so no two samples line up //
+	RandomState = hash(uint(gl_FragCoord.x) + hash(uint(gl_FragCoord.y) + hash(uFrame)));
+	FeedbackPixel = hash(RandomState) % FeedbackSparsity == 0u;
+
+	// Trace however many samples the frame pacer gave us this frame //
+	vec3 color = vec3(0.0);
+	for (uint i = 0u; i < uSamples; i++) {
+		vec2 pixel = gl_FragCoord.xy + vec2(random(), random()) - 0.5;
+		vec2 uv = (pixel / vec2(uWidth, uHeight)) * 2.0 - 1.0;
+		vec3 direction = normalize(uCameraRotationMatrix * vec3(uv.x * uAspectRatio, uv.y, 1.0));
+		color += trace(uCameraPosition, direction);
+	}
+
+	// Output the sum & the sample count, blending adds them onto what's already accumulated //
+	FragColor = vec4(color, float(uSamples));
 }
\ No newline at end of file
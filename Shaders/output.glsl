@@ -0,0 +1,59 @@
+#version 330 core
+
+// Uniforms //
+uniform sampler2D uAccumulation;
+uniform vec2 uRenderSize;
+
+// Which part of the window the view covers, in pixels //
+uniform vec2 uViewOrigin;
+uniform vec2 uViewSize;
+
+// Output //
+out vec4 FragColor;
+
+// How strongly differences in brightness cut the filter off at an edge //
+const float EdgeSharpness = 8.0;
+
+// Reads one accumulated pixel and averages its samples //
+vec3 fetch(ivec2 pixel) {
+	vec4 accumulated = texelFetch(uAccumulation, clamp(pixel, ivec2(0), ivec2(uRenderSize) - 1), 0);
+	return accumulated.rgb / max(accumulated.a, 1.0);
+}
+
+float luminance(vec3 color) {
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+void main() {
+	// At full resolution every view pixel has exactly one render pixel //
+	vec2 pixel = gl_FragCoord.xy - uViewOrigin;
+	if (uRenderSize == uViewSize) {
+		FragColor = vec4(fetch(ivec2(pixel)), 1.0);
+		return;
+	}
+
+	// Work out where this view pixel lands in the smaller render //
+	vec2 position = pixel * uRenderSize / uViewSize - 0.5;
+	ivec2 base = ivec2(floor(position));
+	vec2 f = position - vec2(base);
+
+	// The nearest render pixel decides which side of an edge we're on //
+	float reference = luminance(fetch(ivec2(floor(position + 0.5))));
+
+	// Bilinear filtering, except neighbours that look too different get their weight cut //
+	// That keeps edges crisp instead of smearing them across the upscaled pixels //
+	vec3 color = vec3(0.0);
+	float totalWeight = 0.0;
+	for (int y = 0; y <= 1; y++) {
+		for (int x = 0; x <= 1; x++) {
+			vec3 neighbour = fetch(base + ivec2(x, y));
+			float bilinear = (x == 1 ? f.x : 1.0 - f.x) * (y == 1 ? f.y : 1.0 - f.y);
+			float difference = abs(luminance(neighbour) - reference) / (reference + 0.05);
+			float weight = bilinear * exp(-EdgeSharpness * difference) + 1e-4;
+			color += neighbour * weight;
+			totalWeight += weight;
+		}
+	}
+
+	FragColor = vec4(color / totalWeight, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+// Specialization //
+// Source/shaders.cpp defines these to match whatever's actually in the scene, so the compiler can throw away every //
+// branch the scene can't take (see traceDefines). Anything left undefined falls back to handling everything, so this //
+// file still works as it is, just slower //
+
+#ifdef GL_SPIRV
+// Precompiled SPIR-V can't be handed defines, so there these are specialization constants instead, with the same //
+// names (which is how Source/shaders.cpp matches them up, so their numbers don't matter). Every one of them always //
+// gets set, so the defaults are only here because GLSL needs one (the bounce limits' match Source/renderer.h's) //
+layout(constant_id = 0) const uint MIN_BOUNCES = 3u;
+layout(constant_id = 1) const uint MAX_BOUNCES = 8u;
+layout(constant_id = 2) const bool HAS_MESHES = true;
+layout(constant_id = 3) const bool HAS_FULL_NODES = true;
+layout(constant_id = 4) const bool HAS_WIDE_NODES = true;
+layout(constant_id = 5) const bool HAS_PLANES = true;
+layout(constant_id = 6) const bool HAS_PRIMITIVE_BVH = true;
+layout(constant_id = 7) const bool HAS_SPHERES = true;
+layout(constant_id = 8) const bool HAS_BOXES = true;
+layout(constant_id = 9) const bool HAS_DISKS = true;
+layout(constant_id = 10) const bool HAS_TEXTURES = true;
+layout(constant_id = 11) const bool HAS_STREAMED_TEXTURES = true;
+layout(constant_id = 12) const bool HAS_ENVIRONMENT_MAP = true;
+layout(constant_id = 13) const bool HAS_LIGHTS = true;
+layout(constant_id = 14) const bool HAS_TRIANGLE_LIGHTS = true;
+layout(constant_id = 15) const bool HAS_SPHERE_LIGHTS = true;
+layout(constant_id = 16) const bool HAS_DISK_LIGHTS = true;
+#else
+
+// Bounce limits become constants, so the bounce loop has a fixed trip count //
+#ifndef MIN_BOUNCES
+#define MIN_BOUNCES uMinBounces
+#endif
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES uMaxBounces
+#endif
+
+// Geometry: meshes in either node layout, planes, the primitive BVH & which kinds of primitive are in it //
+#ifndef HAS_MESHES
+#define HAS_MESHES true
+#endif
+#ifndef HAS_FULL_NODES
+#define HAS_FULL_NODES true
+#endif
+#ifndef HAS_WIDE_NODES
+#define HAS_WIDE_NODES true
+#endif
+#ifndef HAS_PLANES
+#define HAS_PLANES true
+#endif
+#ifndef HAS_PRIMITIVE_BVH
+#define HAS_PRIMITIVE_BVH true
+#endif
+#ifndef HAS_SPHERES
+#define HAS_SPHERES true
+#endif
+#ifndef HAS_BOXES
+#define HAS_BOXES true
+#endif
+#ifndef HAS_DISKS
+#define HAS_DISKS true
+#endif
+
+// Materials: ordinary textures, streamed ones, or none at all //
+#ifndef HAS_TEXTURES
+#define HAS_TEXTURES true
+#endif
+#ifndef HAS_STREAMED_TEXTURES
+#define HAS_STREAMED_TEXTURES true
+#endif
+
+// Lighting: an environment map (rather than the gradient), & which kinds of light there are to aim at //
+#ifndef HAS_ENVIRONMENT_MAP
+#define HAS_ENVIRONMENT_MAP true
+#endif
+#ifndef HAS_LIGHTS
+#define HAS_LIGHTS true
+#endif
+#ifndef HAS_TRIANGLE_LIGHTS
+#define HAS_TRIANGLE_LIGHTS true
+#endif
+#ifndef HAS_SPHERE_LIGHTS
+#define HAS_SPHERE_LIGHTS true
+#endif
+#ifndef HAS_DISK_LIGHTS
+#define HAS_DISK_LIGHTS true
+#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,492 @@
+#include "bvh.h"
+#include "parallel.h"
+
+#include <cassert>
+
+/////////
+// BVH //
+/////////
+
+// How many buckets the primitives get sorted into when looking for a split //
+// More bins find slightly better splits, but take longer to evaluate //
+const int BinCount = 16;
+
+// Relative cost of stepping through a node vs intersecting a primitive //
+const float TraversalCost = 1.0f;
+const float IntersectionCost = 1.0f;
+
+AABB nodeBounds(const BVHNode& node) {
+	AABB bounds;
+	bounds.min = {node.min[0], node.min[1], node.min[2]};
+	bounds.max = {node.max[0], node.max[1], node.max[2]};
+	return bounds;
+}
+
+static void setBounds(BVHNode& node, const AABB& bounds) {
+	for (int axis = 0; axis < 3; axis++) {
+		node.min[axis] = bounds.min[axis];
+		node.max[axis] = bounds.max[axis];
+	}
+}
+
+BVH buildBVH(const std::vector<AABB>& bounds, unsigned int maxLeafSize) {
+	BVH bvh;
+	unsigned int primitiveCount = (unsigned int)bounds.size();
+	bvh.order.resize(primitiveCount);
+	for (unsigned int i = 0; i < primitiveCount; i++) bvh.order[i] = i;
+
+	// Centroids get used a lot, so work them out once //
+	std::vector<Vec3> centroids(primitiveCount);
+	for (unsigned int i = 0; i < primitiveCount; i++) centroids[i] = bounds[i].centre();
+
+	// A BVH with n leaves has 2n - 1 nodes, and there's at most one primitive per leaf //
+	bvh.nodes.reserve(primitiveCount > 0 ? primitiveCount * 2 - 1 : 1);
+	bvh.nodes.push_back({{0, 0, 0}, 0, {0, 0, 0}, primitiveCount});
+
+	// Empty scenes still get a (degenerate) root so the shader has something to look at //
+	if (primitiveCount == 0) return bvh;
+
+	// Nodes get split until they're small enough or splitting stops helping //
+	std::vector<unsigned int> stack = {0};
+	while (!stack.empty()) {
+		unsigned int nodeIndex = stack.back();
+		stack.pop_back();
+		unsigned int first = bvh.nodes[nodeIndex].leftOrFirst, count = bvh.nodes[nodeIndex].count;
+
+		// Work out the bounds of everything in the node, and of their centroids //
+		AABB nodeBox, centroidBox;
+		for (unsigned int i = first; i < first + count; i++) {
+			nodeBox.grow(bounds[bvh.order[i]]);
+			centroidBox.grow(centroids[bvh.order[i]]);
+		}
+		setBounds(bvh.nodes[nodeIndex], nodeBox);
+		if (count <= 1) continue;
+
+		// Sort the centroids into bins along each axis, and find the split with the lowest SAH cost //
+		float bestCost = std::numeric_limits<float>::max();
+		int bestAxis = -1, bestBin = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float low = centroidBox.min[axis], high = centroidBox.max[axis];
+			if (high <= low) continue;
+			float scale = BinCount / (high - low);
+
+			AABB binBounds[BinCount];
+			unsigned int binCounts[BinCount] = {};
+			for (unsigned int i = first; i < first + count; i++) {
+				int bin = std::min(BinCount - 1, (int)((centroids[bvh.order[i]][axis] - low) * scale));
+				binCounts[bin]++;
+				binBounds[bin].grow(bounds[bvh.order[i]]);
+			}
+
+			// Sweep from both ends so every split's cost comes out in one pass each way //
+			float leftArea[BinCount - 1], rightArea[BinCount - 1];
+			unsigned int leftCount[BinCount - 1], rightCount[BinCount - 1];
+			AABB leftBox, rightBox;
+			unsigned int leftSum = 0, rightSum = 0;
+			for (int i = 0; i < BinCount - 1; i++) {
+				leftSum += binCounts[i];
+				leftCount[i] = leftSum;
+				leftBox.grow(binBounds[i]);
+				leftArea[i] = leftBox.halfArea();
+
+				rightSum += binCounts[BinCount - 1 - i];
+				rightCount[BinCount - 2 - i] = rightSum;
+				rightBox.grow(binBounds[BinCount - 1 - i]);
+				rightArea[BinCount - 2 - i] = rightBox.halfArea();
+			}
+
+			for (int i = 0; i < BinCount - 1; i++) {
+				if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+				float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+				if (cost < bestCost) { bestCost = cost; bestAxis = axis; bestBin = i; }
+			}
+		}
+
+		// Turn the cost into the same units as a leaf & see if splitting is actually worth it //
+		// (Big leaves get split no matter what, since they're awful to traverse) //
+		float parentArea = nodeBox.halfArea();
+		float splitCost = TraversalCost + IntersectionCost * (parentArea > 0 ? bestCost / parentArea : count);
+		float leafCost = IntersectionCost * count;
+		unsigned int middle;
+		if (bestAxis != -1 && (splitCost < leafCost || count > maxLeafSize)) {
+			float low = centroidBox.min[bestAxis], scale = BinCount / (centroidBox.max[bestAxis] - low);
+			auto split = std::partition(bvh.order.begin() + first, bvh.order.begin() + first + count, [&](unsigned int primitive) {
+				return std::min(BinCount - 1, (int)((centroids[primitive][bestAxis] - low) * scale)) <= bestBin;
+			});
+			middle = (unsigned int)(split - bvh.order.begin());
+		} else if (count > maxLeafSize) {
+			// All the centroids are in the same spot, so just cut the list in half //
+			middle = first + count / 2;
+		} else {
+			continue;
+		}
+
+		// Children always go next to each other, so the parent only needs to know where the left one is //
+		unsigned int left = (unsigned int)bvh.nodes.size();
+		bvh.nodes.push_back({{0, 0, 0}, first, {0, 0, 0}, middle - first});
+		bvh.nodes.push_back({{0, 0, 0}, middle, {0, 0, 0}, first + count - middle});
+		bvh.nodes[nodeIndex].leftOrFirst = left;
+		bvh.nodes[nodeIndex].count = 0;
+		stack.push_back(left);
+		stack.push_back(left + 1);
+	}
+
+	return bvh;
+}
+
+/////////////////////
+// Compressed BVHs //
+/////////////////////
+
+const unsigned int WideNodeWidth = 8;
+static_assert(CompressedLeafSize <= 7 && WideNodeWidth * CompressedLeafSize <= 32, "A full wide node's leaves have to fit in meta's offsets");
+
+// Fills in one wide node's corner, step sizes & quantized child boxes //
+// Boxes only ever get rounded outwards, so they still contain everything they're meant to //
+static void quantizeChildren(WideBVHNode& node, const AABB* children, unsigned int childCount) {
+	AABB box;
+	for (unsigned int i = 0; i < childCount; i++) box.grow(children[i]);
+
+	for (int axis = 0; axis < 3; axis++) {
+		node.origin[axis] = box.min[axis];
+
+		// Find the smallest power of two step that covers the node in 255 steps //
+		float extent = box.max[axis] - box.min[axis];
+		int exponent = extent > 0 ? (int)std::ceil(std::log2(extent / 255)) : -126;
+		exponent = std::clamp(exponent, -126, 127);
+		while (exponent < 127 && box.min[axis] + 255 * std::ldexp(1.0f, exponent) < box.max[axis]) exponent++;
+		float step = std::ldexp(1.0f, exponent);
+		node.exponent[axis] = (unsigned char)(exponent + 127);
+
+		for (unsigned int i = 0; i < childCount; i++) {
+			int low = std::clamp((int)std::floor((children[i].min[axis] - box.min[axis]) / step), 0, 255);
+			int high = std::clamp((int)std::ceil((children[i].max[axis] - box.min[axis]) / step), 0, 255);
+			while (low > 0 && box.min[axis] + low * step > children[i].min[axis]) low--;
+			while (high < 255 && box.min[axis] + high * step < children[i].max[axis]) high++;
+			node.low[axis][i] = (unsigned char)low;
+			node.high[axis][i] = (unsigned char)high;
+		}
+	}
+}
+
+WideBVH compressBVH(const BVH& bvh) {
+	WideBVH wide;
+	wide.nodes.push_back({});
+
+	// Wide nodes come out breadth first, so every node's interior children end up next to each other //
+	std::vector<std::pair<unsigned int, unsigned int>> work = {{0, 0}};
+	for (size_t w = 0; w < work.size(); w++) {
+		auto [binaryIndex, wideIndex] = work[w];
+
+		// Start with the binary node's children, then keep opening the biggest interior one until we run out of room //
+		// (A root that's already a leaf just becomes a wide node with one leaf child) //
+		const BVHNode& binary = bvh.nodes[binaryIndex];
+		std::vector<unsigned int> children;
+		if (binary.count > 0) children = {binaryIndex};
+		else children = {binary.leftOrFirst, binary.leftOrFirst + 1};
+		while (children.size() < WideNodeWidth) {
+			int best = -1;
+			float bestArea = -1;
+			for (size_t i = 0; i < children.size(); i++) {
+				const BVHNode& child = bvh.nodes[children[i]];
+				float area = nodeBounds(child).halfArea();
+				if (child.count == 0 && area > bestArea) { best = (int)i; bestArea = area; }
+			}
+			if (best == -1) break;
+			unsigned int opened = bvh.nodes[children[best]].leftOrFirst;
+			children[best] = opened;
+			children.push_back(opened + 1);
+		}
+
+		WideBVHNode node = {};
+		AABB childBounds[WideNodeWidth];
+		for (size_t i = 0; i < children.size(); i++) childBounds[i] = nodeBounds(bvh.nodes[children[i]]);
+		quantizeChildren(node, childBounds, (unsigned int)children.size());
+
+		node.firstChild = (unsigned int)wide.nodes.size();
+		node.firstPrimitive = (unsigned int)wide.order.size();
+		unsigned int leafOffset = 0;
+		for (size_t i = 0; i < children.size(); i++) {
+			const BVHNode& child = bvh.nodes[children[i]];
+			if (child.count == 0) {
+				node.interiorMask |= 1 << i;
+				work.push_back({children[i], (unsigned int)wide.nodes.size()});
+				wide.nodes.push_back({});
+			} else {
+				assert(child.count <= 7 && leafOffset + child.count <= 32);
+				node.meta[i] = (unsigned char)(child.count << 5 | leafOffset);
+				for (unsigned int p = child.leftOrFirst; p < child.leftOrFirst + child.count; p++) wide.order.push_back(p);
+				leafOffset += child.count;
+			}
+		}
+		wide.nodes[wideIndex] = node;
+	}
+
+	return wide;
+}
+
+///////////
+// Refit //
+///////////
+
+// One node's share of the SAH cost, before dividing by the root's area //
+static float nodeCost(const BVHNode& node) {
+	float area = nodeBounds(node).halfArea();
+	return node.count > 0 ? IntersectionCost * node.count * area : TraversalCost * area;
+}
+
+BVHRefit prepareRefit(const BVHNode* nodes, unsigned int nodeCount, unsigned int nodeOffset) {
+	BVHRefit refit;
+	refit.parents.assign(nodeCount, 0);
+	refit.depths.assign(nodeCount, 0);
+	refit.marked.assign(nodeCount, 0);
+	refit.costChanges.assign(nodeCount, 0);
+
+	// Children always come after their parents, so one pass from the root fills everything in //
+	unsigned int maxDepth = 0;
+	for (unsigned int i = 0; i < nodeCount; i++) {
+		refit.surfaceCost += nodeCost(nodes[i]);
+		if (nodes[i].count > 0) continue;
+		unsigned int left = nodes[i].leftOrFirst - nodeOffset;
+		for (unsigned int child = left; child < left + 2; child++) {
+			refit.parents[child] = i;
+			refit.depths[child] = refit.depths[i] + 1;
+			maxDepth = std::max(maxDepth, refit.depths[child]);
+		}
+	}
+	refit.levels.resize(maxDepth + 1);
+	refit.builtCost = refitCost(nodes, refit);
+	return refit;
+}
+
+float refitCost(const BVHNode* nodes, const BVHRefit& refit) {
+	float rootArea = nodeBounds(nodes[0]).halfArea();
+	return rootArea > 0 ? (float)(refit.surfaceCost / rootArea) : 0;
+}
+
+void refitBVH(BVHNode* nodes, unsigned int nodeOffset, BVHRefit& refit, const std::vector<unsigned int>& dirtyLeaves,
+	const std::function<AABB(const BVHNode&)>& leafBounds, std::vector<unsigned int>& touched) {
+	touched.clear();
+
+	// Walk up from every dirty leaf, stopping as soon as we hit a path someone else already took //
+	// That way the work only depends on how much moved, not on how big the whole tree is //
+	for (unsigned int leaf : dirtyLeaves) {
+		unsigned int node = leaf;
+		while (!refit.marked[node]) {
+			refit.marked[node] = 1;
+			refit.levels[refit.depths[node]].push_back(node);
+			touched.push_back(node);
+			if (node == 0) break;
+			node = refit.parents[node];
+		}
+	}
+
+	// Every node on a level only depends on the level below it, so each level can go in parallel //
+	for (size_t depth = refit.levels.size(); depth-- > 0;) {
+		std::vector<unsigned int>& level = refit.levels[depth];
+		parallelFor(level.size(), 64, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				BVHNode& node = nodes[level[i]];
+				float oldCost = nodeCost(node);
+				if (node.count > 0) {
+					setBounds(node, leafBounds(node));
+				} else {
+					AABB bounds = nodeBounds(nodes[node.leftOrFirst - nodeOffset]);
+					bounds.grow(nodeBounds(nodes[node.leftOrFirst - nodeOffset + 1]));
+					setBounds(node, bounds);
+				}
+				refit.costChanges[level[i]] = nodeCost(node) - oldCost;
+			}
+		});
+		level.clear();
+	}
+
+	// Tally up how much the cost moved, & reset the marks for next time //
+	for (unsigned int node : touched) {
+		refit.surfaceCost += refit.costChanges[node];
+		refit.marked[node] = 0;
+	}
+}
+
+/////////////////
+// Light Trees //
+/////////////////
+
+const float PI = 3.14159265358979f;
+
+// Trails only have 32 bits, one of which marks where they end //
+const unsigned int MaxLightDepth = 31;
+
+struct LightBuild {
+	unsigned int node, first, count, depth, trail;
+};
+
+static float safeAcos(float x) {
+	return std::acos(std::clamp(x, -1.0f, 1.0f));
+}
+
+// Spins v around a (unit) axis by angle, using Rodrigues' formula //
+static Vec3 rotate(Vec3 v, Vec3 axis, float angle) {
+	float c = std::cos(angle), s = std::sin(angle);
+	return v * c + cross(axis, v) * s + axis * (dot(axis, v) * (1 - c));
+}
+
+// Smallest cone that covers both a's cone & b's //
+// Lights are two sided, so b's axis can be flipped to whichever way lines up better with a's //
+static void mergeCones(LightBounds& a, const LightBounds& b) {
+	Vec3 axis = dot(a.axis, b.axis) < 0 ? b.axis * -1 : b.axis;
+	float thetaA = safeAcos(a.cosSpread), thetaB = safeAcos(b.cosSpread), between = safeAcos(dot(a.axis, axis));
+	if (std::min(between + thetaB, PI) <= thetaA) return;
+	if (std::min(between + thetaA, PI) <= thetaB) { a.axis = axis; a.cosSpread = b.cosSpread; return; }
+
+	// Otherwise the new cone goes from a's far edge to b's far edge, so its axis is a's, turned towards b's //
+	float theta = (thetaA + between + thetaB) / 2;
+	Vec3 turn = cross(a.axis, axis);
+	if (theta >= PI || dot(turn, turn) == 0) { a.cosSpread = -1; return; }
+	a.axis = normalize(rotate(a.axis, normalize(turn), theta - thetaA));
+	a.cosSpread = std::cos(theta);
+}
+
+static void mergeLights(LightBounds& a, const LightBounds& b) {
+	if (b.power <= 0) return;
+	if (a.power <= 0) { a = b; return; }
+	a.bounds.grow(b.bounds);
+	mergeCones(a, b);
+	a.cosEmit = std::min(a.cosEmit, b.cosEmit);
+	a.power += b.power;
+}
+
+// How much of the sphere of directions a cone lights up, weighted by cosine (the "M_Omega" term of the heuristic) //
+static float orientationCost(float cosSpread, float cosEmit) {
+	float thetaSpread = safeAcos(cosSpread), thetaEmit = safeAcos(cosEmit);
+	float thetaMax = std::min(thetaSpread + thetaEmit, PI);
+	float sinSpread = std::sqrt(std::max(0.0f, 1 - cosSpread * cosSpread));
+	return 2 * PI * (1 - cosSpread) + PI / 2 * (2 * thetaMax * sinSpread - std::cos(thetaSpread - 2 * thetaMax) - 2 * thetaSpread * sinSpread + cosSpread);
+}
+
+static float lightCost(const LightBounds& light) {
+	return light.power * orientationCost(light.cosSpread, light.cosEmit) * light.bounds.halfArea();
+}
+
+LightTree buildLightTree(const std::vector<LightBounds>& lights) {
+	LightTree tree;
+	tree.trails.assign(lights.size(), 0);
+
+	std::vector<unsigned int> order;
+	for (unsigned int i = 0; i < lights.size(); i++) {
+		if (lights[i].power > 0) order.push_back(i);
+	}
+	if (order.empty()) return tree;
+
+	unsigned int lightCount = (unsigned int)order.size();
+	std::vector<Vec3> centroids(lights.size());
+	for (unsigned int light : order) centroids[light] = lights[light].bounds.centre();
+
+	tree.nodes.reserve(lightCount * 2 - 1);
+	tree.nodes.push_back({});
+	std::vector<LightBuild> stack = {{0, 0, lightCount, 0, 0}};
+	while (!stack.empty()) {
+		LightBuild build = stack.back();
+		stack.pop_back();
+
+		LightBounds nodeLight;
+		AABB centroidBox;
+		for (unsigned int i = build.first; i < build.first + build.count; i++) {
+			mergeLights(nodeLight, lights[order[i]]);
+			centroidBox.grow(centroids[order[i]]);
+		}
+
+		LightTreeNode& node = tree.nodes[build.node];
+		for (int axis = 0; axis < 3; axis++) {
+			node.min[axis] = nodeLight.bounds.min[axis];
+			node.max[axis] = nodeLight.bounds.max[axis];
+			node.axis[axis] = nodeLight.axis[axis];
+		}
+		node.power = nodeLight.power;
+		node.cosSpread = nodeLight.cosSpread;
+		node.cosEmit = nodeLight.cosEmit;
+
+		if (build.count == 1) {
+			node.leftOrLight = order[build.first];
+			node.leaf = 1;
+			tree.trails[order[build.first]] = build.trail | (1u << build.depth);
+			continue;
+		}
+
+		// Same binned sweep as buildBVH, except the cost also weighs in power & how spread out the cones are //
+		// Thin nodes get a penalty for splitting across their short sides, so lights don't end up in long slivers //
+		Vec3 extent = nodeLight.bounds.extent();
+		float longest = std::max(extent.x, std::max(extent.y, extent.z));
+		float bestCost = std::numeric_limits<float>::max();
+		int bestAxis = -1, bestBin = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float low = centroidBox.min[axis], high = centroidBox.max[axis];
+			if (high <= low) continue;
+			float scale = BinCount / (high - low);
+
+			LightBounds bins[BinCount];
+			unsigned int binCounts[BinCount] = {};
+			for (unsigned int i = build.first; i < build.first + build.count; i++) {
+				int bin = std::min(BinCount - 1, (int)((centroids[order[i]][axis] - low) * scale));
+				binCounts[bin]++;
+				mergeLights(bins[bin], lights[order[i]]);
+			}
+
+			float leftCost[BinCount - 1], rightCost[BinCount - 1];
+			unsigned int leftCount[BinCount - 1], rightCount[BinCount - 1];
+			LightBounds left, right;
+			unsigned int leftSum = 0, rightSum = 0;
+			for (int i = 0; i < BinCount - 1; i++) {
+				leftSum += binCounts[i];
+				leftCount[i] = leftSum;
+				mergeLights(left, bins[i]);
+				leftCost[i] = lightCost(left);
+
+				rightSum += binCounts[BinCount - 1 - i];
+				rightCount[BinCount - 2 - i] = rightSum;
+				mergeLights(right, bins[BinCount - 1 - i]);
+				rightCost[BinCount - 2 - i] = lightCost(right);
+			}
+
+			float thinness = extent[axis] > 0 ? longest / extent[axis] : 1;
+			for (int i = 0; i < BinCount - 1; i++) {
+				if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+				float cost = thinness * (leftCost[i] + rightCost[i]);
+				if (cost < bestCost) { bestCost = cost; bestAxis = axis; bestBin = i; }
+			}
+		}
+
+		unsigned int middle = build.first;
+		if (bestAxis != -1) {
+			float low = centroidBox.min[bestAxis], scale = BinCount / (centroidBox.max[bestAxis] - low);
+			auto split = std::partition(order.begin() + build.first, order.begin() + build.first + build.count, [&](unsigned int light) {
+				return std::min(BinCount - 1, (int)((centroids[light][bestAxis] - low) * scale)) <= bestBin;
+			});
+			middle = (unsigned int)(split - order.begin());
+		}
+
+		// If the split's so lopsided the trails could run out of bits (or there's no split at all, since every //
+		// light's in the same spot), cut the lights in half along the longest axis instead //
+		unsigned int budget = 1u << (MaxLightDepth - build.depth - 1);
+		if (bestAxis == -1 || middle - build.first > budget || build.first + build.count - middle > budget) {
+			int axis = 0;
+			Vec3 spread = centroidBox.extent();
+			if (spread.y > spread[axis]) axis = 1;
+			if (spread.z > spread[axis]) axis = 2;
+			middle = build.first + build.count / 2;
+			std::nth_element(order.begin() + build.first, order.begin() + middle, order.begin() + build.first + build.count, [&](unsigned int a, unsigned int b) {
+				return centroids[a][axis] < centroids[b][axis];
+			});
+		}
+
+		unsigned int left = (unsigned int)tree.nodes.size();
+		tree.nodes[build.node].leftOrLight = left;
+		tree.nodes[build.node].leaf = 0;
+		tree.nodes.push_back({});
+		tree.nodes.push_back({});
+		stack.push_back({left, build.first, middle - build.first, build.depth + 1, build.trail});
+		stack.push_back({left + 1, middle, build.first + build.count - middle, build.depth + 1, build.trail | (1u << build.depth)});
+	}
+
+	return tree;
+}
\ No newline at end of file
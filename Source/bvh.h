@@ -0,0 +1,159 @@
+#pragma once
+
+#include "vec.h"
+
+#include <functional>
+#include <vector>
+
+/////////
+// BVH //
+/////////
+
+// One node of a bounding volume hierarchy, laid out exactly like the shader's Node struct //
+// Interior nodes have count == 0 and their two children at leftOrFirst & leftOrFirst + 1 //
+// Leaves hold count primitives, starting at leftOrFirst //
+struct BVHNode {
+	float min[3];
+	unsigned int leftOrFirst;
+	float max[3];
+	unsigned int count;
+};
+
+struct BVH {
+	std::vector<BVHNode> nodes;
+
+	// The order the primitives need to be stored in so each leaf's primitives are next to each other //
+	std::vector<unsigned int> order;
+};
+
+// Builds a BVH over a list of primitive bounds using the binned surface area heuristic //
+BVH buildBVH(const std::vector<AABB>& bounds, unsigned int maxLeafSize);
+
+AABB nodeBounds(const BVHNode& node);
+
+/////////////////////
+// Compressed BVHs //
+/////////////////////
+
+// Wide nodes have up to 8 children each, with the children's boxes stored as 8-bit offsets from the //
+// node's corner. Each axis gets a power of two step size, stored as a float exponent so the shader can //
+// rebuild it with a single bit shift. 80 bytes covers what would take about 7 binary nodes (224 bytes) //
+// Laid out exactly like the shader's WideNodes (5 uvec4s per node) //
+struct WideBVHNode {
+	float origin[3];
+	unsigned char exponent[3];
+
+	// Bit i is set if child i is another wide node //
+	unsigned char interiorMask;
+
+	// Interior children are stored next to each other starting at firstChild, in slot order //
+	unsigned int firstChild;
+
+	// Same for every leaf child's primitives, starting at firstPrimitive //
+	unsigned int firstPrimitive;
+
+	// For leaf children: primitive count in the top 3 bits, offset from firstPrimitive in the bottom 5 //
+	// (Empty slots are 0, and interior children don't use theirs) //
+	unsigned char meta[8];
+
+	// Quantized bounds, one byte per child per plane //
+	unsigned char low[3][8];
+	unsigned char high[3][8];
+};
+static_assert(sizeof(WideBVHNode) == 80, "WideBVHNode has to match the shader's layout");
+
+struct WideBVH {
+	std::vector<WideBVHNode> nodes;
+
+	// Where each primitive should come from, as an index into the binary BVH's primitive order //
+	std::vector<unsigned int> order;
+};
+
+// Biggest leaves a BVH can have & still be compressed //
+// Each leaf's meta only has room for up to 7 primitives, at an offset of up to 31, & every leaf under one wide node shares //
+// its firstPrimitive, so all 8 children's leaves together can't go past 32 primitives. That means 4 each at most //
+const unsigned int CompressedLeafSize = 4;
+
+// Collapses a binary BVH into wide nodes, opening up the biggest children first //
+// The BVH has to have been built with a maxLeafSize no bigger than CompressedLeafSize //
+WideBVH compressBVH(const BVH& bvh);
+
+///////////
+// Refit //
+///////////
+
+// Everything needed to update a BVH's bounds in place when the things inside it move //
+// Refitting keeps the tree's shape, so it's way cheaper than a rebuild, but the tree slowly //
+// gets worse as things drift away from where they were when it was built //
+struct BVHRefit {
+	// Node indices here are relative to the BVH's first node //
+	std::vector<unsigned int> parents;
+	std::vector<unsigned int> depths;
+
+	// Sum of every node's SAH term, kept up to date as nodes get refit //
+	// (A double, since it gets nudged a little every frame for as long as things keep moving) //
+	double surfaceCost = 0;
+
+	// What the (normalised) cost was right after the tree was last built //
+	float builtCost = 0;
+
+	// Scratch space, so refitting doesn't need to allocate every frame //
+	std::vector<unsigned char> marked;
+	std::vector<float> costChanges;
+	std::vector<std::vector<unsigned int>> levels;
+};
+
+// Sets up refitting for a BVH whose nodes start at nodes[0], with child indices offset by nodeOffset //
+BVHRefit prepareRefit(const BVHNode* nodes, unsigned int nodeCount, unsigned int nodeOffset);
+
+// SAH cost of the tree relative to its root, so it doesn't change if everything just gets bigger //
+float refitCost(const BVHNode* nodes, const BVHRefit& refit);
+
+// Recomputes the bounds of the given leaves & everything above them, one level at a time (bottom-up) //
+// Each level is spread across every core. touched gets every node that changed, so they can be uploaded //
+void refitBVH(BVHNode* nodes, unsigned int nodeOffset, BVHRefit& refit, const std::vector<unsigned int>& dirtyLeaves,
+	const std::function<AABB(const BVHNode&)>& leafBounds, std::vector<unsigned int>& touched);
+
+/////////////////
+// Light Trees //
+/////////////////
+
+// Roughly where a light (or a bunch of them) is, which way it faces & how much power it gives off //
+// Every light here shines out of both sides, so the cone covers the directions around axis & -axis //
+struct LightBounds {
+	AABB bounds;
+	Vec3 axis = {0, 1, 0};
+
+	// Cosine of how far the normals spread out from the axis, & of how far past its normal a light still shines //
+	float cosSpread = 1;
+	float cosEmit = 0;
+
+	float power = 0;
+};
+
+// One node of a light tree, laid out exactly like the shader's LightNode struct //
+// Interior nodes have their two children at leftOrLight & leftOrLight + 1, leaves hold just the light leftOrLight //
+struct LightTreeNode {
+	float min[3];
+	float power;
+	float max[3];
+	float cosSpread;
+	float axis[3];
+	float cosEmit;
+	unsigned int leftOrLight;
+	unsigned int leaf;
+	unsigned int padding[2];
+};
+static_assert(sizeof(LightTreeNode) == 64, "LightTreeNode has to match the shader's layout");
+
+// A BVH over lights instead of triangles, for picking lights in proportion to how much they'll light up a point //
+struct LightTree {
+	std::vector<LightTreeNode> nodes;
+
+	// The way down to each light: bit i says which child to take at depth i, and the highest set bit marks the end //
+	// Lights with no power don't go in the tree at all, and get a trail of 0 //
+	std::vector<unsigned int> trails;
+};
+
+// Builds a light tree using the binned surface area orientation heuristic, one light per leaf //
+LightTree buildLightTree(const std::vector<LightBounds>& lights);
\ No newline at end of file
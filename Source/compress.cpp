@@ -0,0 +1,469 @@
+#include "compress.h"
+#include "print.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+///////////////////////
+// Block Compression //
+///////////////////////
+
+size_t blockBytes(BlockFormat format) {
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+const char* blockFormatName(BlockFormat format) {
+	return format == BlockFormat::BC1 ? "BC1" : "BC7";
+}
+
+// Both encoders start from the line through the block's colours that they're most spread out along //
+// (The principal axis of their covariance, by power iteration starting from whichever channel varies the most) //
+static void fitLine(const float (*texels)[4], int channels, float* mean, float* low, float* high) {
+	for (int c = 0; c < channels; c++) {
+		mean[c] = 0;
+		for (int i = 0; i < 16; i++) mean[c] += texels[i][c];
+		mean[c] /= 16;
+	}
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++) {
+		for (int a = 0; a < channels; a++) {
+			for (int b = 0; b < channels; b++) covariance[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+		}
+	}
+	int widest = 0;
+	for (int c = 1; c < channels; c++) if (covariance[c][c] > covariance[widest][widest]) widest = c;
+
+	float axis[4] = {};
+	for (int c = 0; c < channels; c++) axis[c] = covariance[widest][c];
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {}, length = 0;
+		for (int a = 0; a < channels; a++) {
+			for (int b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+			length += next[a] * next[a];
+		}
+		if (length < 1e-12f) break;
+		length = std::sqrt(length);
+		for (int c = 0; c < channels; c++) axis[c] = next[c] / length;
+	}
+
+	// The ends of the line are wherever the texels furthest along it are //
+	float minimum = 0, maximum = 0;
+	for (int i = 0; i < 16; i++) {
+		float t = 0;
+		for (int c = 0; c < channels; c++) t += (texels[i][c] - mean[c]) * axis[c];
+		minimum = std::min(minimum, t);
+		maximum = std::max(maximum, t);
+	}
+	for (int c = 0; c < channels; c++) {
+		low[c] = std::clamp(mean[c] + axis[c] * minimum, 0.0f, 255.0f);
+		high[c] = std::clamp(mean[c] + axis[c] * maximum, 0.0f, 255.0f);
+	}
+}
+
+// Given which texels went with how much of each end, finds the ends that fit them best (by least squares) //
+// weights[i] is how much of the first end texel i gets, & the second end gets the rest //
+static bool refitLine(const float (*texels)[4], const float* weights, int channels, float* first, float* second) {
+	float aa = 0, ab = 0, bb = 0, ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; i++) {
+		float a = weights[i], b = 1 - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < channels; c++) {
+			ax[c] += a * texels[i][c];
+			bx[c] += b * texels[i][c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) < 1e-6f) return false;
+	for (int c = 0; c < channels; c++) {
+		first[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+		second[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+// Bits go in (& come out) lowest first, like the formats want //
+struct BitWriter {
+	unsigned char* bytes;
+	unsigned int position = 0;
+	void write(unsigned int value, unsigned int count) {
+		for (unsigned int i = 0; i < count; i++, position++) {
+			if (value >> i & 1) bytes[position >> 3] |= (unsigned char)(1 << (position & 7));
+		}
+	}
+};
+
+struct BitReader {
+	const unsigned char* bytes;
+	unsigned int position = 0;
+	unsigned int read(unsigned int count) {
+		unsigned int value = 0;
+		for (unsigned int i = 0; i < count; i++, position++) value |= (unsigned int)(bytes[position >> 3] >> (position & 7) & 1) << i;
+		return value;
+	}
+};
+
+/////////
+// BC1 //
+/////////
+
+static uint16_t packRGB565(const float* rgb) {
+	unsigned int r = (unsigned int)std::lround(rgb[0] * 31 / 255), g = (unsigned int)std::lround(rgb[1] * 63 / 255), b = (unsigned int)std::lround(rgb[2] * 31 / 255);
+	return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+static void unpackRGB565(uint16_t colour, unsigned int* rgb) {
+	unsigned int r = colour >> 11, g = colour >> 5 & 63, b = colour & 31;
+	rgb[0] = r << 3 | r >> 2;
+	rgb[1] = g << 2 | g >> 4;
+	rgb[2] = b << 3 | b >> 2;
+}
+
+// The four colours a block can use. With the first end bigger than the second, the middle two are a third & //
+// two thirds of the way along. Otherwise there's only one in the middle, & the last one's black //
+static void bc1Palette(uint16_t first, uint16_t second, unsigned int (*palette)[3]) {
+	unpackRGB565(first, palette[0]);
+	unpackRGB565(second, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		if (first > second) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+		} else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Picks the nearest colour for every texel, & returns how far off they all were //
+static float bc1Indices(const float (*texels)[4], uint16_t first, uint16_t second, uint32_t& indices) {
+	unsigned int palette[4][3];
+	bc1Palette(first, second, palette);
+	float total = 0;
+	indices = 0;
+	for (int i = 0; i < 16; i++) {
+		float best = 1e30f;
+		uint32_t bestIndex = 0;
+		for (uint32_t index = 0; index < 4; index++) {
+			float error = 0;
+			for (int c = 0; c < 3; c++) error += (texels[i][c] - palette[index][c]) * (texels[i][c] - palette[index][c]);
+			if (error < best) { best = error; bestIndex = index; }
+		}
+		indices |= bestIndex << (i * 2);
+		total += best;
+	}
+	return total;
+}
+
+// Only ever uses the four colour mode, so the first end always has to be the bigger one //
+static float encodeBC1Ends(const float (*texels)[4], const float* high, const float* low, uint16_t& first, uint16_t& second, uint32_t& indices) {
+	first = packRGB565(high);
+	second = packRGB565(low);
+	if (first < second) std::swap(first, second);
+	if (first == second) {
+		// Every texel's the same colour (as far as 565 can tell), so index 0 it is //
+		unsigned int palette[4][3];
+		bc1Palette(first, second, palette);
+		float total = 0;
+		for (int i = 0; i < 16; i++) for (int c = 0; c < 3; c++) total += (texels[i][c] - palette[0][c]) * (texels[i][c] - palette[0][c]);
+		indices = 0;
+		return total;
+	}
+	return bc1Indices(texels, first, second, indices);
+}
+
+static void encodeBC1Block(const float (*texels)[4], unsigned char* block) {
+	float mean[4], low[4], high[4];
+	fitLine(texels, 3, mean, low, high);
+	uint16_t first, second;
+	uint32_t indices;
+	float error = encodeBC1Ends(texels, high, low, first, second, indices);
+
+	// Then see if fitting the ends to the texels that picked them does any better //
+	const float firstWeights[4] = {1, 0, 2.0f / 3, 1.0f / 3};
+	float weights[16];
+	for (int i = 0; i < 16; i++) weights[i] = firstWeights[indices >> (i * 2) & 3];
+	if (refitLine(texels, weights, 3, high, low)) {
+		uint16_t refitFirst, refitSecond;
+		uint32_t refitIndices;
+		float refitError = encodeBC1Ends(texels, high, low, refitFirst, refitSecond, refitIndices);
+		if (refitError < error) { first = refitFirst; second = refitSecond; indices = refitIndices; }
+	}
+
+	std::memcpy(block, &first, 2);
+	std::memcpy(block + 2, &second, 2);
+	std::memcpy(block + 4, &indices, 4);
+}
+
+static void decodeBC1Block(const unsigned char* block, unsigned char (*texels)[4]) {
+	uint16_t first, second;
+	uint32_t indices;
+	std::memcpy(&first, block, 2);
+	std::memcpy(&second, block + 2, 2);
+	std::memcpy(&indices, block + 4, 4);
+	unsigned int palette[4][3];
+	bc1Palette(first, second, palette);
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) texels[i][c] = (unsigned char)palette[indices >> (i * 2) & 3][c];
+		texels[i][3] = 255;
+	}
+}
+
+/////////
+// BC7 //
+/////////
+
+// Mode 6: 7 mode bits (0000001), the two ends' 7-bit R, G, B & A, then a low bit for each end, then 4-bit indices //
+// (apart from the first, which has to be under 8, so it only gets 3 bits) //
+static const unsigned int BC7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Each end shares its low bit between all four channels, so try both & keep whichever's closer //
+static void quantizeBC7End(const float* end, unsigned int* quantized, unsigned int& lowBit) {
+	float bestError = 1e30f;
+	for (unsigned int bit = 0; bit < 2; bit++) {
+		unsigned int candidate[4];
+		float error = 0;
+		for (int c = 0; c < 4; c++) {
+			candidate[c] = (unsigned int)std::clamp(std::lround((end[c] - bit) / 2), 0l, 127l);
+			float reconstructed = (float)(candidate[c] << 1 | bit);
+			error += (reconstructed - end[c]) * (reconstructed - end[c]);
+		}
+		if (error < bestError) {
+			bestError = error;
+			lowBit = bit;
+			std::copy(candidate, candidate + 4, quantized);
+		}
+	}
+}
+
+static void bc7Palette(const unsigned int* first, const unsigned int* second, unsigned int (*palette)[4]) {
+	for (int index = 0; index < 16; index++) {
+		for (int c = 0; c < 4; c++) palette[index][c] = ((64 - BC7Weights[index]) * first[c] + BC7Weights[index] * second[c] + 32) >> 6;
+	}
+}
+
+struct BC7Block {
+	unsigned int ends[2][4];
+	unsigned int lowBits[2];
+	unsigned int indices[16];
+};
+
+static float encodeBC7Ends(const float (*texels)[4], const float* first, const float* second, BC7Block& block) {
+	quantizeBC7End(first, block.ends[0], block.lowBits[0]);
+	quantizeBC7End(second, block.ends[1], block.lowBits[1]);
+	unsigned int expanded[2][4];
+	for (int end = 0; end < 2; end++) for (int c = 0; c < 4; c++) expanded[end][c] = block.ends[end][c] << 1 | block.lowBits[end];
+	unsigned int palette[16][4];
+	bc7Palette(expanded[0], expanded[1], palette);
+
+	float total = 0;
+	for (int i = 0; i < 16; i++) {
+		float best = 1e30f;
+		for (unsigned int index = 0; index < 16; index++) {
+			float error = 0;
+			for (int c = 0; c < 4; c++) error += (texels[i][c] - palette[index][c]) * (texels[i][c] - palette[index][c]);
+			if (error < best) { best = error; block.indices[i] = index; }
+		}
+		total += best;
+	}
+	return total;
+}
+
+static void encodeBC7Block(const float (*texels)[4], unsigned char* bytes) {
+	float mean[4], low[4], high[4];
+	fitLine(texels, 4, mean, low, high);
+	BC7Block block;
+	float error = encodeBC7Ends(texels, low, high, block);
+
+	float weights[16];
+	for (int i = 0; i < 16; i++) weights[i] = 1 - BC7Weights[block.indices[i]] / 64.0f;
+	if (refitLine(texels, weights, 4, low, high)) {
+		BC7Block refit;
+		if (encodeBC7Ends(texels, low, high, refit) < error) block = refit;
+	}
+
+	// The first texel's index has to be under 8, which swapping the ends over always manages //
+	if (block.indices[0] >= 8) {
+		std::swap(block.ends[0], block.ends[1]);
+		std::swap(block.lowBits[0], block.lowBits[1]);
+		for (unsigned int& index : block.indices) index = 15 - index;
+	}
+
+	std::memset(bytes, 0, 16);
+	BitWriter writer = {bytes};
+	writer.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		writer.write(block.ends[0][c], 7);
+		writer.write(block.ends[1][c], 7);
+	}
+	writer.write(block.lowBits[0], 1);
+	writer.write(block.lowBits[1], 1);
+	for (int i = 0; i < 16; i++) writer.write(block.indices[i], i == 0 ? 3 : 4);
+}
+
+// Only mode 6 blocks get decoded, since that's all nelcompress ever writes. Anything else comes out magenta //
+static void decodeBC7Block(const unsigned char* bytes, unsigned char (*texels)[4]) {
+	BitReader reader = {bytes};
+	if (reader.read(7) != 1 << 6) {
+		for (int i = 0; i < 16; i++) { texels[i][0] = 255; texels[i][1] = 0; texels[i][2] = 255; texels[i][3] = 255; }
+		return;
+	}
+	unsigned int ends[2][4];
+	for (int c = 0; c < 4; c++) {
+		ends[0][c] = reader.read(7);
+		ends[1][c] = reader.read(7);
+	}
+	unsigned int lowBits[2] = {reader.read(1), reader.read(1)};
+	for (int end = 0; end < 2; end++) for (int c = 0; c < 4; c++) ends[end][c] = ends[end][c] << 1 | lowBits[end];
+
+	unsigned int palette[16][4];
+	bc7Palette(ends[0], ends[1], palette);
+	for (int i = 0; i < 16; i++) {
+		unsigned int index = reader.read(i == 0 ? 3 : 4);
+		for (int c = 0; c < 4; c++) texels[i][c] = (unsigned char)palette[index][c];
+	}
+}
+
+////////////
+// Levels //
+////////////
+
+CompressedLevel compressLevel(const MipLevel& level, BlockFormat format) {
+	CompressedLevel result;
+	result.width = level.width;
+	result.height = level.height;
+	unsigned int blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+	size_t bytes = blockBytes(format);
+	result.blocks.resize((size_t)blocksX * blocksY * bytes);
+
+	parallelFor(blocksY, 4, [&](size_t begin, size_t end) {
+		for (unsigned int blockY = (unsigned int)begin; blockY < end; blockY++) {
+			for (unsigned int blockX = 0; blockX < blocksX; blockX++) {
+				// Blocks hanging off the edge repeat the last texels, which keeps them out of the way of the fit //
+				float texels[16][4];
+				for (unsigned int i = 0; i < 16; i++) {
+					unsigned int x = std::min(blockX * 4 + i % 4, level.width - 1), y = std::min(blockY * 4 + i / 4, level.height - 1);
+					for (int c = 0; c < 4; c++) texels[i][c] = level.texels[((size_t)y * level.width + x) * 4 + c];
+				}
+				unsigned char* block = &result.blocks[((size_t)blockY * blocksX + blockX) * bytes];
+				if (format == BlockFormat::BC1) encodeBC1Block(texels, block);
+				else encodeBC7Block(texels, block);
+			}
+		}
+	});
+	return result;
+}
+
+MipLevel decompressLevel(const CompressedLevel& level, BlockFormat format) {
+	MipLevel result;
+	result.width = level.width;
+	result.height = level.height;
+	result.texels.resize((size_t)level.width * level.height * 4);
+	unsigned int blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+	size_t bytes = blockBytes(format);
+
+	parallelFor(blocksY, 4, [&](size_t begin, size_t end) {
+		for (unsigned int blockY = (unsigned int)begin; blockY < end; blockY++) {
+			for (unsigned int blockX = 0; blockX < blocksX; blockX++) {
+				unsigned char texels[16][4];
+				const unsigned char* block = &level.blocks[((size_t)blockY * blocksX + blockX) * bytes];
+				if (format == BlockFormat::BC1) decodeBC1Block(block, texels);
+				else decodeBC7Block(block, texels);
+				for (unsigned int i = 0; i < 16; i++) {
+					unsigned int x = blockX * 4 + i % 4, y = blockY * 4 + i / 4;
+					if (x < level.width && y < level.height) std::memcpy(&result.texels[((size_t)y * level.width + x) * 4], texels[i], 4);
+				}
+			}
+		}
+	});
+	return result;
+}
+
+///////////
+// Cache //
+///////////
+
+// A header & then every level's blocks one after another, biggest first //
+struct CompressedHeader {
+	char magic[4] = {'N', 'E', 'L', 'B'};
+	uint32_t version = 1;
+	uint32_t format = 0;
+	uint32_t width = 0, height = 0;
+	uint32_t levels = 0;
+	uint64_t hash = 0;
+};
+
+// FNV-1a over every byte, which is nowhere near as slow as decoding the image would be //
+bool hashFile(std::string path, uint64_t& hash) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) return false;
+	hash = 14695981039346656037ull;
+	std::vector<char> chunk(1 << 16);
+	while (file) {
+		file.read(chunk.data(), chunk.size());
+		for (std::streamsize i = 0; i < file.gcount(); i++) hash = (hash ^ (unsigned char)chunk[i]) * 1099511628211ull;
+	}
+	return true;
+}
+
+std::string compressedCachePath(uint64_t hash) {
+	std::stringstream name;
+	name << std::hex << hash << ".blocks";
+	return CompressedCacheDirectory + name.str();
+}
+
+bool writeCompressedTexture(const CompressedTexture& texture, uint64_t hash) {
+	CompressedHeader header;
+	header.format = (uint32_t)texture.format;
+	header.width = texture.levels[0].width;
+	header.height = texture.levels[0].height;
+	header.levels = (uint32_t)texture.levels.size();
+	header.hash = hash;
+
+	// Written somewhere else first & then moved over, so nel never sees half of one //
+	std::error_code errorCode;
+	std::filesystem::create_directories(CompressedCacheDirectory, errorCode);
+	std::string path = compressedCachePath(hash), temporaryPath = path + ".tmp";
+	std::ofstream file(temporaryPath, std::ios::binary);
+	if (!file.is_open()) { error("Could not write '" + temporaryPath + "'."); return false; }
+	file.write((const char*)&header, sizeof(header));
+	for (const CompressedLevel& level : texture.levels) file.write((const char*)level.blocks.data(), level.blocks.size());
+	file.close();
+	if (!file) { error("Could not write '" + temporaryPath + "'."); return false; }
+	std::filesystem::rename(temporaryPath, path, errorCode);
+	if (errorCode) { error("Could not write '" + path + "'."); return false; }
+	return true;
+}
+
+bool findCompressedTexture(CompressedTexture& texture, std::string imagePath) {
+	uint64_t hash;
+	if (!hashFile(imagePath, hash)) return false;
+	std::string path = compressedCachePath(hash);
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) return false;
+
+	CompressedHeader header, expected;
+	file.read((char*)&header, sizeof(header));
+	bool valid = file && std::memcmp(header.magic, expected.magic, 4) == 0 && header.version == expected.version && header.hash == hash;
+	valid &= (header.format == (uint32_t)BlockFormat::BC1 || header.format == (uint32_t)BlockFormat::BC7) && header.levels > 0 && header.levels <= 32;
+	if (!valid) { error("'" + path + "' isn't a compressed texture nel can read, so '" + imagePath + "' is being loaded uncompressed."); return false; }
+
+	texture.format = (BlockFormat)header.format;
+	texture.levels.resize(header.levels);
+	for (unsigned int level = 0; level < header.levels; level++) {
+		CompressedLevel& compressed = texture.levels[level];
+		compressed.width = std::max(header.width >> level, 1u);
+		compressed.height = std::max(header.height >> level, 1u);
+		compressed.blocks.resize((size_t)((compressed.width + 3) / 4) * ((compressed.height + 3) / 4) * blockBytes(texture.format));
+		file.read((char*)compressed.blocks.data(), compressed.blocks.size());
+	}
+	if (!file) { error("'" + path + "' is cut short, so '" + imagePath + "' is being loaded uncompressed."); texture.levels.clear(); return false; }
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "image.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+///////////////////////
+// Block Compression //
+///////////////////////
+
+// Textures can be compressed ahead of time (with nelcompress, see Tools/compress.cpp) into formats the GPU reads //
+// as they are, so they take less memory & less bandwidth every time they're sampled. Every 4x4 block of texels becomes: //
+// - BC1: two 565 colours & a 2-bit index per texel, in 8 bytes (an eighth of RGBA8, but blotchy on smooth gradients) //
+// - BC7: two 7-bit RGBA colours (plus a shared low bit each) & a 4-bit index per texel, in 16 bytes (a quarter of RGBA8) //
+//   BC7 has 8 ways of laying a block out, but these are always mode 6, since that's the only one that's simple & still good //
+// Either way the colours are sRGB, just like MipLevel //
+enum class BlockFormat : uint32_t {
+	BC1 = 1,
+	BC7 = 7
+};
+
+// Levels that aren't a multiple of 4 texels across still get whole blocks, with whatever's left over ignored //
+struct CompressedLevel {
+	unsigned int width = 0, height = 0;
+	std::vector<unsigned char> blocks;
+};
+
+struct CompressedTexture {
+	BlockFormat format = BlockFormat::BC7;
+	std::vector<CompressedLevel> levels;
+};
+
+size_t blockBytes(BlockFormat format);
+const char* blockFormatName(BlockFormat format);
+
+// Every block gets encoded independently, so a level's split across every core //
+CompressedLevel compressLevel(const MipLevel& level, BlockFormat format);
+
+// For when the GPU can't read a format (or the CPU tracer needs the texels) //
+MipLevel decompressLevel(const CompressedLevel& level, BlockFormat format);
+
+// Compressed textures are cached by a hash of the image file's contents, so moving or renaming it doesn't matter //
+// (The path's relative to where nel runs from, same as the tile caches) //
+const std::string CompressedCacheDirectory = "../Cache/";
+
+bool hashFile(std::string path, uint64_t& hash);
+std::string compressedCachePath(uint64_t hash);
+bool writeCompressedTexture(const CompressedTexture& texture, uint64_t hash);
+
+// Finds the compressed version of an image, if nelcompress has made one //
+// Returns false (without an error) if there isn't one, so the image can be loaded the usual way instead //
+bool findCompressedTexture(CompressedTexture& texture, std::string imagePath);
\ No newline at end of file
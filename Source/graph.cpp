@@ -0,0 +1,427 @@
+#include "graph.h"
+#include "print.h"
+
+#include <algorithm>
+#include <vector>
+
+//////////////////
+// Render Graph //
+//////////////////
+
+struct GraphResource {
+	std::string name;
+	bool isBuffer;
+	bool isWindow;
+	bool isTransient;
+	TextureDescription description;
+	unsigned int id;
+
+	// Barrier tracking: whether the last write was an incoherent one (image/storage/atomic), //
+	// and which kinds of access have been made safe by a barrier since //
+	bool pendingWrite;
+	GLbitfield visibleTo;
+};
+
+struct Use {
+	int resource;
+	Access access;
+	bool isWrite;
+};
+
+struct GraphPass {
+	std::string name;
+	PassFunction execute;
+	bool hasSideEffects;
+	std::vector<Use> uses;
+	unsigned int framebuffer;
+};
+
+struct RenderGraph {
+	std::vector<GraphResource> resources;
+	std::vector<GraphPass> passes;
+
+	// The result of compiling: the passes that survived culling, in the order they'll run //
+	std::vector<int> schedule;
+	std::vector<TransientTexture> transients;
+	std::vector<int> transientResources;
+	bool compiled = false;
+
+	// The barrier that went in before each scheduled pass, the last time it ran (for checkRenderGraph) //
+	std::vector<GLbitfield> barriers;
+};
+
+// Everything below works on whichever graph's bound //
+static RenderGraph DefaultGraph;
+static RenderGraph* Graph = &DefaultGraph;
+
+RenderGraph* newRenderGraph() {
+	return new RenderGraph();
+}
+
+void deleteRenderGraph(RenderGraph* graph) {
+	if (Graph == graph) Graph = &DefaultGraph;
+	delete graph;
+}
+
+void bindRenderGraph(RenderGraph* graph) {
+	Graph = graph ? graph : &DefaultGraph;
+}
+
+///////////////
+// Resources //
+///////////////
+
+static int addResource(GraphResource resource) {
+	Graph->resources.push_back(resource);
+	Graph->compiled = false;
+	return (int)Graph->resources.size() - 1;
+}
+
+int graphImportTexture(std::string name, unsigned int texture) {
+	return addResource({name, false, false, false, {0, 0, 0}, texture, false, 0});
+}
+
+int graphImportBuffer(std::string name, unsigned int buffer) {
+	return addResource({name, true, false, false, {0, 0, 0}, buffer, false, 0});
+}
+
+// The default framebuffer, which can only ever be drawn into //
+int graphImportWindow(std::string name) {
+	return addResource({name, false, true, false, {0, 0, 0}, 0, false, 0});
+}
+
+// A texture that only lives inside the frame, so the graph can decide where its memory comes from //
+int graphCreateTexture(std::string name, TextureDescription description) {
+	description.exactSize = false;
+	return addResource({name, false, false, true, description, 0, false, 0});
+}
+
+void graphSetTexture(int resource, unsigned int texture) { Graph->resources[resource].id = texture; }
+void graphSetBuffer(int resource, unsigned int buffer) { Graph->resources[resource].id = buffer; }
+void graphSetDescription(int resource, TextureDescription description) {
+	description.exactSize = false;
+	Graph->resources[resource].description = description;
+	Graph->compiled = false;
+}
+
+unsigned int graphTexture(int resource) { return Graph->resources[resource].id; }
+unsigned int graphBuffer(int resource) { return Graph->resources[resource].id; }
+
+////////////
+// Passes //
+////////////
+
+int graphAddPass(std::string name, PassFunction execute, bool hasSideEffects) {
+	Graph->passes.push_back({name, execute, hasSideEffects, {}, 0});
+	Graph->compiled = false;
+	return (int)Graph->passes.size() - 1;
+}
+
+void graphRead(int pass, int resource, Access access) {
+	Graph->passes[pass].uses.push_back({resource, access, false});
+	Graph->compiled = false;
+}
+
+void graphWrite(int pass, int resource, Access access) {
+	Graph->passes[pass].uses.push_back({resource, access, true});
+	Graph->compiled = false;
+}
+
+static bool reads(const GraphPass& pass, int resource) {
+	for (const Use& use : pass.uses) if (use.resource == resource && !use.isWrite) return true;
+	return false;
+}
+
+static bool writes(const GraphPass& pass, int resource) {
+	for (const Use& use : pass.uses) if (use.resource == resource && use.isWrite) return true;
+	return false;
+}
+
+///////////////
+// Compiling //
+///////////////
+
+// Passes that touch anything outside the graph (the window, imported resources) always have to run //
+// Everything else only runs if a pass that runs needs what it writes //
+static std::vector<bool> cullPasses() {
+	std::vector<bool> alive(Graph->passes.size(), false);
+	std::vector<int> stack;
+	for (size_t i = 0; i < Graph->passes.size(); i++) {
+		bool external = Graph->passes[i].hasSideEffects;
+		for (const Use& use : Graph->passes[i].uses) if (use.isWrite && !Graph->resources[use.resource].isTransient) external = true;
+		if (external) { alive[i] = true; stack.push_back((int)i); }
+	}
+
+	// Walk backwards from those, keeping alive every earlier pass that writes something they read //
+	while (!stack.empty()) {
+		int pass = stack.back();
+		stack.pop_back();
+		for (const Use& use : Graph->passes[pass].uses) {
+			if (use.isWrite) continue;
+			for (int writer = 0; writer < pass; writer++) {
+				if (alive[writer] || !writes(Graph->passes[writer], use.resource)) continue;
+				alive[writer] = true;
+				stack.push_back(writer);
+			}
+		}
+	}
+
+	return alive;
+}
+
+// Orders passes so every write lands before the reads that need it, and reads finish before //
+// the next write clobbers them. Ties keep the order the passes were added in //
+static bool sortPasses(const std::vector<bool>& alive) {
+	size_t count = Graph->passes.size();
+	std::vector<std::vector<int>> after(count);
+	std::vector<int> waitingOn(count, 0);
+
+	// Passes are declared in the order their effects are meant to happen, so a dependency //
+	// only ever points from an earlier pass to a later one that touches the same resource //
+	for (size_t a = 0; a < count; a++) {
+		if (!alive[a]) continue;
+		for (size_t b = a + 1; b < count; b++) {
+			if (!alive[b]) continue;
+			bool dependent = false;
+			for (const Use& use : Graph->passes[a].uses) {
+				if (use.isWrite && (reads(Graph->passes[b], use.resource) || writes(Graph->passes[b], use.resource))) dependent = true;
+				if (!use.isWrite && writes(Graph->passes[b], use.resource)) dependent = true;
+			}
+			if (!dependent) continue;
+			after[a].push_back((int)b);
+			waitingOn[b]++;
+		}
+	}
+
+	// Kahn's algorithm, always picking the earliest declared pass that's ready //
+	Graph->schedule.clear();
+	std::vector<int> ready;
+	for (size_t i = 0; i < count; i++) if (alive[i] && waitingOn[i] == 0) ready.push_back((int)i);
+	while (!ready.empty()) {
+		auto earliest = std::min_element(ready.begin(), ready.end());
+		int pass = *earliest;
+		ready.erase(earliest);
+		Graph->schedule.push_back(pass);
+		for (int next : after[pass]) if (--waitingOn[next] == 0) ready.push_back(next);
+	}
+
+	size_t aliveCount = std::count(alive.begin(), alive.end(), true);
+	if (Graph->schedule.size() != aliveCount) { error("Render graph has a cycle in it."); return false; }
+	return true;
+}
+
+// Works out which scheduled passes each transient texture lives between //
+static bool planTransients() {
+	Graph->transients.clear();
+	Graph->transientResources.clear();
+	for (size_t resource = 0; resource < Graph->resources.size(); resource++) {
+		if (!Graph->resources[resource].isTransient) continue;
+
+		int firstUse = -1, lastUse = -1;
+		for (size_t step = 0; step < Graph->schedule.size(); step++) {
+			if (!reads(Graph->passes[Graph->schedule[step]], (int)resource) && !writes(Graph->passes[Graph->schedule[step]], (int)resource)) continue;
+			if (firstUse == -1) firstUse = (int)step;
+			lastUse = (int)step;
+		}
+		if (firstUse == -1) continue;
+
+		// Reading something before anything has written it is almost definitely a mistake //
+		if (!writes(Graph->passes[Graph->schedule[firstUse]], (int)resource)) {
+			error("Transient '" + Graph->resources[resource].name + "' is read by '" + Graph->passes[Graph->schedule[firstUse]].name + "' before anything writes it.");
+			return false;
+		}
+
+		Graph->transients.push_back({Graph->resources[resource].description, firstUse, lastUse, 0});
+		Graph->transientResources.push_back((int)resource);
+	}
+	return true;
+}
+
+bool compileRenderGraph() {
+	std::vector<bool> alive = cullPasses();
+	if (!sortPasses(alive)) return false;
+	if (!planTransients()) return false;
+
+	// Every pass that draws into textures gets its own framebuffer //
+	for (int pass : Graph->schedule) {
+		bool drawsToTexture = false;
+		for (const Use& use : Graph->passes[pass].uses) if (use.isWrite && use.access == ATTACHMENT && !Graph->resources[use.resource].isWindow) drawsToTexture = true;
+		if (drawsToTexture && Graph->passes[pass].framebuffer == 0) glGenFramebuffers(1, &Graph->passes[pass].framebuffer);
+	}
+
+	std::string order;
+	for (int pass : Graph->schedule) order += (order.empty() ? "" : " -> ") + Graph->passes[pass].name;
+	debug("RenderGraph", order + " (" + std::to_string(Graph->passes.size() - Graph->schedule.size()) + " culled, " + std::to_string(Graph->transients.size()) + " transients)");
+
+	Graph->compiled = true;
+	return true;
+}
+
+///////////////
+// Executing //
+///////////////
+
+// The barrier bit that makes incoherent writes visible to a given kind of access //
+static GLbitfield barrierFor(Access access, bool isBuffer) {
+	switch (access) {
+		case ATTACHMENT: return GL_FRAMEBUFFER_BARRIER_BIT;
+		case SAMPLED: return GL_TEXTURE_FETCH_BARRIER_BIT;
+		case IMAGE: return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+		case STORAGE: return GL_SHADER_STORAGE_BARRIER_BIT;
+		case UNIFORM: return GL_UNIFORM_BARRIER_BIT;
+		case ATOMIC: return GL_ATOMIC_COUNTER_BARRIER_BIT;
+		case INDIRECT: return GL_COMMAND_BARRIER_BIT;
+		case TRANSFER: return isBuffer ? GL_BUFFER_UPDATE_BARRIER_BIT : GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT;
+	}
+	return 0;
+}
+
+// GL keeps framebuffer draws & CPU transfers in order by itself, but image, storage & atomic //
+// writes need a glMemoryBarrier before anything else can see them //
+static bool isIncoherent(Access access) {
+	return access == IMAGE || access == STORAGE || access == ATOMIC;
+}
+
+// Issues one barrier covering everything this pass is about to read that hasn't been made visible yet //
+// (Returns which bits it was, 0 if it didn't need one) //
+static GLbitfield insertBarriers(const GraphPass& pass) {
+	GLbitfield needed = 0;
+	for (const Use& use : pass.uses) {
+		const GraphResource& resource = Graph->resources[use.resource];
+		if (!resource.pendingWrite) continue;
+		GLbitfield bit = barrierFor(use.access, resource.isBuffer);
+		if (!(resource.visibleTo & bit)) needed |= bit;
+	}
+	if (!needed) return 0;
+
+	glMemoryBarrier(needed);
+
+	// A barrier covers every write issued before it, not just the ones we were thinking of //
+	for (GraphResource& resource : Graph->resources) if (resource.pendingWrite) resource.visibleTo |= needed;
+	return needed;
+}
+
+static void trackWrites(const GraphPass& pass) {
+	for (const Use& use : pass.uses) {
+		if (!use.isWrite || !isIncoherent(use.access)) continue;
+		Graph->resources[use.resource].pendingWrite = true;
+		Graph->resources[use.resource].visibleTo = 0;
+	}
+}
+
+// Binds the framebuffer a pass draws into, attaching whatever textures it writes //
+static bool bindTargets(GraphPass& pass) {
+	if (pass.framebuffer == 0) {
+		for (const Use& use : pass.uses) if (use.isWrite && use.access == ATTACHMENT) glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return true;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+	int attachment = 0;
+	for (const Use& use : pass.uses) {
+		if (!use.isWrite || use.access != ATTACHMENT) continue;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + attachment++, GL_TEXTURE_2D, Graph->resources[use.resource].id, 0);
+	}
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) { error("Framebuffer for pass '" + pass.name + "' is incomplete."); return false; }
+	return true;
+}
+
+bool executeRenderGraph() {
+	if (!Graph->compiled && !compileRenderGraph()) return false;
+
+	// Hand out memory to this frame's transients (the pool gives us the same textures back every frame) //
+	if (!allocateTransientTextures(Graph->transients)) return false;
+	for (size_t i = 0; i < Graph->transients.size(); i++) Graph->resources[Graph->transientResources[i]].id = Graph->transients[i].texture;
+
+	bool successState = true;
+	Graph->barriers.clear();
+	for (int index : Graph->schedule) {
+		GraphPass& pass = Graph->passes[index];
+		Graph->barriers.push_back(insertBarriers(pass));
+		if (!bindTargets(pass)) { successState = false; break; }
+		if (!pass.execute()) { error("Render pass '" + pass.name + "' failed."); successState = false; break; }
+		trackWrites(pass);
+	}
+
+	releaseTransientTextures(Graph->transients);
+	return successState;
+}
+
+void clearRenderGraph() {
+	for (GraphPass& pass : Graph->passes) if (pass.framebuffer != 0) glDeleteFramebuffers(1, &pass.framebuffer);
+	Graph->passes.clear();
+	Graph->resources.clear();
+	Graph->schedule.clear();
+	Graph->transients.clear();
+	Graph->transientResources.clear();
+	Graph->barriers.clear();
+	Graph->compiled = false;
+}
+
+////////////////
+// Self Check //
+////////////////
+
+// nel's own frame never has a transient in it (every pass writes something imported), so culling, lifetimes & //
+// barriers between passes would otherwise never get exercised. This builds a made up frame that has all of them: //
+//   Draw A  (writes A)              -> Blur (reads A, writes B as an image) -> Tone map (reads B as an image, //
+//   Unused  (writes C, never read)     writes D as an image) -> Output (samples D, draws to the window) //
+// A, B, C & D are all transients, & everything gets checked against what it has to come out as (which includes A & //
+// D sharing a texture, since A's done with before D's written, while B overlaps them both) //
+bool checkRenderGraph() {
+	RenderGraph* previous = Graph;
+	RenderGraph check;
+	Graph = &check;
+
+	TextureDescription description = {64, 64, GL_RGBA8};
+	int a = graphCreateTexture("A", description), b = graphCreateTexture("B", description);
+	int c = graphCreateTexture("C", description), d = graphCreateTexture("D", description);
+	int window = graphImportWindow("Window");
+
+	auto nothing = [] { return true; };
+	int draw = graphAddPass("Draw A", nothing);
+	graphWrite(draw, a, ATTACHMENT);
+	int unused = graphAddPass("Unused", nothing);
+	graphWrite(unused, c, ATTACHMENT);
+	int blur = graphAddPass("Blur", nothing);
+	graphRead(blur, a, SAMPLED);
+	graphWrite(blur, b, IMAGE);
+	int toneMap = graphAddPass("Tone map", nothing);
+	graphRead(toneMap, b, IMAGE);
+	graphWrite(toneMap, d, IMAGE);
+	int output = graphAddPass("Output", nothing);
+	graphRead(output, d, SAMPLED);
+	graphWrite(output, window, ATTACHMENT);
+
+	bool successState = true;
+	auto expect = [&successState](bool condition, std::string what) {
+		if (!condition) { error("Render graph check failed: " + what); successState = false; }
+	};
+
+	if (!executeRenderGraph()) { error("Render graph check couldn't run its graph."); successState = false; }
+	else {
+		// Unused's C is never read, so it goes, & everything else keeps the order it was added in //
+		expect(check.schedule == std::vector<int>({draw, blur, toneMap, output}), "Unused should be culled & the rest kept in order.");
+
+		// C never gets planned, & the rest live from the step that writes them to the step that last reads them //
+		expect(check.transientResources == std::vector<int>({a, b, d}), "Only A, B & D should be planned.");
+		if (check.transients.size() == 3) {
+			expect(check.transients[0].firstUse == 0 && check.transients[0].lastUse == 1, "A should live from step 0 to 1.");
+			expect(check.transients[1].firstUse == 1 && check.transients[1].lastUse == 2, "B should live from step 1 to 2.");
+			expect(check.transients[2].firstUse == 2 && check.transients[2].lastUse == 3, "D should live from step 2 to 3.");
+		}
+
+		// Drawing into A is coherent, so only the image writes need barriers, each for whatever reads it next //
+		expect(check.barriers == std::vector<GLbitfield>({0, 0, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT, GL_TEXTURE_FETCH_BARRIER_BIT}), "Only Tone map & Output should get barriers.");
+
+		// (The textures go back to the pool once the frame's done, but the resources still say which ones they had) //
+		expect(graphTexture(a) != 0 && graphTexture(a) == graphTexture(d), "A & D should share a texture.");
+		expect(graphTexture(b) != 0 && graphTexture(b) != graphTexture(a), "B should get a texture of its own.");
+		expect(aliasedBytesSaved() == textureBytes(description), "Aliasing should save exactly one texture's worth.");
+	}
+
+	clearRenderGraph();
+	Graph = previous;
+	if (successState) print("Render graph check passed.");
+	return successState;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "resources.h"
+
+#include <functional>
+#include <string>
+
+//////////////////
+// Render Graph //
+//////////////////
+
+// Each frame is a list of passes that say which resources they read & write //
+// From that, the graph works out what order to run them in, throws out passes nobody needs, //
+// puts in the memory barriers GL needs between them, and shares memory between transient textures //
+
+// How a pass touches a resource (this decides which barriers are needed) //
+enum Access {
+	ATTACHMENT,    // Drawn into as part of a framebuffer
+	SAMPLED,       // Read through a sampler
+	IMAGE,         // imageLoad / imageStore
+	STORAGE,       // Shader storage buffer
+	UNIFORM,       // Uniform buffer
+	ATOMIC,        // Atomic counter buffer
+	INDIRECT,      // Indirect draw / dispatch arguments
+	TRANSFER,      // Read back or written by the CPU (glGetBufferSubData, glReadPixels, etc.)
+};
+
+// A pass does its thing in here, returning false if something went horribly wrong //
+// (It can capture whatever it needs, so one pass function can be added several times over different things) //
+typedef std::function<bool()> PassFunction;
+
+// Resources //
+int graphImportTexture(std::string name, unsigned int texture);
+int graphImportBuffer(std::string name, unsigned int buffer);
+int graphImportWindow(std::string name);
+int graphCreateTexture(std::string name, TextureDescription description);
+void graphSetTexture(int resource, unsigned int texture);
+void graphSetBuffer(int resource, unsigned int buffer);
+void graphSetDescription(int resource, TextureDescription description);
+unsigned int graphTexture(int resource);
+unsigned int graphBuffer(int resource);
+
+// Passes //
+int graphAddPass(std::string name, PassFunction execute, bool hasSideEffects = false);
+void graphRead(int pass, int resource, Access access);
+void graphWrite(int pass, int resource, Access access);
+
+// Running it //
+bool compileRenderGraph();
+bool executeRenderGraph();
+void clearRenderGraph();
+
+// Everything above works on whichever graph's bound, so every renderer can have its own (see Source/renderer.h) //
+// There's always one bound to start with, & deleting the bound graph goes back to that one //
+// (Clear a graph before deleting it, with it bound, so its framebuffers go too) //
+struct RenderGraph;
+RenderGraph* newRenderGraph();
+void deleteRenderGraph(RenderGraph* graph);
+void bindRenderGraph(RenderGraph* graph);
+
+// Runs a made up frame through a graph of its own, checking culling, transient lifetimes, aliasing & barriers all //
+// come out right //
+// nel's frames never have transients, so this is the only thing that exercises them (run it with --check-graph) //
+// Needs a GL context, & leaves whatever graph was bound as it was //
+bool checkRenderGraph();
\ No newline at end of file
@@ -0,0 +1,379 @@
+#include "image.h"
+#include "print.h"
+#include "vec.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+////////////
+// Images //
+////////////
+
+static bool readFile(std::string path, std::vector<unsigned char>& bytes) {
+	std::ifstream fileStream(path, std::ios::binary);
+	if (!fileStream.is_open()) { error("Could not open image '" + path + "'."); return false; }
+	bytes.assign(std::istreambuf_iterator<char>(fileStream), std::istreambuf_iterator<char>());
+	return true;
+}
+
+/////////
+// HDR //
+/////////
+
+// Each pixel is a shared exponent plus an 8-bit mantissa per channel //
+static void decodeRGBE(const unsigned char* rgbe, float* rgb) {
+	float scale = rgbe[3] == 0 ? 0 : std::ldexp(1.0f, (int)rgbe[3] - (128 + 8));
+	for (int channel = 0; channel < 3; channel++) rgb[channel] = rgbe[channel] * scale;
+}
+
+bool loadHDR(Image& image, std::string path) {
+	std::vector<unsigned char> bytes;
+	if (!readFile(path, bytes)) return false;
+
+	// The header is text, one setting per line, ending with a blank line & then the resolution //
+	size_t position = 0;
+	auto readLine = [&]() {
+		std::string line;
+		while (position < bytes.size() && bytes[position] != '\n') line += (char)bytes[position++];
+		position++;
+		return line;
+	};
+	std::string line = readLine();
+	if (line != "#?RADIANCE" && line != "#?RGBE") { error("'" + path + "' isn't a Radiance HDR file."); return false; }
+	while (position < bytes.size() && !(line = readLine()).empty()) {
+		if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe") { error("'" + path + "' uses " + line.substr(7) + ", only RGBE is supported."); return false; }
+	}
+
+	std::istringstream resolution(readLine());
+	std::string yAxis, xAxis;
+	int height = 0, width = 0;
+	resolution >> yAxis >> height >> xAxis >> width;
+	if (yAxis != "-Y" || xAxis != "+X" || width <= 0 || height <= 0) { error("'" + path + "' is stored in an orientation nel can't read."); return false; }
+
+	image.width = width;
+	image.height = height;
+	image.pixels.assign((size_t)width * height * 3, 0);
+	std::vector<unsigned char> scanline((size_t)width * 4);
+	for (int y = 0; y < height; y++) {
+		if (position + 4 > bytes.size()) { error("'" + path + "' ends early."); return false; }
+		const unsigned char* start = &bytes[position];
+
+		// Run-length encoded scanlines start with 2, 2 & the width, then store each channel separately //
+		if (width >= 8 && width < 32768 && start[0] == 2 && start[1] == 2 && ((start[2] << 8) | start[3]) == width) {
+			position += 4;
+			for (int channel = 0; channel < 4; channel++) {
+				for (int x = 0; x < width;) {
+					if (position >= bytes.size()) { error("'" + path + "' ends early."); return false; }
+					int count = bytes[position++];
+					bool run = count > 128;
+					if (run) count -= 128;
+					if (count == 0 || x + count > width || position + (run ? 1 : count) > bytes.size()) { error("'" + path + "' has a broken scanline."); return false; }
+					for (int i = 0; i < count; i++) scanline[(size_t)(x + i) * 4 + channel] = bytes[run ? position : position + i];
+					position += run ? 1 : count;
+					x += count;
+				}
+			}
+		} else {
+			// Flat scanlines are just the pixels one after another //
+			if (position + scanline.size() > bytes.size()) { error("'" + path + "' ends early."); return false; }
+			std::memcpy(scanline.data(), start, scanline.size());
+			position += scanline.size();
+		}
+
+		for (int x = 0; x < width; x++) decodeRGBE(&scanline[(size_t)x * 4], &image.pixels[((size_t)y * width + x) * 3]);
+	}
+
+	return true;
+}
+
+/////////
+// EXR //
+/////////
+
+bool loadEXR(Image& image, std::string path) {
+	std::vector<unsigned char> bytes;
+	if (!readFile(path, bytes)) return false;
+
+	// Everything in an EXR is little endian, same as anything nel runs on //
+	size_t position = 0;
+	bool broken = false;
+	auto read = [&](void* value, size_t size) {
+		if (position + size > bytes.size()) { broken = true; std::memset(value, 0, size); return; }
+		std::memcpy(value, &bytes[position], size);
+		position += size;
+	};
+	auto readString = [&]() {
+		std::string text;
+		while (position < bytes.size() && bytes[position] != 0) text += (char)bytes[position++];
+		position++;
+		return text;
+	};
+
+	uint32_t magic = 0, version = 0;
+	read(&magic, 4);
+	read(&version, 4);
+	if (magic != 20000630) { error("'" + path + "' isn't an OpenEXR file."); return false; }
+	if ((version & 0xFF) != 2 || (version & 0x1E00) != 0) { error("'" + path + "' is tiled, deep or multi-part, which nel can't read."); return false; }
+
+	// The header's a list of named attributes, ending in an empty name //
+	struct Channel {
+		std::string name;
+		int32_t type;
+	};
+	std::vector<Channel> channels;
+	int32_t window[4] = {};
+	unsigned char compression = 255;
+	for (std::string name = readString(); !name.empty() && !broken; name = readString()) {
+		std::string type = readString();
+		int32_t size = 0;
+		read(&size, 4);
+		size_t end = position + (size_t)size;
+		if (size < 0 || end > bytes.size()) { broken = true; break; }
+
+		if (name == "channels" && type == "chlist") {
+			// Each channel is a name, a pixel type, a linear flag, 3 reserved bytes & two sampling rates //
+			for (std::string channel = readString(); !channel.empty() && position < end; channel = readString()) {
+				Channel entry = {channel, 0};
+				read(&entry.type, 4);
+				position += 12;
+				channels.push_back(entry);
+			}
+		} else if (name == "compression") {
+			read(&compression, 1);
+		} else if (name == "dataWindow") {
+			read(window, sizeof(window));
+		}
+		position = end;
+	}
+	if (broken) { error("'" + path + "' has a broken header."); return false; }
+	if (compression != 0) { error("'" + path + "' is compressed, and nel can only read uncompressed EXRs."); return false; }
+
+	int width = window[2] - window[0] + 1, height = window[3] - window[1] + 1;
+	if (width <= 0 || height <= 0) { error("'" + path + "' has no pixels."); return false; }
+
+	// Find where R, G & B (or just Y) go. Channels are stored in the order the header lists them (alphabetical) //
+	int targets[3] = {-1, -1, -1};
+	for (int i = 0; i < (int)channels.size(); i++) {
+		const std::string& name = channels[i].name;
+		if (name == "R" || name == "Y") targets[0] = i;
+		if (name == "G" || name == "Y") targets[1] = i;
+		if (name == "B" || name == "Y") targets[2] = i;
+	}
+	if (targets[0] == -1 || targets[1] == -1 || targets[2] == -1) { error("'" + path + "' doesn't have R, G & B channels (or a Y channel)."); return false; }
+
+	// Then comes a table of where each scanline starts, which uncompressed files don't strictly need //
+	image.width = width;
+	image.height = height;
+	image.pixels.assign((size_t)width * height * 3, 0);
+	position += (size_t)height * 8;
+
+	// Each scanline: its y, its size, then every channel's values for the whole row, one channel after another //
+	for (int line = 0; line < height; line++) {
+		int32_t y = 0, size = 0;
+		read(&y, 4);
+		read(&size, 4);
+		y -= window[1];
+		if (broken || y < 0 || y >= height || size < 0 || position + (size_t)size > bytes.size()) { error("'" + path + "' has a broken scanline."); return false; }
+
+		size_t channelStart = position;
+		for (int i = 0; i < (int)channels.size(); i++) {
+			size_t valueSize = channels[i].type == 1 ? 2 : 4;
+			if (channelStart + valueSize * width > position + size) { error("'" + path + "' has a broken scanline."); return false; }
+
+			for (int channel = 0; channel < 3; channel++) {
+				if (targets[channel] != i) continue;
+				for (int x = 0; x < width; x++) {
+					const unsigned char* value = &bytes[channelStart + valueSize * x];
+					float decoded;
+					if (channels[i].type == 1) {
+						uint16_t half;
+						std::memcpy(&half, value, 2);
+						decoded = halfToFloat(half);
+					} else if (channels[i].type == 2) {
+						std::memcpy(&decoded, value, 4);
+					} else {
+						uint32_t integer;
+						std::memcpy(&integer, value, 4);
+						decoded = (float)integer;
+					}
+					image.pixels[((size_t)y * width + x) * 3 + channel] = decoded;
+				}
+			}
+			channelStart += valueSize * width;
+		}
+		position += size;
+	}
+
+	return true;
+}
+
+/////////
+// PPM //
+/////////
+
+// 8-bit sRGB to linear, looked up rather than worked out, since every texel of every mip goes through it //
+static const float* srgbTable() {
+	static const std::vector<float> table = [] {
+		std::vector<float> values(256);
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return values;
+	}();
+	return table.data();
+}
+
+static unsigned char linearToSRGB(float value) {
+	value = std::clamp(value, 0.0f, 1.0f);
+	float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1 / 2.4f) - 0.055f;
+	return (unsigned char)(c * 255 + 0.5f);
+}
+
+bool loadPPM(Image& image, std::string path) {
+	std::vector<unsigned char> bytes;
+	if (!readFile(path, bytes)) return false;
+
+	// The header's "P6", then the width, height & biggest value, split up by whitespace (& maybe comments) //
+	size_t position = 0;
+	auto readNumber = [&]() {
+		while (position < bytes.size() && (std::isspace(bytes[position]) || bytes[position] == '#')) {
+			if (bytes[position] == '#') while (position < bytes.size() && bytes[position] != '\n') position++;
+			else position++;
+		}
+		long value = 0;
+		bool found = false;
+		while (position < bytes.size() && std::isdigit(bytes[position]) && value < 1 << 24) { value = value * 10 + (bytes[position++] - '0'); found = true; }
+		return found ? value : -1;
+	};
+	if (bytes.size() < 2 || bytes[0] != 'P' || bytes[1] != '6') { error("'" + path + "' isn't a binary PPM file."); return false; }
+	position = 2;
+	long width = readNumber(), height = readNumber(), maximum = readNumber();
+	if (width <= 0 || height <= 0 || maximum <= 0 || maximum > 65535) { error("'" + path + "' has a broken header."); return false; }
+
+	// Exactly one whitespace character, then the pixels (two bytes a value, big end first, if they go past 255) //
+	position++;
+	size_t valueSize = maximum > 255 ? 2 : 1, count = (size_t)width * height * 3;
+	if (position + count * valueSize > bytes.size()) { error("'" + path + "' ends early."); return false; }
+
+	image.width = (unsigned int)width;
+	image.height = (unsigned int)height;
+	image.pixels.resize(count);
+	const float* table = srgbTable();
+	for (size_t i = 0; i < count; i++) {
+		if (valueSize == 1 && maximum == 255) { image.pixels[i] = table[bytes[position + i]]; continue; }
+		unsigned int value = valueSize == 1 ? bytes[position + i] : (unsigned int)bytes[position + i * 2] << 8 | bytes[position + i * 2 + 1];
+		float c = (float)value / maximum;
+		image.pixels[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+	return true;
+}
+
+bool loadImage(Image& image, std::string path) {
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (extension == "hdr") return loadHDR(image, path);
+	if (extension == "exr") return loadEXR(image, path);
+	if (extension == "ppm") return loadPPM(image, path);
+	error("Don't know how to load '" + path + "' (only .hdr, .exr & .ppm are supported).");
+	return false;
+}
+
+//////////
+// Mips //
+//////////
+
+MipLevel encodeLevel(const Image& image) {
+	MipLevel level;
+	level.width = image.width;
+	level.height = image.height;
+	level.texels.resize((size_t)image.width * image.height * 4);
+	parallelFor(image.height, 16, [&](size_t begin, size_t end) {
+		for (size_t i = begin * image.width; i < end * image.width; i++) {
+			for (int channel = 0; channel < 3; channel++) level.texels[i * 4 + channel] = linearToSRGB(image.pixels[i * 3 + channel]);
+			level.texels[i * 4 + 3] = 255;
+		}
+	});
+	return level;
+}
+
+void sampleLevel(const MipLevel& level, float u, float v, float* rgba) {
+	const float* table = srgbTable();
+
+	// Texel centres are at half texels, same as GL's bilinear filtering //
+	float x = u * level.width - 0.5f, y = v * level.height - 0.5f;
+	float x0 = std::floor(x), y0 = std::floor(y);
+	float fx = x - x0, fy = y - y0;
+	auto wrap = [](float value, unsigned int size) { return (size_t)(value - std::floor(value / size) * size) % size; };
+	size_t columns[2] = {wrap(x0, level.width), wrap(x0 + 1, level.width)};
+	size_t rows[2] = {wrap(y0, level.height), wrap(y0 + 1, level.height)};
+
+	for (int channel = 0; channel < 4; channel++) rgba[channel] = 0;
+	for (int corner = 0; corner < 4; corner++) {
+		float weight = (corner & 1 ? fx : 1 - fx) * (corner & 2 ? fy : 1 - fy);
+		const unsigned char* texel = &level.texels[(rows[corner >> 1] * level.width + columns[corner & 1]) * 4];
+		for (int channel = 0; channel < 3; channel++) rgba[channel] += weight * table[texel[channel]];
+		rgba[3] += weight * texel[3] / 255.0f;
+	}
+}
+
+MipLevel resizeLevel(const MipLevel& source, unsigned int width, unsigned int height) {
+	MipLevel level;
+	level.width = width;
+	level.height = height;
+	level.texels.resize((size_t)width * height * 4);
+	parallelFor(height, 16, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; y++) {
+			for (unsigned int x = 0; x < width; x++) {
+				float rgba[4];
+				sampleLevel(source, (x + 0.5f) / width, (y + 0.5f) / height, rgba);
+				unsigned char* texel = &level.texels[(y * width + x) * 4];
+				for (int channel = 0; channel < 3; channel++) texel[channel] = linearToSRGB(rgba[channel]);
+				texel[3] = (unsigned char)(std::clamp(rgba[3], 0.0f, 1.0f) * 255 + 0.5f);
+			}
+		}
+	});
+	return level;
+}
+
+void buildMips(std::vector<MipLevel>& levels) {
+	const float* table = srgbTable();
+	levels.resize(1);
+	while (levels.back().width > 1 || levels.back().height > 1) {
+		const MipLevel& source = levels.back();
+		MipLevel level;
+		level.width = std::max(1u, source.width / 2);
+		level.height = std::max(1u, source.height / 2);
+		level.texels.resize((size_t)level.width * level.height * 4);
+
+		// Odd sizes don't halve evenly, so some texels cover 3 rows or columns instead of 2 //
+		parallelFor(level.height, 16, [&](size_t begin, size_t end) {
+			for (size_t y = begin; y < end; y++) {
+				size_t top = y * source.height / level.height, bottom = ((y + 1) * source.height + level.height - 1) / level.height;
+				for (size_t x = 0; x < level.width; x++) {
+					size_t left = x * source.width / level.width, right = ((x + 1) * source.width + level.width - 1) / level.width;
+					float sum[4] = {};
+					for (size_t sy = top; sy < bottom; sy++) {
+						for (size_t sx = left; sx < right; sx++) {
+							const unsigned char* texel = &source.texels[(sy * source.width + sx) * 4];
+							for (int channel = 0; channel < 3; channel++) sum[channel] += table[texel[channel]];
+							sum[3] += texel[3] / 255.0f;
+						}
+					}
+					float count = (float)((bottom - top) * (right - left));
+					unsigned char* texel = &level.texels[(y * level.width + x) * 4];
+					for (int channel = 0; channel < 3; channel++) texel[channel] = linearToSRGB(sum[channel] / count);
+					texel[3] = (unsigned char)(sum[3] / count * 255 + 0.5f);
+				}
+			}
+		});
+		levels.push_back(std::move(level));
+	}
+}
\ No newline at end of file
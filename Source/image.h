@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+////////////
+// Images //
+////////////
+
+// A floating point RGB image, top row first //
+struct Image {
+	unsigned int width = 0, height = 0;
+	std::vector<float> pixels;
+};
+
+// Radiance .hdr files (RGBE, flat or run-length encoded, top to bottom & left to right only) //
+bool loadHDR(Image& image, std::string path);
+
+// OpenEXR files, as long as they're single part, scanline & uncompressed (the rest need zlib & friends) //
+// Takes the R, G & B channels, or Y for greyscale images //
+bool loadEXR(Image& image, std::string path);
+
+// Binary (P6) PPM files, which are stored in sRGB, so they come out linear like everything else //
+bool loadPPM(Image& image, std::string path);
+
+// Picks a loader from the file's extension //
+bool loadImage(Image& image, std::string path);
+
+//////////
+// Mips //
+//////////
+
+// One level of a texture, as 8-bit sRGB RGBA (alpha's always opaque), top row first //
+// Ready to go straight into a GL_SRGB8_ALPHA8 texture, at a third of the size of the floats //
+struct MipLevel {
+	unsigned int width = 0, height = 0;
+	std::vector<unsigned char> texels;
+};
+
+// Squashes a linear image down to 8-bit sRGB //
+MipLevel encodeLevel(const Image& image);
+
+// Reads a level with bilinear filtering (in linear space), wrapping around the edges, as linear RGB & alpha //
+// u & v go from 0 to 1 across the level, with v going down it //
+void sampleLevel(const MipLevel& level, float u, float v, float* rgba);
+
+// Stretches a level out (or squashes it down) to a new size, filtering the same way as sampleLevel //
+// (Squashing it by more than half skips texels, so start from a mip that's nearly the right size) //
+MipLevel resizeLevel(const MipLevel& level, unsigned int width, unsigned int height);
+
+// Fills in every level below levels[0], down to 1x1, halving each time like GL does //
+// Each texel's the average of the ones it covers (in linear space, or dark & bright patterns would get darker) //
+void buildMips(std::vector<MipLevel>& levels);
\ No newline at end of file
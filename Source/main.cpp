@@ -1,346 +1,439 @@
 #include "../Dependencies/glad/include/glad/glad.h"
 #include "../Dependencies/glfw/include/glfw/glfw3.h"
 
+#include "print.h"
+#include "resources.h"
+#include "renderer.h"
+#include "graph.h"
+#include "tracer.h"
+#include "textures.h"
+#include "parallel.h"
+
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <string>
 #include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
 #include <unordered_map>
 
-using std::sin, std::cos;
-
-#define DEBUG true
 #define PI 3.1415926535897932384626433832795028841971693993
 
-/////////////////////
-// Print Functions //
-/////////////////////
-
-// A basic function to just print some debug prints with some nice colors and styling //
-int color = 0;
-std::string colors[3] = {"\x1b[31m", "\x1b[32m", "\x1b[34m"};
-void print(std::string message) {
-	std::cout << colors[color++ % 3] + ">> " + "\x1b[0;3m" + message + "\x1b[m" << std::endl;
-}
-
-// Similar function to print errors with a different styling //
-void error(std::string message) {
-	std::cerr << "\x1b[41;1m!! ERROR: " + message + "\x1b[m" << std::endl;
-}
-
-// Another print function for debug messages
-void debug(std::string item, std::string message) {
-	if (!DEBUG) return;
-	std::cout << "\x1b[2;3m$$ DEBUG " + item + ": " + message + "\x1b[m" << std::endl;
-}
-
-//////////////
-// Uniforms //
-//////////////
-
-float uFrame = 0;
-
-float uCameraPosition[3] = {0, 0, 0};
-float uCameraRotationMatrix[9]  = {
-	0, 0, 0,
-	0, 0, 0,
-	0, 0, 0,
-};
-
-float uWidth, uHeight, uAspectRatio;
+// nel is one renderer drawing into a window, with a loop around it to steer the camera & pace the frames //
+// (Everything that actually gets the scene onto the GPU & traces it lives in Source/renderer.h) //
+// It lives in main, so it's gone before anything static is //
+Renderer* MainRenderer;
 
 ////////////
 // Window //
 ////////////
 
-GLFWwindow* Window;
 int width, height;
 bool ShouldExit = false, PauseStatus = false;
-bool createWindow() {
-	print("Creating window...");
 
-	// Create a window //
-	Window = glfwCreateWindow(1, 1, "Not Enough Light v1.0.0", nullptr, nullptr);
-	if (!Window) { error("Could not create window object."); return false; }
-	
-	// Load OpenGL function pointers //
-	// (This must be done after creating the window) //
-	glfwMakeContextCurrent(Window);
-	gladLoadGL(glfwGetProcAddress);	
-
-
-	// Maximize the window and pass the dimensions over to OpenGL //
-	glfwMaximizeWindow(Window);
-	glfwGetWindowSize(Window, &width, &height);
-	if (!width || !height) { error("Could not get window dimensions."); return false; }
-	glViewport(0, 0, width, height);
-	uWidth = (float)width;
-	uHeight = (float)height;
-	uAspectRatio = uWidth / uHeight;
-
-	// Minimize again to show off my fancy print statements .w. //
-	glfwIconifyWindow(Window);
-
-	return true;
+// Resizes come in as a flood of events while the user drags the window edge //
+// So all we do here is note down the new size, and the mainloop deals with it once per frame //
+bool WindowResized = false, WindowMinimized = false;
+void handleResize(GLFWwindow* window, int newWidth, int newHeight) {
+	// Minimizing gives us a 0x0 framebuffer, which there's no point rendering to //
+	WindowMinimized = (newWidth == 0 || newHeight == 0);
+	if (WindowMinimized) return;
+
+	width = newWidth;
+	height = newHeight;
+	WindowResized = true;
 }
 
-//////////////
-// Geometry //
-//////////////
-
-unsigned int VertexBuffer;
-bool createVertexBuffer() {
-	print("Generating geometry...");
-	
-	// Create & bind vertex buffer //
-	glGenBuffers(1, &VertexBuffer);
-	if (VertexBuffer == 0) { error("Could not create vertex buffer."); return false; }
-	glBindBuffer(GL_ARRAY_BUFFER, VertexBuffer);
-	
-	// Populate buffer with fullscreen quad //
-	const float QuadMesh[] = {
-		-1.0,  1.0,
-		 1.0,  1.0,
-		 1.0, -1.0,
-
-		 1.0, -1.0,
-		-1.0, -1.0,
-		-1.0,  1.0,
-	};
-	glBufferData(GL_ARRAY_BUFFER, 12 * sizeof(float), QuadMesh, GL_STATIC_DRAW);
-
-	// Set up vertex attributes (literally just position lmao) //
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-	glEnableVertexAttribArray(0);
-
-	// I was too lazy to reverse the winding order in my mesh TwT //
-	glFrontFace(GL_CW);
-	// Also for some reason clockwise winding is more intuitive to me idk //
+////////////////////
+// Event Handlers //
+////////////////////
 
-	return true;
+std::unordered_map<int, bool> KeyStates;
+void toggleTopView();
+void handleKeypress(GLFWwindow* window, int key, int _, int action, int mods) {
+	KeyStates[key] = (action == GLFW_PRESS || action == GLFW_REPEAT);
+	if (action == GLFW_PRESS && key == GLFW_KEY_ESCAPE) ShouldExit = true;
+	if (action == GLFW_PRESS && key == GLFW_KEY_R) ShouldExit = !MainRenderer->recompileShaders();
+	if (action == GLFW_PRESS && key == GLFW_KEY_P) PauseStatus = !PauseStatus;
+	if (action == GLFW_PRESS && key == GLFW_KEY_M) reportResourceUsage();
+	if (action == GLFW_PRESS && key == GLFW_KEY_B) MainRenderer->toggleBounceStats();
+	if (action == GLFW_PRESS && key == GLFW_KEY_V) toggleTopView();
 }
 
-/////////////
-// Shaders //
-/////////////
-
-unsigned int ShaderProgram, FragmentShader, VertexShader;
-bool createShaders() {
-	print("Creating shaders...");
-
-	// Create all the necessary objects //
-	ShaderProgram = glCreateProgram();
-	FragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	if (FragmentShader == 0) { error("Failed to create fragment shader."); return false; }
-	VertexShader = glCreateShader(GL_VERTEX_SHADER);
-	if (FragmentShader == 0) { error("Failed to create vertex shader."); return false; }
+// Only the main view gets steered, the others stay put //
+bool handleMovement(double step) {
+	float* rotation = MainRenderer->views[MAIN_VIEW].rotation;
+	if (KeyStates[GLFW_KEY_LEFT]) {
+		rotation[1] += PI / 2 * step;
+	}
+	if (KeyStates[GLFW_KEY_RIGHT]) {
+		rotation[1] -= PI / 2 * step;
+	}
+	if (KeyStates[GLFW_KEY_UP]) {
+		rotation[0] -= PI / 2 * step;
+	}
+	if (KeyStates[GLFW_KEY_DOWN]) {
+		rotation[0] += PI / 2 * step;
+	}
 
+	// Keep the yaw wrapped so it never grows big enough to lose precision //
+	// (Both states get shifted together so the interpolation doesn't spin around) //
+	if (std::abs(rotation[1]) > PI) {
+		float wrap = rotation[1] > 0 ? -2 * PI : 2 * PI;
+		rotation[1] += wrap;
+		MainRenderer->views[MAIN_VIEW].prevRotation[1] += wrap;
+	}
 	return true;
 }
 
-bool compileShader(unsigned int Shader, std::string path) {
-	print("Compiling shader '" + path + "'...");
-
-	// Read file from path into a stringstream //
-	std::ifstream fileStream(path);
-	if (!fileStream.is_open()) { error("Could not open file '" + path + "'."); return false; }
-	std::stringstream readStream;
-	readStream << fileStream.rdbuf();
-
-	// Read the contents of the file from the string stream //
-	const std::string FileContents = readStream.str();
+////////////
+// Timing //
+////////////
 
-	// Print the contents for debugging //
-	debug("FileContents", "\n" + FileContents);
-	
-	// Attach the shader source string to the shader object //
-	const char* fileContentsString = FileContents.c_str();
-	glShaderSource(Shader, 1, &fileContentsString, nullptr);
-
-	// Compile the shader //
-	glCompileShader(Shader);
-
-	// Check for compilation errors //
-	int compileStatus;
-	glGetShaderiv(Shader, GL_COMPILE_STATUS, &compileStatus);
-	if (compileStatus == GL_FALSE) {
-		int logLength;
-		glGetShaderiv(Shader, GL_INFO_LOG_LENGTH, &logLength);
-		
-		char* InfoLog = (char*)malloc(logLength);
-		glGetShaderInfoLog(Shader, logLength, NULL, InfoLog);
-		print("BEGIN GLSL ERROR LOG");
-		std::cout << InfoLog << std::endl;
-		print("END GLSL ERROR LOG");
-		free( (void*)InfoLog );
-
-		glDeleteShader(Shader);
-		error("Your shader code has an error in it, ya doofus -w-");
-		return false;
+// Everything in here is a double, since float seconds start skipping after a few hours of uptime //
+const double SimulationStep = 1.0 / 120.0;
+const double MaxFrameTime = 0.25;
+double Delta = 0;
+double PrevFrameTime = 0;
+double SimulationAccumulator = 0;
+double SimulationTime = 0;
+
+// Runs as many fixed-size simulation steps as fit in the time since the last frame //
+// Returns how far we are between the last step and the next one, for interpolation //
+double updateSimulation() {
+	double currentTime = glfwGetTime();
+	Delta = currentTime - PrevFrameTime;
+	PrevFrameTime = currentTime;
+
+	// Don't try to catch up on huge hitches (dragging the window, breakpoints, etc.) //
+	// Otherwise we'd spend the next frame simulating, fall further behind, and so on forever //
+	if (Delta > MaxFrameTime) Delta = MaxFrameTime;
+
+	SimulationAccumulator += Delta;
+	while (SimulationAccumulator >= SimulationStep) {
+		for (View& view : MainRenderer->views) std::copy(view.rotation, view.rotation + 3, view.prevRotation);
+		handleMovement(SimulationStep);
+		SimulationAccumulator -= SimulationStep;
+		SimulationTime += SimulationStep;
 	}
 
-	return true;
+	return SimulationAccumulator / SimulationStep;
 }
 
-bool linkProgram() {
-	print("Linking program...");
-	
-	// Attach compiled shaders and link them into an executable //
-	glAttachShader(ShaderProgram, FragmentShader);
-	glAttachShader(ShaderProgram, VertexShader);
-	glLinkProgram(ShaderProgram);
-	glUseProgram(ShaderProgram);
-	
-	// Check for any linking errors (very rare) //
-	int linkStatus;
-	glGetProgramiv(ShaderProgram, GL_LINK_STATUS, &linkStatus);
-	if (linkStatus == GL_FALSE) {
-		error("Program linking failed.");
-		return false;
-	}
-	
-	// Print the number of attached shaders (for debugging) //
-	int shaderCount;
-	glGetProgramiv(ShaderProgram, GL_ATTACHED_SHADERS, &shaderCount);
-	debug("shaderCount", std::to_string(shaderCount));
-
-	return true;
+//////////////////
+// Frame Pacing //
+//////////////////
+
+// The pacer sizes the GPU work (samples per pixel) so each frame fits in one refresh interval //
+// Until the GPU timers have something to say, it grows the budget by one sample while frames are on time //
+// and halves it when one runs late //
+const unsigned int MaxSamples = 256;
+const double LateFrameTolerance = 1.2;
+double TargetFrameTime = 1.0 / 60.0;
+double SampleBudget = 1;
+unsigned int LateFrames = 0;
+
+// How much of the frame the tracing is allowed to eat //
+// Moving gets a smaller slice so input stays snappy, standing still gets nearly all of it //
+const double MovingBudgetFraction = 0.5;
+const double StillBudgetFraction = 0.9;
+
+// How fast the budget is allowed to grow per frame while still (it drops instantly) //
+const double SampleRampRate = 1.25;
+
+// GPU timer queries take a few frames to come back, so we keep a small ring of them in flight //
+// That way we never stall waiting on a result //
+const int TimerQueryCount = 4;
+unsigned int TimerQueries[TimerQueryCount];
+unsigned int TimerQuerySamples[TimerQueryCount];
+double TimerQueryPixels[TimerQueryCount];
+bool TimerQueryPending[TimerQueryCount];
+int TimerQueryIndex = 0;
+
+// Whether this frame actually got a query (if they're all still pending, it goes untimed) //
+bool TimerQueryRunning = false;
+bool TimerQueriesSupported = false;
+
+// Smoothed GPU time (in seconds) per sample per pixel, 0 until the first query comes back //
+// (It's per pixel so it stays meaningful when the render resolution changes) //
+const double SampleCostSmoothing = 0.2;
+double SampleCost = 0;
+double GPUFrameTime = 0;
+
+void initFramePacer() {
+	// Aim for the refresh interval of whichever monitor we're on (or 60Hz if it won't tell us) //
+	const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	if (mode && mode->refreshRate > 0) TargetFrameTime = 1.0 / mode->refreshRate;
+	debug("TargetFrameTime", std::to_string(TargetFrameTime * 1000) + "ms");
+
+	// Timer queries have been core since 3.3, but better safe than sorry //
+	TimerQueriesSupported = GLAD_GL_VERSION_3_3;
+	if (TimerQueriesSupported) glGenQueries(TimerQueryCount, TimerQueries);
+	for (int i = 0; i < TimerQueryCount; i++) TimerQueryPending[i] = false;
+	debug("TimerQueriesSupported", TimerQueriesSupported ? "true" : "false");
+
+	SampleBudget = 1;
+	SampleCost = 0;
+	MainRenderer->samples = 1;
 }
 
-//////////////
-// Uniforms //
-//////////////
+// Collects any timer queries that have finished, without ever waiting on one //
+void collectTimerQueries() {
+	if (!TimerQueriesSupported) return;
 
-bool setUniform(const char* name, float value) {
-	
-	// Get the location of the requested uniform //
-	int location = glGetUniformLocation(ShaderProgram, name);
-	if (location == -1) { error("Could not get location of uniform '" + std::string(name) + "'."); return false; }
+	// Queries finish in order, so walk from the oldest one and stop at the first one that isn't ready //
+	for (int i = 0; i < TimerQueryCount; i++) {
+		int index = (TimerQueryIndex + i) % TimerQueryCount;
+		if (!TimerQueryPending[index]) continue;
 
-	// Set its value //
-	glUniform1f(location, value);	
+		int available = 0;
+		glGetQueryObjectiv(TimerQueries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
 
-	return true;
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(TimerQueries[index], GL_QUERY_RESULT, &elapsed);
+		TimerQueryPending[index] = false;
+
+		GPUFrameTime = elapsed * 1e-9;
+		double cost = GPUFrameTime / (std::max(1u, TimerQuerySamples[index]) * TimerQueryPixels[index]);
+		SampleCost = SampleCost == 0 ? cost : SampleCost + (cost - SampleCost) * SampleCostSmoothing;
+	}
 }
 
-enum Uniform {
-	FLOAT,
-	INT,
-	UINT,
-	VEC3,
-	MAT3
-};
+// Wraps the GPU work of a frame in a timer query (if there's a free one) //
+// (That's every view's passes, so tracedPixels has to be worked out before any of them run) //
+void beginFrameTimer() {
+	if (!TimerQueriesSupported || TimerQueryPending[TimerQueryIndex]) return;
+	glBeginQuery(GL_TIME_ELAPSED, TimerQueries[TimerQueryIndex]);
+	TimerQueryRunning = true;
+	TimerQuerySamples[TimerQueryIndex] = (unsigned int)MainRenderer->samples;
+	TimerQueryPixels[TimerQueryIndex] = MainRenderer->tracedPixels();
+	TimerQueryPending[TimerQueryIndex] = true;
+}
 
-bool setUniform(const char* name, float* data, unsigned int type) {
-	int location = glGetUniformLocation(ShaderProgram, name);
-	if (location == -1) { error("Could not set uniform '" + std::string(name) + "' - Location could not be found."); return false; }
-	switch (type) {
-		case Uniform::FLOAT:
-			glUniform1f(location, *data);
-			break;
-		case Uniform::INT:
-			glUniform1i(location, (int)*data);
-			break;
-		case Uniform::UINT:
-			glUniform1ui(location, (unsigned int)*data);
-			break;
-		case Uniform::VEC3:
-			glUniform3f(location, data[0], data[1], data[2]);
-			break;
-		case Uniform::MAT3:
-			glUniformMatrix3fv(location, 1, GL_TRUE, data);
-			break;
-		default:
-			error("Could not set uniform '" + std::string(name) + "' - Type is not supported.");
-			return false;
-	}
-	
-	return true;
+void endFrameTimer() {
+	if (!TimerQueryRunning) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	TimerQueryRunning = false;
+	TimerQueryIndex = (TimerQueryIndex + 1) % TimerQueryCount;
 }
 
-bool setInitialUniforms() {
-	print("Passing parameters to the GPU...");
-	
-	bool successState = true;
+bool isCameraMoving() {
+	return KeyStates[GLFW_KEY_LEFT] || KeyStates[GLFW_KEY_RIGHT] || KeyStates[GLFW_KEY_UP] || KeyStates[GLFW_KEY_DOWN];
+}
 
-	// Set uniforms to store the screen dimensions & aspect ratio //
-	successState &= setUniform("uWidth", &uWidth, Uniform::FLOAT);
-	successState &= setUniform("uHeight", &uHeight, Uniform::FLOAT);
-	successState &= setUniform("uAspectRatio", &uAspectRatio, Uniform::FLOAT);
+void updateFramePacer(double frameTime) {
+	// A frame counts as late once it misses the refresh interval by a good margin //
+	// (vsync jitter alone shouldn't be enough to knock the budget down) //
+	bool late = frameTime > TargetFrameTime * LateFrameTolerance;
+	if (late) LateFrames++;
+
+	collectTimerQueries();
+
+	if (SampleCost > 0) {
+		// We know what a sample costs, so work out how many fit in the time we're allowed //
+		double budget = TargetFrameTime * (isCameraMoving() ? MovingBudgetFraction : StillBudgetFraction);
+		// (SampleCost comes from the timers, so this closes the loop on what the GPU actually did) //
+		// (Every view shares the frame, so the samples get spread over all of their pixels) //
+		double desired = budget / (SampleCost * std::max(1.0, MainRenderer->tracedPixels()));
+
+		// Drop right away when we're over, but only creep back up so we don't oscillate //
+		// (The timers are a few frames behind, so they can still say there's room when a frame's just run late, but a //
+		// late frame never gets to raise the budget) //
+		if (late || desired < SampleBudget) SampleBudget = std::min(desired, SampleBudget);
+		else SampleBudget = std::min(desired, SampleBudget * SampleRampRate);
+	} else if (late) {
+		SampleBudget /= 2;
+	} else {
+		SampleBudget += 1;
+	}
 
-	return successState;
+	SampleBudget = std::clamp(SampleBudget, 1.0, (double)MaxSamples);
+	MainRenderer->samples = (float)std::floor(SampleBudget);
 }
 
-bool setPerFrameUniforms() {
-	bool successState = true;
-	
-	successState &= setUniform("uCameraRotationMatrix", uCameraRotationMatrix, Uniform::MAT3);
-	successState &= setUniform("uFrame", &uFrame, Uniform::UINT);
+//////////////////////
+// Resolution Scale //
+//////////////////////
+
+// While the camera moves, we trace fewer pixels and let the output pass upscale them //
+// Once it stops, we go back to full resolution so the image can converge //
+const float MovingRenderScale = 0.5;
+const float MinRenderScale = 0.25;
+float RenderScale = 1;
+
+// Every view gets the same scale, since they all share the one frame //
+void updateRenderScale() {
+	float scale = 1;
+	if (isCameraMoving()) {
+		scale = MovingRenderScale;
+
+		// If even a single sample at that size won't fit in the frame, shrink further //
+		// (Pixel count goes with the square of the scale, hence the sqrt) //
+		if (SampleCost > 0) {
+			double pixels = 0;
+			for (const View& view : MainRenderer->views) if (view.enabled) pixels += (double)view.width * view.height;
+			double budget = TargetFrameTime * MovingBudgetFraction;
+			double affordable = std::sqrt(budget / (SampleCost * pixels));
+			scale = std::clamp((float)affordable, MinRenderScale, MovingRenderScale);
+		}
+	}
 
-	return successState;
+	RenderScale = scale;
+	MainRenderer->setRenderScale(scale);
 }
 
-////////////
-// Camera //
-////////////
+// (--top-view turns it on, & V turns it on & off) //
+void toggleTopView() {
+	bool enabled = !MainRenderer->views[TOP_VIEW].enabled;
+	print(std::string("Top view ") + (enabled ? "on" : "off") + ".");
+	if (!MainRenderer->setTopView(enabled)) { error("Could not rebuild the render graph for the top view."); ShouldExit = true; }
+}
 
-float CameraRotation[3] = {0, 0, 0};
-bool calculateCamera() {
-	// For SOME reason GLSL uniform mat3s are stored in column-major order //
-	// Because of course, everyone just loves screwing with mathematicians //
-	float newCameraRotationMatrix[9] = {
-		cos( CameraRotation[1] ), -sin( CameraRotation[0] ) * sin( CameraRotation[1] ), -cos( CameraRotation[0] ) * sin( CameraRotation[1] ),
-		0.0                     ,  cos( CameraRotation[0] )                           , -sin( CameraRotation[0] )                           ,
-		sin( CameraRotation[1] ),  sin( CameraRotation[0] ) * cos( CameraRotation[1] ),  cos( CameraRotation[0] ) * cos( CameraRotation[1] ),
-	};
-	
-	for (int i = 0; i < 9; i++) uCameraRotationMatrix[i] = newCameraRotationMatrix[i];
+///////////////
+// Benchmark //
+///////////////
+
+// Renders the same scene with each node layout, & compares how much memory they take & how fast they trace //
+// Every frame is the same size & sample count, and the accumulation gets thrown away each time, so both //
+// layouts do exactly the same work //
+const unsigned int BenchmarkWarmupFrames = 8;
+const unsigned int BenchmarkFrames = 64;
+const unsigned int BenchmarkSamples = 4;
+
+bool runBenchmark(std::string path) {
+	print("Benchmarking node layouts...");
+	const char* layoutNames[] = {"full", "compressed"};
+
+	// Timestamps, rather than elapsed time queries, so one pair can cover every frame that's measured //
+	GLuint queries[2];
+	glGenQueries(2, queries);
+
+	for (int layout = FULL_NODES; layout <= COMPRESSED_NODES; layout++) {
+		MainRenderer->layoutOverride = layout;
+		if (!MainRenderer->loadScene(path)) return false;
+		const SceneBuffers& buffers = MainRenderer->buffers;
+		size_t nodeBytes = buffers.nodes.size() * sizeof(BVHNode) + buffers.wideNodes.size() * sizeof(WideBVHNode);
+
+		MainRenderer->setRenderScale(1);
+		MainRenderer->samples = (float)BenchmarkSamples;
+		for (unsigned int frame = 0; frame < BenchmarkWarmupFrames + BenchmarkFrames; frame++) {
+			if (frame == BenchmarkWarmupFrames) glQueryCounter(queries[0], GL_TIMESTAMP);
+			MainRenderer->frame++;
+			MainRenderer->dirtyAllViews();
+			if (!MainRenderer->renderFrame()) { error("Could not render benchmark frame."); return false; }
+			glfwPollEvents();
+		}
+		glQueryCounter(queries[1], GL_TIMESTAMP);
+
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+		double seconds = std::max(1e-9, (end - start) * 1e-9);
+
+		// Every sample is one path, which starts with exactly one camera ray //
+		double rays = MainRenderer->tracedPixels() * BenchmarkSamples * BenchmarkFrames;
+		print(std::string(layoutNames[layout]) + " nodes: " + std::to_string(nodeBytes / 1024) + "KiB of mesh nodes, " +
+			std::to_string(seconds * 1000 / BenchmarkFrames) + "ms per frame, " + std::to_string(rays / seconds / 1e6) + "M camera rays/s");
+	}
 
+	glDeleteQueries(2, queries);
+	MainRenderer->layoutOverride = -1;
 	return true;
 }
 
-////////////////////
-// Event Handlers //
-////////////////////
+////////////////
+// CPU Render //
+////////////////
+
+// Renders the scene on the CPU from wherever the main view's camera starts, & writes it out as a PPM //
+bool renderOnCPU(std::string path, unsigned int samples) {
+	print("Rendering on the CPU (" + std::to_string(width) + "x" + std::to_string(height) + ", " + std::to_string(samples) + " samples)...");
+	const View& view = MainRenderer->views[MAIN_VIEW];
+	if (!MainRenderer->prepareFrame(1)) return false;
+
+	TracerCamera camera;
+	camera.position = view.cameraPosition;
+	for (int i = 0; i < 9; i++) camera.rotation[i] = view.rotationMatrix[i];
+	camera.aspectRatio = viewAspectRatio(view);
+
+	double start = glfwGetTime();
+	std::vector<float> pixels;
+	traceImage(MainRenderer->scene, camera, width, height, samples, MainRenderer->maxBounces, pixels);
+	print("Took " + std::to_string(glfwGetTime() - start) + "s, writing '" + path + "'...");
+	return writePPM(path, pixels, width, height);
+}
 
-bool recompileShaders() {
-	if (!compileShader(FragmentShader, "../Shaders/frag.glsl")) return false;
-	if (!compileShader(VertexShader, "../Shaders/vert.glsl")) return false;
+/////////////
+// Startup //
+/////////////
 
-	// Finally, link and use the program //
-	if (!linkProgram()) return false;
+// Every stage of starting up gets timed, right up to the first frame being finished, so we can keep an eye on how //
+// long it takes to get the first picture up. Stages can overlap, since most of them are jobs (see Source/parallel.h) //
+struct StartupStage {
+	std::string name;
+	bool mainThread;
+	double start, end;
+};
 
-	// Set the necessary uniforms //
-	if (!setInitialUniforms()) return false;
+std::chrono::steady_clock::time_point StartupTime;
+std::vector<StartupStage> StartupStages;
+bool ExitAfterFirstFrame = false;
 
-	print("Successfully recompiled shaders!!");
-	return true;
+// Times are kept in milliseconds since main started //
+double startupMilliseconds(std::chrono::steady_clock::time_point time) {
+	return std::chrono::duration<double, std::milli>(time - StartupTime).count();
 }
 
-float Delta;
-float prevFrameTime = 0;
-std::unordered_map<int, bool> KeyStates;
-void handleKeypress(GLFWwindow* window, int key, int _, int action, int mods) {
-	KeyStates[key] = (action == GLFW_PRESS || action == GLFW_REPEAT);
-	if (action == GLFW_PRESS && key == GLFW_KEY_ESCAPE) ShouldExit = true;
-	if (action == GLFW_PRESS && key == GLFW_KEY_R) ShouldExit = !recompileShaders();
-	if (action == GLFW_PRESS && key == GLFW_KEY_P) PauseStatus = !PauseStatus;
+// Adds a stage on the main thread that started at start & has just finished //
+void timeStartupStage(std::string name, std::chrono::steady_clock::time_point start) {
+	StartupStages.push_back({name, true, startupMilliseconds(start), startupMilliseconds(std::chrono::steady_clock::now())});
 }
 
-bool handleMovement() {
-	if (KeyStates[GLFW_KEY_LEFT]) {
-		CameraRotation[1] += PI / 2 * Delta;
+void addStartupJobs(const std::vector<JobTiming>& timings) {
+	for (const JobTiming& timing : timings) StartupStages.push_back({timing.name, timing.mainThread, startupMilliseconds(timing.start), startupMilliseconds(timing.end)});
+}
+
+std::string escapeJSON(std::string text) {
+	std::string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\') escaped += '\\';
+		escaped += c;
 	}
-	if (KeyStates[GLFW_KEY_RIGHT]) {
-		CameraRotation[1] -= PI / 2 * Delta;
+	return escaped;
+}
+
+// Prints every stage in the order they started, & writes them out as JSON too if there's somewhere to put it //
+// (busy is every stage's time added up, so comparing it to total shows how much overlapped) //
+bool reportStartup(std::string jsonPath) {
+	std::stable_sort(StartupStages.begin(), StartupStages.end(), [](const StartupStage& a, const StartupStage& b) { return a.start < b.start; });
+	double total = 0, busy = 0;
+	for (const StartupStage& stage : StartupStages) {
+		total = std::max(total, stage.end);
+		busy += stage.end - stage.start;
 	}
-	if (KeyStates[GLFW_KEY_UP]) {
-		CameraRotation[0] -= PI / 2 * Delta;
+
+	print("Startup times (ms):");
+	char row[256];
+	std::snprintf(row, sizeof(row), "%-40s %9s %9s  %s", "Stage", "Start", "Took", "Thread");
+	print(row);
+	for (const StartupStage& stage : StartupStages) {
+		std::snprintf(row, sizeof(row), "%-40s %9.2f %9.2f  %s", stage.name.c_str(), stage.start, stage.end - stage.start, stage.mainThread ? "main" : "worker");
+		print(row);
 	}
-	if (KeyStates[GLFW_KEY_DOWN]) {
-		CameraRotation[0] += PI / 2 * Delta;
+	std::snprintf(row, sizeof(row), "First frame after %.2fms (%.2fms of work)", total, busy);
+	print(row);
+
+	if (jsonPath.empty()) return true;
+	std::ofstream file(jsonPath);
+	if (!file.is_open()) { error("Could not write startup times to '" + jsonPath + "'."); return false; }
+	file << "{\n\t\"firstFrameMs\": " << total << ",\n\t\"busyMs\": " << busy << ",\n\t\"stages\": [";
+	for (size_t i = 0; i < StartupStages.size(); i++) {
+		const StartupStage& stage = StartupStages[i];
+		file << (i == 0 ? "\n" : ",\n") << "\t\t{\"name\": \"" << escapeJSON(stage.name) << "\", \"thread\": \"" << (stage.mainThread ? "main" : "worker") << "\", \"startMs\": " << stage.start << ", \"durationMs\": " << stage.end - stage.start << "}";
 	}
+	file << "\n\t]\n}\n";
 	return true;
 }
 
@@ -349,7 +442,11 @@ bool handleMovement() {
 /////////////////////
 
 bool mainloop();
-int main() {
+int main(int argc, char** argv) {
+	StartupTime = std::chrono::steady_clock::now();
+	Renderer renderer;
+	MainRenderer = &renderer;
+
 	// Print Header :3 //
 	std::cout <<
 		"\x1b[1m"
@@ -364,47 +461,108 @@ int main() {
 	///////////
 
 	// Initialize GLFW //
+	auto stageStart = std::chrono::steady_clock::now();
 	glfwInit();
+	timeStartupStage("GLFW init", stageStart);
 
 	// Create a window to display graphics on //
-	if (!createWindow()) { return -1; }
+	stageStart = std::chrono::steady_clock::now();
+	if (!MainRenderer->createContext(true)) { return -1; }
+	width = MainRenderer->width;
+	height = MainRenderer->height;
+	timeStartupStage("Create window", stageStart);
 
 	// Tell GLFW to call our event handler when a key is pressed/released //
-	glfwSetKeyCallback(Window, handleKeypress);
+	glfwSetKeyCallback(MainRenderer->window, handleKeypress);
+
+	// And the same for when the window gets resized //
+	glfwSetFramebufferSizeCallback(MainRenderer->window, handleResize);
 
 	// Initialize the KeyStates map with all false //
 	for (int i = 0; i < 348; i++) {
 		KeyStates[i] = false;
 	}
 
-	// Create a vertex buffer and populate it with a rectangle that covers the whole screen //
-	if (!createVertexBuffer()) { error("Could not create and populate vertex buffer."); return -1; }
-
-	// Create a shader program and shader objects //
-	if (!createShaders()) { error("Could not create shaders."); return -1; }
-	
-	// Compile the shaders! //
-	if (!compileShader(FragmentShader, "../Shaders/frag.glsl")) return -1;
-	if (!compileShader(VertexShader, "../Shaders/vert.glsl")) return -1;
+	// Read the command line: nel [--layout <full | compressed>] [--min-depth <n>] [--max-depth <n>] [--tile-pool <n>] [--benchmark] //
+	// [--cpu-render <out.ppm> [--samples <n>]] [--startup-json <out.json>] [--exit-after-first-frame] [--spirv] [--top-view] //
+	// [--check-graph] [scene] //
+	std::string scenePath = "../Scenes/default.nel", cpuRenderPath, startupJSONPath;
+	unsigned int cpuSamples = 16;
+	bool benchmark = false, checkGraph = false;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--benchmark") benchmark = true;
+		else if (argument == "--check-graph") checkGraph = true;
+		else if (argument == "--cpu-render" && i + 1 < argc) cpuRenderPath = argv[++i];
+		else if (argument == "--samples" && i + 1 < argc) cpuSamples = (unsigned int)std::max(1, std::atoi(argv[++i]));
+		else if (argument == "--min-depth" && i + 1 < argc) MainRenderer->minBounces = (unsigned int)std::max(0, std::atoi(argv[++i]));
+		else if (argument == "--max-depth" && i + 1 < argc) MainRenderer->maxBounces = (unsigned int)std::clamp(std::atoi(argv[++i]), 0, (int)MaxDepthLimit - 1);
+		else if (argument == "--startup-json" && i + 1 < argc) startupJSONPath = argv[++i];
+		else if (argument == "--exit-after-first-frame") ExitAfterFirstFrame = true;
+		else if (argument == "--spirv") MainRenderer->useSPIRV = true;
+		else if (argument == "--top-view") MainRenderer->views[TOP_VIEW].enabled = true;
+		else if (argument == "--tile-pool" && i + 1 < argc) setTilePoolSize((unsigned int)std::max(1, std::atoi(argv[++i])));
+		else if (argument == "--layout" && i + 1 < argc) {
+			std::string layout = argv[++i];
+			if (layout == "full") MainRenderer->layoutOverride = FULL_NODES;
+			else if (layout == "compressed") MainRenderer->layoutOverride = COMPRESSED_NODES;
+			else { error("Don't know of a node layout called '" + layout + "'."); return -1; }
+		}
+		else scenePath = argument;
+	}
 
-	// Finally, link and use the program //
-	if (!linkProgram()) return -1;
+	// Set up GL & load the scene (either the one we were given, or the default one), all as jobs (see Source/renderer.h) //
+	MainRenderer->addCreateJobs(scenePath);
 
-	// Set the necessary uniforms //
-	if (!setInitialUniforms()) return -1;
+	std::vector<JobTiming> jobTimings;
+	if (!waitForJobs(&jobTimings)) { error("Could not start up."); return -1; }
+	addStartupJobs(jobTimings);
 
 	///////////////
 	// Main Loop //
 	///////////////
 
 	// Maximize window one last time before starting mainloop //
-	glfwMaximizeWindow(Window);
+	glfwMaximizeWindow(MainRenderer->window);
+
+	// Start the clocks //
+	initFramePacer();
+	PrevFrameTime = glfwGetTime();
+
+	// Benchmarks, CPU renders & the render graph check run instead of the usual loop //
+	if (checkGraph) {
+		if (!checkRenderGraph()) return -1;
+		ShouldExit = true;
+	}
+	if (benchmark) {
+		if (!runBenchmark(scenePath)) return -1;
+		ShouldExit = true;
+	}
+	if (!cpuRenderPath.empty()) {
+		if (!renderOnCPU(cpuRenderPath, cpuSamples)) { error("Could not render on the CPU."); return -1; }
+		ShouldExit = true;
+	}
 
 	// Run mainloop until GLFW says we should stop //
+	// Starting up only counts as done once the first frame's actually finished on the GPU, so that one gets waited on //
 	print("Running simulation!");
-	while (!ShouldExit) if (!mainloop()) return -1;
+	bool startupReported = false;
+	stageStart = std::chrono::steady_clock::now();
+	while (!ShouldExit) {
+		if (!mainloop()) return -1;
+		if (startupReported || MainRenderer->frame == 0) continue;
+		glFinish();
+		timeStartupStage("First frame", stageStart);
+		if (!reportStartup(startupJSONPath)) return -1;
+		startupReported = true;
+		if (ExitAfterFirstFrame) ShouldExit = true;
+	}
 
-	// Tell GLFW to clean up its mess :3c //
+	// How often the pacer got it wrong, for judging how well it's keeping up //
+	print(std::to_string(LateFrames) + " of " + std::to_string(MainRenderer->frame) + " frames ran late.");
+
+	// Give back all the GPU memory we were holding, then tell GLFW to clean up its mess :3c //
+	MainRenderer->destroy();
 	glfwTerminate();
 
 	std::cout << std::endl;
@@ -412,40 +570,53 @@ int main() {
 }
 
 bool mainloop() {
-	if (PauseStatus) return true;
+	// While paused or minimized, just sleep until something happens //
+	// (We still need to handle events though, or we could never unpause) //
+	if (PauseStatus || WindowMinimized) {
+		glfwWaitEvents();
+		if (glfwWindowShouldClose(MainRenderer->window)) ShouldExit = true;
+		PrevFrameTime = glfwGetTime();
+		return true;
+	}
+
+	// Catch up with any resizing that happened since last frame //
+	if (WindowResized) {
+		WindowResized = false;
+		if (!MainRenderer->resize(width, height)) { error("Could not resize render targets."); return false; }
+	}
 
 	// Increment the frame counter //
-	uFrame++;
+	MainRenderer->frame++;
 
-	// Calculate Delta for framerate-independent movement //
-	Delta = glfwGetTime() - prevFrameTime;
-	prevFrameTime = glfwGetTime();
+	// Free any pooled GPU memory that's been sitting around unused //
+	trimResourcePool(MainRenderer->frame);
 
-	// Handle player movement //
-	handleMovement();
-	
-	// Bind the shaders //
-	glUseProgram(ShaderProgram);
-	
-	// Calculate the camera rotation matrix and pass it to the GPU //
-	if (!calculateCamera()) { error("Could not calculate rotation matrix for camera."); return false; }
+	// Step the simulation (player movement, etc.) at a fixed rate //
+	double alpha = updateSimulation();
 
-	// Pass all updated parameters to the GPU //
-	setPerFrameUniforms();
+	// Size this frame's resolution & sample count based on how the last few frames went //
+	updateRenderScale();
+	updateFramePacer(Delta);
+	
+	// Move anything in the scene that's animated (& refit its BVHs to match) //
+	if (!MainRenderer->updateSceneAnimation(SimulationTime + alpha * SimulationStep)) { error("Could not update scene animation."); return false; }
 
-	// Clear the screen //
-	glClear(GL_COLOR_BUFFER_BIT);
+	// Work out each view's camera & swap in any streamed texture tiles that have loaded //
+	if (!MainRenderer->prepareFrame(alpha)) return false;
 
-	// Draw our beautifully decorated rectangle //
-	glDrawArrays(GL_TRIANGLES, 0, 6);
+	// Run every pass in the frame (clearing, tracing & output, for every view), & time how long the GPU takes //
+	beginFrameTimer();
+	if (!MainRenderer->renderFrame()) { error("Could not render frame."); return false; }
+	endFrameTimer();
+	MainRenderer->reportBounceStats();
 
 	// Tell GLFW to actually show all our hard work //
-	glfwSwapBuffers(Window);
+	glfwSwapBuffers(MainRenderer->window);
 	
 	// Make sure that key presses are handled //
 	// Also, without this line it crashes -w- //
 	glfwPollEvents();
-	if (glfwWindowShouldClose(Window)) ShouldExit = true;
+	if (glfwWindowShouldClose(MainRenderer->window)) ShouldExit = true;
 
 	return true;
 }
\ No newline at end of file
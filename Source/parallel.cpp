@@ -0,0 +1,230 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//////////////
+// Parallel //
+//////////////
+
+// Idle workers grab chunks off a shared counter until there's nothing left //
+struct ParallelLoop {
+	const std::function<void(size_t, size_t)>* body = nullptr;
+	size_t count = 0, chunk = 0;
+	std::atomic<size_t> next = 0;
+	std::atomic<size_t> finished = 0;
+	unsigned int generation = 0;
+};
+
+// There's one pool of workers for both loops & jobs, so PoolMutex guards the loop's setup as well as the job queues //
+// (The workers never stop, so nothing they wait on is ever destroyed either, since destroying a condition variable //
+// that something's still waiting on never returns, & that would hang the process on its way out) //
+static std::vector<std::thread> Workers;
+static std::mutex LoopMutex;
+static std::mutex& PoolMutex = *new std::mutex;
+static std::condition_variable& WorkReady = *new std::condition_variable;
+static std::condition_variable& LoopFinished = *new std::condition_variable;
+static ParallelLoop Loop;
+static unsigned int ActiveWorkers = 0;
+static thread_local bool InsideLoop = false;
+
+// Grabs chunks of the current loop until they run out //
+static void runChunks() {
+	InsideLoop = true;
+	while (true) {
+		size_t begin = Loop.next.fetch_add(Loop.chunk);
+		if (begin >= Loop.count) break;
+		size_t end = std::min(Loop.count, begin + Loop.chunk);
+		(*Loop.body)(begin, end);
+		Loop.finished.fetch_add(end - begin);
+	}
+	InsideLoop = false;
+}
+
+// The workers are started the first time anything runs in parallel (or there's a job for them), and then stick around //
+// (They're detached, since they'd only be joined right as the process exits anyway. Expects PoolMutex to be held) //
+static void workerMain();
+static void startWorkers() {
+	if (!Workers.empty() || parallelThreadCount() == 1) return;
+	for (unsigned int i = 0; i < parallelThreadCount() - 1; i++) {
+		Workers.emplace_back(workerMain);
+		Workers.back().detach();
+	}
+}
+
+unsigned int parallelThreadCount() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+	if (count == 0) return;
+
+	// Small loops (and loops inside loops) aren't worth waking anyone up for //
+	grain = std::max<size_t>(1, grain);
+	if (InsideLoop || count <= grain || parallelThreadCount() == 1) { body(0, count); return; }
+
+	// Only one loop can have the workers at a time. Anyone else calling in meanwhile (usually a job, while the workers //
+	// are busy with another job's loop) just runs theirs by themselves, since waiting would only leave a core idle //
+	std::unique_lock<std::mutex> loopLock(LoopMutex, std::try_to_lock);
+	if (!loopLock.owns_lock()) { body(0, count); return; }
+
+	// Aim for a few chunks per thread, so one slow chunk doesn't hold everyone up //
+	size_t chunk = std::max(grain, count / (parallelThreadCount() * 4) + 1);
+	{
+		// Stragglers from the last loop have to be out before its counters get reset under them //
+		std::unique_lock<std::mutex> lock(PoolMutex);
+		startWorkers();
+		LoopFinished.wait(lock, [] { return ActiveWorkers == 0; });
+		Loop.body = &body;
+		Loop.count = count;
+		Loop.chunk = chunk;
+		Loop.next = 0;
+		Loop.finished = 0;
+		Loop.generation++;
+	}
+	WorkReady.notify_all();
+
+	runChunks();
+
+	std::unique_lock<std::mutex> lock(PoolMutex);
+	LoopFinished.wait(lock, [] { return Loop.finished == Loop.count; });
+}
+
+//////////
+// Jobs //
+//////////
+
+// Every job remembers who's waiting on it, so finishing one only has to look at its own dependents //
+// failed also gets set on jobs that never ran because something they depend on failed //
+struct Job {
+	std::string name;
+	JobThread thread;
+	std::function<bool()> work;
+	std::vector<JobID> dependents;
+	unsigned int waitingOn = 0;
+	bool finished = false, failed = false;
+	bool ran = false;
+	JobTiming timing;
+};
+
+// (A deque, so jobs being added never move the ones that are running. Everything in here is guarded by PoolMutex) //
+struct JobQueues {
+	std::condition_variable progress;
+	std::deque<Job> jobs;
+	std::deque<JobID> ready, readyMain;
+	unsigned int unfinished = 0;
+	bool anyFailed = false;
+};
+
+// (Never destroyed, for the same reason as the loop's condition variables) //
+static JobQueues& Jobs = *new JobQueues;
+
+// Jobs that depend on something that failed finish straight away, without running //
+static void finishJob(JobID id, bool failed);
+static void readyJob(JobID id) {
+	Job& job = Jobs.jobs[id];
+	if (job.failed) { finishJob(id, true); return; }
+	if (job.thread == MAIN_THREAD || Workers.empty()) {
+		Jobs.readyMain.push_back(id);
+		Jobs.progress.notify_all();
+	} else {
+		Jobs.ready.push_back(id);
+		WorkReady.notify_one();
+	}
+}
+
+// (Both of these expect the lock to be held already) //
+static void finishJob(JobID id, bool failed) {
+	Job& job = Jobs.jobs[id];
+	job.finished = true;
+	job.failed = failed;
+	job.work = nullptr;
+	Jobs.anyFailed |= failed;
+	Jobs.unfinished--;
+	for (JobID dependent : job.dependents) {
+		Jobs.jobs[dependent].failed |= failed;
+		if (--Jobs.jobs[dependent].waitingOn == 0) readyJob(dependent);
+	}
+	Jobs.progress.notify_all();
+}
+
+static void runJob(std::unique_lock<std::mutex>& lock, JobID id, bool mainThread) {
+	std::function<bool()> work = std::move(Jobs.jobs[id].work);
+	lock.unlock();
+	auto start = std::chrono::steady_clock::now();
+	bool succeeded = work();
+	auto end = std::chrono::steady_clock::now();
+	lock.lock();
+
+	Job& job = Jobs.jobs[id];
+	job.ran = true;
+	job.timing = {job.name, mainThread, start, end};
+	finishJob(id, !succeeded);
+}
+
+// Workers help out with loops before taking another job, since whoever started the loop is stuck waiting on it //
+// (With only one core there aren't any workers, & the main thread just runs every job itself) //
+static void workerMain() {
+	unsigned int seen = 0;
+	std::unique_lock<std::mutex> lock(PoolMutex);
+	while (true) {
+		WorkReady.wait(lock, [&] { return Loop.generation != seen || !Jobs.ready.empty(); });
+		if (Loop.generation != seen) {
+			seen = Loop.generation;
+			ActiveWorkers++;
+			lock.unlock();
+			runChunks();
+			lock.lock();
+			ActiveWorkers--;
+			LoopFinished.notify_all();
+			continue;
+		}
+		JobID id = Jobs.ready.front();
+		Jobs.ready.pop_front();
+		runJob(lock, id, false);
+	}
+}
+
+JobID addJob(std::string name, JobThread thread, std::vector<JobID> dependencies, std::function<bool()> work) {
+	std::lock_guard<std::mutex> lock(PoolMutex);
+	startWorkers();
+
+	JobID id = (JobID)Jobs.jobs.size();
+	Jobs.jobs.push_back({name, thread, std::move(work)});
+	Jobs.unfinished++;
+	for (JobID dependency : dependencies) {
+		Job& other = Jobs.jobs[dependency];
+		if (other.finished) Jobs.jobs[id].failed |= other.failed;
+		else {
+			other.dependents.push_back(id);
+			Jobs.jobs[id].waitingOn++;
+		}
+	}
+	if (Jobs.jobs[id].waitingOn == 0) readyJob(id);
+	return id;
+}
+
+bool waitForJobs(std::vector<JobTiming>* timings) {
+	std::unique_lock<std::mutex> lock(PoolMutex);
+	while (true) {
+		Jobs.progress.wait(lock, [] { return !Jobs.readyMain.empty() || Jobs.unfinished == 0; });
+		if (Jobs.readyMain.empty()) break;
+		JobID id = Jobs.readyMain.front();
+		Jobs.readyMain.pop_front();
+		runJob(lock, id, true);
+	}
+
+	if (timings) {
+		for (const Job& job : Jobs.jobs) if (job.ran) timings->push_back(job.timing);
+	}
+
+	bool successState = !Jobs.anyFailed;
+	Jobs.jobs.clear();
+	Jobs.anyFailed = false;
+	return successState;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+//////////////
+// Parallel //
+//////////////
+
+// Splits [0, count) into chunks of at least grain items and runs body(begin, end) on them across //
+// every core. The calling thread helps out too, and it only returns once every chunk is done //
+// Loops share their workers with jobs (see below), & only one loop can have them at a time. So calling it from //
+// inside a body, or while another loop (say, another job's) already has the workers, just runs it on the current thread //
+void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+// How many threads parallelFor spreads work over (including the caller) //
+unsigned int parallelThreadCount();
+
+//////////
+// Jobs //
+//////////
+
+// Jobs are bits of work that can start as soon as every job they depend on has finished, so loading can run as //
+// much as possible at once (reading files, building BVHs, etc.) instead of one thing after another //
+// Anything that touches GL has to run on the thread that owns the context, so those jobs are marked MAIN_THREAD, //
+// and only ever run from inside waitForJobs. Everything else goes to the same workers parallelFor uses, which help //
+// with any loop that's running before they pick up another job //
+// Jobs report their own errors & return false if they failed, in which case nothing that depends on them runs //
+enum JobThread {
+	ANY_THREAD,
+	MAIN_THREAD
+};
+
+typedef unsigned int JobID;
+
+// Jobs can add more jobs while they're running, but only ever depending on ones that already exist //
+JobID addJob(std::string name, JobThread thread, std::vector<JobID> dependencies, std::function<bool()> work);
+
+// When each job ran & where, for seeing where the time goes //
+struct JobTiming {
+	std::string name;
+	bool mainThread;
+	std::chrono::steady_clock::time_point start, end;
+};
+
+// Runs main thread jobs as they become ready until every job is done, then forgets about all of them //
+// Every job that actually ran gets its timing added to timings, if there is one //
+// (Only ever call it from the main thread, & never from inside a job) //
+bool waitForJobs(std::vector<JobTiming>* timings = nullptr);
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+#define DEBUG true
+
+/////////////////////
+// Print Functions //
+/////////////////////
+
+// A basic function to just print some debug prints with some nice colors and styling //
+inline int color = 0;
+inline std::string colors[3] = {"\x1b[31m", "\x1b[32m", "\x1b[34m"};
+inline void print(std::string message) {
+	std::cout << colors[color++ % 3] + ">> " + "\x1b[0;3m" + message + "\x1b[m" << std::endl;
+}
+
+// Similar function to print errors with a different styling //
+inline void error(std::string message) {
+	std::cerr << "\x1b[41;1m!! ERROR: " + message + "\x1b[m" << std::endl;
+}
+
+// Another print function for debug messages
+inline void debug(std::string item, std::string message) {
+	if (!DEBUG) return;
+	std::cout << "\x1b[2;3m$$ DEBUG " + item + ": " + message + "\x1b[m" << std::endl;
+}
\ No newline at end of file
@@ -0,0 +1,1141 @@
+#include "../Dependencies/glad/include/glad/glad.h"
+#include "../Dependencies/glfw/include/glfw/glfw3.h"
+
+#include "renderer.h"
+#include "print.h"
+#include "resources.h"
+#include "graph.h"
+#include "textures.h"
+
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+using std::sin, std::cos;
+
+#define PI 3.1415926535897932384626433832795028841971693993
+
+/////////////
+// Context //
+/////////////
+
+// Every renderer's window that's still around, so new ones have a context to share objects with //
+static std::vector<GLFWwindow*> Contexts;
+
+bool Renderer::createContext(bool visible) {
+	print("Creating window...");
+	this->visible = visible;
+
+	// Ask for at least GL 4.3, since the shaders need storage buffers //
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
+
+	// Create a window //
+	window = glfwCreateWindow(1, 1, "Not Enough Light v1.0.0", nullptr, Contexts.empty() ? nullptr : Contexts.front());
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	if (!window) { error("Could not create window object."); return false; }
+	Contexts.push_back(window);
+
+	// Load OpenGL function pointers //
+	// (This must be done after creating the window) //
+	glfwMakeContextCurrent(window);
+	gladLoadGL(glfwGetProcAddress);
+
+	// Every renderer draws with its own render graph & its own scene's textures //
+	graph = newRenderGraph();
+	textures = newSceneTextures();
+	makeCurrent();
+	if (!visible) return true;
+
+	// Maximize the window and pass the dimensions over to OpenGL //
+	// (We want the framebuffer size in pixels, which isn't the window size on high DPI screens) //
+	glfwMaximizeWindow(window);
+	glfwGetFramebufferSize(window, &width, &height);
+	if (!width || !height) { error("Could not get window dimensions."); return false; }
+	glViewport(0, 0, width, height);
+
+	// Sync buffer swaps to the display so the frame pacer has a refresh interval to aim for //
+	glfwSwapInterval(1);
+
+	// Minimize again to show off my fancy print statements .w. //
+	glfwIconifyWindow(window);
+
+	return true;
+}
+
+void Renderer::makeCurrent() {
+	GLFWwindow* current = glfwGetCurrentContext();
+	if (current != window) {
+		// Every context shares the one upload ring, but a fence only comes after its own context's copies, so whatever //
+		// was staged from the old one gets fenced there before switching away. It gets flushed too, since waiting on a //
+		// fence from another context can't flush it (see makeRingRoom) //
+		if (current) {
+			fenceUploads();
+			glFlush();
+		}
+		glfwMakeContextCurrent(window);
+	}
+	bindRenderGraph(graph);
+	bindSceneTextures(textures);
+}
+
+// Gives back everything the renderer was holding on to. Whichever renderer goes last takes every pooled resource & //
+// program variant with it, since there's no context left for them to belong to //
+void Renderer::destroy() {
+	if (!window) return;
+	makeCurrent();
+
+	clearRenderGraph();
+	deleteRenderGraph(graph);
+	deleteSceneTextures(textures);
+	graph = nullptr;
+	textures = nullptr;
+
+	for (View& view : views) if (view.accumulationTexture != 0) releaseTexture(view.accumulationTexture);
+	for (unsigned int buffer : sceneStorage) if (buffer != 0) releaseBuffer(buffer);
+	if (environmentTexture != 0) releaseTexture(environmentTexture);
+	if (bounceStatsBuffer != 0) releaseBuffer(bounceStatsBuffer);
+	if (vertexBuffer != 0) releaseBuffer(vertexBuffer);
+	glDeleteVertexArrays(1, &vertexArray);
+	glDeleteProgram(outputProgram);
+	glDeleteShader(vertexShader);
+	glDeleteShader(outputShader);
+	if (spirvVertexShader != 0) glDeleteShader(spirvVertexShader);
+
+	Contexts.erase(std::find(Contexts.begin(), Contexts.end(), window));
+	if (Contexts.empty()) {
+		clearProgramVariants();
+		freeResourcePool();
+	}
+
+	bindRenderGraph(nullptr);
+	bindSceneTextures(nullptr);
+	glfwMakeContextCurrent(nullptr);
+	glfwDestroyWindow(window);
+	window = nullptr;
+}
+
+Renderer::~Renderer() {
+	destroy();
+}
+
+//////////////
+// Geometry //
+//////////////
+
+bool Renderer::createVertexBuffer() {
+	print("Generating geometry...");
+
+	// Core profiles won't draw anything without a vertex array bound //
+	glGenVertexArrays(1, &vertexArray);
+	glBindVertexArray(vertexArray);
+
+	// Populate buffer with fullscreen quad //
+	const float QuadMesh[] = {
+		-1.0,  1.0,
+		 1.0,  1.0,
+		 1.0, -1.0,
+
+		 1.0, -1.0,
+		-1.0, -1.0,
+		-1.0,  1.0,
+	};
+
+	// Grab a vertex buffer from the resource pool & fill it in //
+	vertexBuffer = acquireBuffer(sizeof(QuadMesh), GL_STATIC_DRAW, "QuadMesh");
+	if (vertexBuffer == 0) { error("Could not create vertex buffer."); return false; }
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(QuadMesh), QuadMesh);
+
+	// Set up vertex attributes (literally just position lmao) //
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	glEnableVertexAttribArray(0);
+
+	// I was too lazy to reverse the winding order in my mesh TwT //
+	glFrontFace(GL_CW);
+	// Also for some reason clockwise winding is more intuitive to me idk //
+
+	return true;
+}
+
+///////////
+// Views //
+///////////
+
+// Works out where every view is in the window, in pixels //
+void Renderer::layoutViews() {
+	for (View& view : views) {
+		view.x = (int)std::round(view.area[0] * width);
+		view.y = (int)std::round(view.area[1] * height);
+		view.width = std::max(1, (int)std::round(view.area[2] * width));
+		view.height = std::max(1, (int)std::round(view.area[3] * height));
+	}
+}
+
+float viewAspectRatio(const View& view) {
+	return (float)view.width / (float)view.height;
+}
+
+static bool viewNeedsSamples(const View& view) {
+	return view.enabled && (view.accumulationDirty || view.accumulatedSamples < MaxAccumulatedSamples);
+}
+
+double Renderer::tracedPixels() const {
+	double pixels = 0;
+	for (const View& view : views) if (viewNeedsSamples(view)) pixels += (double)view.renderWidth * view.renderHeight;
+	return pixels;
+}
+
+void Renderer::dirtyAllViews() {
+	for (View& view : views) view.accumulationDirty = true;
+}
+
+void Renderer::setRenderScale(float scale) {
+	// Work out each render's size, keeping at least one pixel in each direction //
+	// (The aspect ratio is left alone, since the render still covers the whole view) //
+	for (View& view : views) {
+		float renderWidth = std::max(1.0f, std::round(view.width * scale));
+		float renderHeight = std::max(1.0f, std::round(view.height * scale));
+		if (renderWidth != view.renderWidth || renderHeight != view.renderHeight) view.accumulationDirty = true;
+		view.renderWidth = renderWidth;
+		view.renderHeight = renderHeight;
+	}
+}
+
+////////////////////
+// Render Targets //
+////////////////////
+
+// Each view's samples get traced into a float texture at whatever resolution we can afford this frame, //
+// and then the output pass stretches that over the view's part of the window //
+// The alpha channel holds the sample count, so plain additive blending is all it takes to //
+// keep accumulating samples across frames //
+
+// The render targets only ever get bigger, and the render uses whatever corner of them it needs //
+// Capacity is rounded up a bunch so dragging the window bigger doesn't reallocate on every frame //
+const int RenderTargetGranularity = 256;
+
+static int roundUpCapacity(int needed, int current) {
+	// Grow by at least half again, so a slow drag only reallocates a couple of times //
+	int capacity = std::max(needed, current + current / 2);
+	return (capacity + RenderTargetGranularity - 1) / RenderTargetGranularity * RenderTargetGranularity;
+}
+
+// Makes sure every view's render target can hold a render the size of its part of the window //
+// (Views that are turned off give theirs back) //
+bool Renderer::ensureRenderTargetCapacity() {
+	for (View& view : views) {
+		if (!view.enabled) {
+			if (view.accumulationTexture != 0) releaseTexture(view.accumulationTexture);
+			view.accumulationTexture = 0;
+			view.targetWidth = view.targetHeight = 0;
+			continue;
+		}
+		if (view.width <= view.targetWidth && view.height <= view.targetHeight) continue;
+
+		// Work out the new size (only growing the dimensions that actually need it) //
+		int newWidth = view.width > view.targetWidth ? roundUpCapacity(view.width, view.targetWidth) : view.targetWidth;
+		int newHeight = view.height > view.targetHeight ? roundUpCapacity(view.height, view.targetHeight) : view.targetHeight;
+		debug("RenderTargetCapacity", view.name + ": " + std::to_string(newWidth) + "x" + std::to_string(newHeight));
+
+		// Hand the old texture back to the pool (it gets freed for real if nothing else wants it) //
+		if (view.accumulationTexture != 0) releaseTexture(view.accumulationTexture);
+
+		// Get a texture for samples to accumulate into //
+		view.accumulationTexture = acquireTexture({newWidth, newHeight, GL_RGBA32F, 1, false}, view.name + "Accumulation");
+		if (view.accumulationTexture == 0) { error("Could not create accumulation texture."); return false; }
+
+		// Let the render graph know the passes should be using the new one //
+		if (view.accumulationResource != -1) graphSetTexture(view.accumulationResource, view.accumulationTexture);
+
+		view.targetWidth = newWidth;
+		view.targetHeight = newHeight;
+		view.accumulationDirty = true;
+		reportResourceUsage();
+	}
+	return true;
+}
+
+bool Renderer::resize(int newWidth, int newHeight) {
+	makeCurrent();
+	width = newWidth;
+	height = newHeight;
+
+	layoutViews();
+	if (!ensureRenderTargetCapacity()) return false;
+
+	// Whatever we accumulated was for the old size, so it has to go //
+	dirtyAllViews();
+	return true;
+}
+
+/////////////
+// Shaders //
+/////////////
+
+bool Renderer::createShaders() {
+	print("Creating shaders...");
+
+	// Create all the necessary objects //
+	vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	if (vertexShader == 0) { error("Failed to create vertex shader."); return false; }
+
+	// The output pass gets its own program, but it can share the vertex shader //
+	outputProgram = glCreateProgram();
+	outputShader = glCreateShader(GL_FRAGMENT_SHADER);
+	if (outputShader == 0) { error("Failed to create output shader."); return false; }
+
+	return true;
+}
+
+// Shaders get preprocessed first (see Source/shaders.h), which doesn't need GL, so at startup it happens on //
+// another thread while the main one gets on with something else //
+static bool compileShader(unsigned int Shader, const ShaderSource& source) {
+	print("Compiling shader '" + source.files[0] + "'...");
+	const std::string& FileContents = source.text;
+
+	// Print the contents for debugging //
+	debug("FileContents", "\n" + FileContents);
+
+	// Attach the shader source string to the shader object //
+	const char* fileContentsString = FileContents.c_str();
+	glShaderSource(Shader, 1, &fileContentsString, nullptr);
+
+	// Compile the shader //
+	glCompileShader(Shader);
+
+	// Check for compilation errors //
+	int compileStatus;
+	glGetShaderiv(Shader, GL_COMPILE_STATUS, &compileStatus);
+	if (compileStatus == GL_FALSE) {
+		int logLength;
+		glGetShaderiv(Shader, GL_INFO_LOG_LENGTH, &logLength);
+
+		char* InfoLog = (char*)malloc(logLength);
+		glGetShaderInfoLog(Shader, logLength, NULL, InfoLog);
+		print("BEGIN GLSL ERROR LOG");
+		std::cout << InfoLog << std::endl;
+		for (size_t i = 1; i < source.files.size(); i++) print("(File " + std::to_string(i) + " is '" + source.files[i] + "')");
+		print("END GLSL ERROR LOG");
+		free( (void*)InfoLog );
+
+		glDeleteShader(Shader);
+		error("Your shader code has an error in it, ya doofus -w-");
+		return false;
+	}
+
+	return true;
+}
+
+static bool compileShader(unsigned int Shader, std::string path, ShaderSource& source) {
+	return preprocessShader(path, {}, source) && compileShader(Shader, source);
+}
+
+static bool linkProgram(unsigned int Program, unsigned int Fragment, unsigned int Vertex) {
+	print("Linking program...");
+
+	// Attach compiled shaders and link them into an executable //
+	// (Attaching a shader that's already attached is a harmless error, so recompiling is fine) //
+	glAttachShader(Program, Fragment);
+	glAttachShader(Program, Vertex);
+	glGetError();
+	glLinkProgram(Program);
+	glUseProgram(Program);
+
+	// Check for any linking errors (very rare) //
+	int linkStatus;
+	glGetProgramiv(Program, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus == GL_FALSE) {
+		error("Program linking failed.");
+		return false;
+	}
+
+	// Print the number of attached shaders (for debugging) //
+	int shaderCount;
+	glGetProgramiv(Program, GL_ATTACHED_SHADERS, &shaderCount);
+	debug("shaderCount", std::to_string(shaderCount));
+
+	return true;
+}
+
+bool Renderer::recompileShaders() {
+	makeCurrent();
+	if (!compileShader(vertexShader, "../Shaders/vert.glsl", shaderSources[0])) return false;
+	if (!compileShader(outputShader, "../Shaders/output.glsl", shaderSources[1])) return false;
+
+	// Finally, link and use the programs //
+	// (Every trace program variant was linked against the old vertex shader, so they all have to go) //
+	// (SPIR-V gets loaded again too, so rebuilding it with CMake & then reloading picks it up) //
+	if (!linkProgram(outputProgram, outputShader, vertexShader)) return false;
+	clearProgramVariants();
+	if (spirvVertexShader != 0) glDeleteShader(spirvVertexShader);
+	spirvVertexShader = 0;
+	if (!specializeTraceProgram()) return false;
+
+	// The new shaders probably render something different, so start accumulating from scratch //
+	dirtyAllViews();
+
+	print("Successfully recompiled shaders!!");
+	return true;
+}
+
+//////////////
+// Uniforms //
+//////////////
+
+// Trace program variants compile out whatever the scene doesn't use (see Source/shaders.h), uniforms & all, //
+// so it's fine for those to be missing. Anywhere else, a missing uniform is a mistake //
+bool Renderer::uniformMissing(unsigned int program, int location) const {
+	return location == -1 && program != traceProgram;
+}
+
+// SPIR-V programs don't have to know their uniforms' names, so the trace program's get looked up in its module //
+int Renderer::uniformLocation(unsigned int program, const char* name) const {
+	if (program != traceProgram || !useSPIRV) return glGetUniformLocation(program, name);
+	auto location = traceModule.uniformLocations.find(name);
+	return location == traceModule.uniformLocations.end() ? -1 : location->second;
+}
+
+enum Uniform {
+	FLOAT,
+	INT,
+	UINT,
+	VEC2,
+	VEC3,
+	MAT3
+};
+
+bool Renderer::setUniform(unsigned int program, const char* name, float* data, unsigned int type) {
+	int location = uniformLocation(program, name);
+	if (uniformMissing(program, location)) { error("Could not set uniform '" + std::string(name) + "' - Location could not be found."); return false; }
+	switch (type) {
+		case Uniform::FLOAT:
+			glProgramUniform1f(program, location, *data);
+			break;
+		case Uniform::INT:
+			glProgramUniform1i(program, location, (int)*data);
+			break;
+		case Uniform::UINT:
+			glProgramUniform1ui(program, location, (unsigned int)*data);
+			break;
+		case Uniform::VEC2:
+			glProgramUniform2f(program, location, data[0], data[1]);
+			break;
+		case Uniform::VEC3:
+			glProgramUniform3f(program, location, data[0], data[1], data[2]);
+			break;
+		case Uniform::MAT3:
+			glProgramUniformMatrix3fv(program, location, 1, GL_TRUE, data);
+			break;
+		default:
+			error("Could not set uniform '" + std::string(name) + "' - Type is not supported.");
+			return false;
+	}
+
+	return true;
+}
+
+// (Trace program variants are shared by every renderer, but these are the same for all of them) //
+bool Renderer::setInitialUniforms() {
+	print("Passing parameters to the GPU...");
+
+	bool successState = true;
+
+	// The output pass reads the accumulated samples from texture unit 0 //
+	float accumulationUnit = 0;
+	successState &= setUniform(outputProgram, "uAccumulation", &accumulationUnit, Uniform::INT);
+
+	// & the trace pass reads the environment map from unit 1 //
+	float environmentUnit = 1;
+	successState &= setUniform(traceProgram, "uEnvironment", &environmentUnit, Uniform::INT);
+
+	// Material textures are in an array on their own unit, unless they're bindless (in which case the shader doesn't even have the uniform) //
+	float materialTextureUnit = MaterialTextureUnit;
+	if (!bindlessTextures()) successState &= setUniform(traceProgram, "uMaterialTextures", &materialTextureUnit, Uniform::INT);
+
+	// Streamed textures' tiles all share one texture, on their own unit too //
+	float tilePoolUnit = TilePoolUnit;
+	successState &= setUniform(traceProgram, "uTilePool", &tilePoolUnit, Uniform::INT);
+
+	return successState;
+}
+
+// The trace shader's per-frame uniforms, laid out exactly like its FrameUniforms block //
+// (std140, so the camera position & each of the rotation's columns take up 16 bytes) //
+const unsigned int FrameUniformBinding = 0;
+struct FrameUniforms {
+	float cameraRotation[3][4];
+	float cameraPosition[3];
+	float width;
+	float height;
+	float aspectRatio;
+	unsigned int frame;
+	unsigned int samples;
+	unsigned int instanceCount;
+	unsigned int planeCount;
+	unsigned int primitiveCount;
+	unsigned int primitiveRoot;
+	unsigned int lightCount;
+	float environmentChance;
+	unsigned int environmentWidth;
+	unsigned int environmentHeight;
+	float environmentRotation;
+	unsigned int minBounces;
+	unsigned int maxBounces;
+	unsigned int bounceStats;
+};
+
+// They all go through the upload ring, so writing them never has to wait for the last frame to finish with them //
+// (Which also means every view gets its own copy, without the next view's overwriting it) //
+bool Renderer::setPerFrameUniforms(const View& view) {
+	FrameUniforms uniforms = {};
+
+	// (The view's rotation matrix is stored a row at a time) //
+	for (int column = 0; column < 3; column++) {
+		for (int row = 0; row < 3; row++) uniforms.cameraRotation[column][row] = view.rotationMatrix[row * 3 + column];
+	}
+	Vec3 cameraPosition = view.cameraPosition.relativeTo(buffers.origin);
+	std::copy(&cameraPosition.x, &cameraPosition.x + 3, uniforms.cameraPosition);
+	uniforms.width = view.renderWidth;
+	uniforms.height = view.renderHeight;
+	uniforms.aspectRatio = viewAspectRatio(view);
+	uniforms.frame = frame;
+	uniforms.samples = (unsigned int)samples;
+	uniforms.instanceCount = instanceCount;
+	uniforms.planeCount = planeCount;
+	uniforms.primitiveCount = primitiveCount;
+	uniforms.primitiveRoot = primitiveRoot;
+	uniforms.lightCount = lightCount;
+	uniforms.environmentChance = environmentChance;
+	uniforms.environmentWidth = environmentWidth;
+	uniforms.environmentHeight = environmentHeight;
+	uniforms.environmentRotation = environmentRotation;
+	uniforms.minBounces = minBounces;
+	uniforms.maxBounces = maxBounces;
+	uniforms.bounceStats = bounceStats;
+
+	UploadSpace space;
+	if (!stageUpload(&uniforms, sizeof(uniforms), space)) return false;
+	glBindBufferRange(GL_UNIFORM_BUFFER, FrameUniformBinding, space.buffer, space.offset, sizeof(uniforms));
+	return true;
+}
+
+bool Renderer::setOutputUniforms(const View& view) {
+	bool successState = true;
+
+	float renderSize[2] = {view.renderWidth, view.renderHeight};
+	float viewOrigin[2] = {(float)view.x, (float)view.y};
+	float viewSize[2] = {(float)view.width, (float)view.height};
+	successState &= setUniform(outputProgram, "uRenderSize", renderSize, Uniform::VEC2);
+	successState &= setUniform(outputProgram, "uViewOrigin", viewOrigin, Uniform::VEC2);
+	successState &= setUniform(outputProgram, "uViewSize", viewSize, Uniform::VEC2);
+
+	return successState;
+}
+
+////////////
+// Camera //
+////////////
+
+bool Renderer::calculateCamera(View& view, double alpha) {
+	// Interpolate between the last two simulation steps so motion stays smooth at any framerate //
+	float rotation[3];
+	for (int i = 0; i < 3; i++) rotation[i] = view.prevRotation[i] + (view.rotation[i] - view.prevRotation[i]) * (float)alpha;
+
+	// For SOME reason GLSL uniform mat3s are stored in column-major order //
+	// Because of course, everyone just loves screwing with mathematicians //
+	float newCameraRotationMatrix[9] = {
+		cos( rotation[1] ), -sin( rotation[0] ) * sin( rotation[1] ), -cos( rotation[0] ) * sin( rotation[1] ),
+		0.0               ,  cos( rotation[0] )                     , -sin( rotation[0] )                     ,
+		sin( rotation[1] ),  sin( rotation[0] ) * cos( rotation[1] ),  cos( rotation[0] ) * cos( rotation[1] ),
+	};
+
+	// Any change to the view makes everything we've accumulated so far useless //
+	for (int i = 0; i < 9; i++) {
+		if (view.rotationMatrix[i] != newCameraRotationMatrix[i]) view.accumulationDirty = true;
+		view.rotationMatrix[i] = newCameraRotationMatrix[i];
+	}
+
+	return true;
+}
+
+RenderCamera Renderer::sceneCamera() const {
+	return {scene.cameraPosition, scene.cameraPitch, scene.cameraYaw};
+}
+
+///////////
+// Scene //
+///////////
+
+// Copies some data into a buffer from the pool & binds it to the given slot //
+// (Empty data still gets a tiny buffer, since there's no binding nothing to a storage block) //
+bool Renderer::uploadSceneBuffer(SceneBinding binding, const void* data, size_t size, std::string name) {
+	if (sceneStorage[binding] != 0) releaseBuffer(sceneStorage[binding]);
+
+	// Animated scenes rewrite bits of their buffers every frame, so let the driver know //
+	GLenum usage = scene.waves.empty() ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW;
+	sceneStorage[binding] = acquireBuffer(std::max(size, (size_t)16), usage, name);
+	if (sceneStorage[binding] == 0) { error("Could not create scene buffer '" + name + "'."); return false; }
+	uploadBuffer(sceneStorage[binding], 0, data, size);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, sceneStorage[binding]);
+
+	graphSetBuffer(sceneResources[binding], sceneStorage[binding]);
+	return true;
+}
+
+// Copies just the elements of a scene buffer that changed //
+// (Through the upload ring, since the last frame's probably still reading the buffer) //
+void Renderer::updateSceneBuffer(SceneBinding binding, const void* data, BufferRange range, size_t elementSize) {
+	if (range.empty()) return;
+	uploadBuffer(sceneStorage[binding], range.first * elementSize, (const char*)data + range.first * elementSize, (range.last - range.first) * elementSize);
+}
+
+// Scenes without an environment map still get a (black, 1x1) texture, so there's always something bound //
+bool Renderer::uploadEnvironment(const Image& image) {
+	if (environmentTexture != 0) releaseTexture(environmentTexture);
+
+	float black[3] = {0, 0, 0};
+	int width = image.width > 0 ? (int)image.width : 1, height = image.width > 0 ? (int)image.height : 1;
+	environmentTexture = acquireTexture({width, height, GL_RGB32F}, "Environment");
+	if (environmentTexture == 0) { error("Could not create the environment texture."); return false; }
+	glBindTexture(GL_TEXTURE_2D, environmentTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_FLOAT, image.width > 0 ? image.pixels.data() : black);
+
+	graphSetTexture(environmentResource, environmentTexture);
+	return true;
+}
+
+// Puts the top view far enough above the middle of the scene to see all of it (planes go on forever, so they don't //
+// count), looking straight down with +z up the screen. A scene with nothing else in it just gets looked down on //
+// from above the main camera //
+const float TopViewMargin = 1.1f;
+void Renderer::placeTopView() {
+	AABB bounds;
+	if (!buffers.instances.empty()) {
+		const BVHNode& root = buffers.instanceNodes[0];
+		bounds.grow(Vec3{root.min[0], root.min[1], root.min[2]});
+		bounds.grow(Vec3{root.max[0], root.max[1], root.max[2]});
+	}
+	for (const Primitive& primitive : scene.primitives) if (primitive.type != PLANE) bounds.grow(primitiveBounds(primitive, buffers.origin));
+
+	// (The bounds are relative to the buffers' origin, like everything else in them) //
+	View& top = views[TOP_VIEW];
+	if (!bounds.valid()) {
+		top.cameraPosition = scene.cameraPosition + DVec3(0, 10, 0);
+	} else {
+		// With a 90 degree field of view, the camera sees as far out to the side as it is above something //
+		Vec3 centre = bounds.centre();
+		float extent = std::max(bounds.max.x - bounds.min.x, bounds.max.z - bounds.min.z) * 0.5f;
+		top.cameraPosition = buffers.origin + DVec3(centre.x, bounds.max.y + extent * TopViewMargin, centre.z);
+	}
+	top.rotation[0] = top.prevRotation[0] = PI / 2;
+	top.rotation[1] = top.prevRotation[1] = 0;
+}
+
+// Everything the scene needs on the GPU, once it's been loaded & built //
+bool Renderer::uploadScene() {
+	makeCurrent();
+
+	// Start the main camera wherever the scene wants it, & the top one over the middle of it //
+	View& main = views[MAIN_VIEW];
+	main.cameraPosition = scene.cameraPosition;
+	main.rotation[0] = main.prevRotation[0] = scene.cameraPitch;
+	main.rotation[1] = main.prevRotation[1] = scene.cameraYaw;
+	placeTopView();
+
+	// Textures go first, since the GPU's copy of the materials is the only one that knows their bindless handles //
+	bool successState = true;
+	std::vector<Material> materials = scene.materials;
+	successState &= uploadMaterialTextures(scene, materials);
+	graphSetTexture(tilePoolResource, tilePoolTexture());
+	graphSetBuffer(pageTableResource, pageTableBuffer());
+	successState &= uploadSceneBuffer(VERTICES, buffers.vertices.data(), buffers.vertices.size() * sizeof(float), "Vertices");
+	successState &= uploadSceneBuffer(TRIANGLES, buffers.triangles.data(), buffers.triangles.size() * sizeof(unsigned int), "Triangles");
+	successState &= uploadSceneBuffer(MATERIALS, materials.data(), materials.size() * sizeof(Material), "Materials");
+	successState &= uploadSceneBuffer(WIDE_NODES, buffers.wideNodes.data(), buffers.wideNodes.size() * sizeof(WideBVHNode), "WideNodes");
+	successState &= uploadWorldBuffers();
+	successState &= uploadSceneBuffer(ENVIRONMENT_TABLE, buffers.environmentTable.data(), buffers.environmentTable.size() * sizeof(AliasEntry), "EnvironmentTable");
+	successState &= uploadEnvironment(scene.environment);
+	instanceCount = (unsigned int)buffers.instances.size();
+	planeCount = buffers.planeCount;
+	primitiveCount = (unsigned int)buffers.primitiveKinds.size();
+	primitiveRoot = buffers.primitiveRoot;
+	lightCount = (unsigned int)buffers.lights.size();
+	environmentChance = buffers.environmentChance;
+	environmentWidth = scene.environment.width;
+	environmentHeight = scene.environment.height;
+	environmentRotation = scene.environmentRotation;
+
+	dirtyAllViews();
+	return successState;
+}
+
+// The buffers with anything in world space in them, which all change whenever the origin moves //
+// (Nodes has the primitives' BVH on the end of it, so that goes too) //
+bool Renderer::uploadWorldBuffers() {
+	bool successState = true;
+	successState &= uploadSceneBuffer(NODES, buffers.nodes.data(), buffers.nodes.size() * sizeof(BVHNode), "Nodes");
+	successState &= uploadSceneBuffer(INSTANCE_NODES, buffers.instanceNodes.data(), buffers.instanceNodes.size() * sizeof(BVHNode), "InstanceNodes");
+	successState &= uploadSceneBuffer(INSTANCES, buffers.instances.data(), buffers.instances.size() * sizeof(GPUInstance), "Instances");
+	successState &= uploadSceneBuffer(PRIMITIVE_SHAPES, buffers.primitiveShapes.data(), buffers.primitiveShapes.size() * sizeof(float), "PrimitiveShapes");
+	successState &= uploadSceneBuffer(PRIMITIVE_EXTRAS, buffers.primitiveExtras.data(), buffers.primitiveExtras.size() * sizeof(float), "PrimitiveExtras");
+	successState &= uploadSceneBuffer(PRIMITIVE_KINDS, buffers.primitiveKinds.data(), buffers.primitiveKinds.size() * sizeof(unsigned int), "PrimitiveKinds");
+	successState &= uploadSceneBuffer(LIGHTS, buffers.lights.data(), buffers.lights.size() * sizeof(GPULight), "Lights");
+	successState &= uploadSceneBuffer(LIGHT_NODES, buffers.lightNodes.data(), buffers.lightNodes.size() * sizeof(LightTreeNode), "LightNodes");
+	return successState;
+}
+
+// Floats have about 7 digits to go round, so once the camera's this far from the origin, the scene gets moved back //
+// under it before anything it's looking at loses more than a fraction of a millimetre //
+const double RebaseDistance = 1024;
+
+bool Renderer::rebaseScene(const DVec3& origin) {
+	makeCurrent();
+	debug("FloatingOrigin", "Moving to " + std::to_string(origin.x) + ", " + std::to_string(origin.y) + ", " + std::to_string(origin.z));
+	rebaseSceneBuffers(scene, buffers, origin);
+	if (!uploadWorldBuffers()) return false;
+
+	// Everything just shifted by a little rounding, so whatever was accumulated doesn't quite line up any more //
+	dirtyAllViews();
+	return true;
+}
+
+// Loads the SPIR-V modules & specializes the vertex shader (which never changes) //
+// SPIR-V can't do bindless textures, so --spirv makes material textures go with the array (see addCreateJobs). They //
+// can still be bindless if another renderer set them up without it, since that's the same for every renderer //
+bool Renderer::loadTraceSPIRV() {
+	if (!spirvSupported()) { print("The driver can't take SPIR-V (that needs GL 4.6)."); return false; }
+	if (bindlessTextures()) { print("Material textures are bindless, which SPIR-V can't do."); return false; }
+
+	if (!loadSPIRV(SPIRVDirectory + "vert.spv", vertexModule) || !loadSPIRV(SPIRVDirectory + "frag.spv", traceModule)) return false;
+	spirvVertexShader = glCreateShader(GL_VERTEX_SHADER);
+	if (spirvVertexShader == 0) { error("Failed to create vertex shader."); return false; }
+	if (specializeShader(spirvVertexShader, vertexModule, {})) return true;
+	glDeleteShader(spirvVertexShader);
+	spirvVertexShader = 0;
+	return false;
+}
+
+// Switches to the variant of the trace program that suits the current scene, compiling it if it's new //
+// (The variant's uniforms all get set again, since they belong to the program) //
+// If SPIR-V was asked for but can't be had, it's back to GLSL for good //
+bool Renderer::specializeTraceProgram() {
+	makeCurrent();
+	ShaderDefines defines = traceDefines(scene, buffers, minBounces, maxBounces);
+
+	// The GLSL checks for bindless textures itself, so it needs telling when they went with the array anyway (like //
+	// they do for --spirv, which can still end up back here) //
+	if (!bindlessTextures()) defines.push_back({"ARRAY_TEXTURES", "true"});
+	if (useSPIRV && spirvVertexShader == 0 && !loadTraceSPIRV()) {
+		print("Compiling the trace program from GLSL instead.");
+		useSPIRV = false;
+	}
+
+	ShaderSource source;
+	if (!useSPIRV && !preprocessShader("../Shaders/frag.glsl", defines, source)) return false;
+	uint64_t key = useSPIRV ? programKey(vertexModule, traceModule, defines) : programKey(shaderSources[0], source);
+	traceProgram = findProgramVariant(key);
+
+	if (traceProgram == 0) {
+		traceProgram = glCreateProgram();
+		if (loadProgramBinary(traceProgram, key)) debug("TraceProgram", "Loaded from the program cache");
+		else {
+			unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+			if (fragmentShader == 0) { error("Failed to create fragment shader."); return false; }
+			bool successState = useSPIRV ? specializeShader(fragmentShader, traceModule, defines) : compileShader(fragmentShader, source);
+			glProgramParameteri(traceProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			successState = successState && linkProgram(traceProgram, fragmentShader, useSPIRV ? spirvVertexShader : vertexShader);
+
+			// (The shader only actually goes once the program does) //
+			glDeleteShader(fragmentShader);
+			if (!successState) { glDeleteProgram(traceProgram); traceProgram = 0; return false; }
+			saveProgramBinary(traceProgram, key);
+		}
+		addProgramVariant(key, traceProgram);
+	}
+
+	return setInitialUniforms();
+}
+
+// Loading a scene is four jobs: reading it in (along with every file it uses), then building its BVHs, then uploading //
+// it all & specializing the trace program for it, which both have to happen on the main thread //
+// Returns the last one, so more can wait on it //
+// (Anything else that has to happen before the upload can go in dependencies) //
+JobID Renderer::addSceneJobs(std::string path, std::vector<JobID> dependencies) {
+	print("Loading scene '" + path + "'...");
+	scene = Scene();
+
+	JobID load = addJob("Load scene", ANY_THREAD, {}, [this, path] {
+		if (!::loadScene(scene, path)) return false;
+		if (layoutOverride != -1) scene.layout = (NodeLayout)layoutOverride;
+		return true;
+	});
+
+	// Build the two levels of BVH & pack everything up for the GPU //
+	JobID build = addJob("Build acceleration structures", ANY_THREAD, {load}, [this] {
+		print("Building acceleration structures...");
+		buffers = buildSceneBuffers(scene, scene.cameraPosition);
+		debug("SceneNodes", std::to_string(buffers.nodes.size()) + " mesh nodes, " + std::to_string(buffers.wideNodes.size()) + " compressed nodes, " + std::to_string(buffers.instanceNodes.size()) + " instance nodes, " + std::to_string(buffers.lights.size()) + " lights, " + std::to_string(buffers.lightNodes.size()) + " light nodes");
+		return true;
+	});
+
+	dependencies.push_back(build);
+	JobID upload = addJob("Upload scene", MAIN_THREAD, dependencies, [this] { return uploadScene(); });
+	return addJob("Specialize trace program", MAIN_THREAD, {upload}, [this] { return specializeTraceProgram(); });
+}
+
+bool Renderer::loadScene(std::string path) {
+	addSceneJobs(path, {});
+	return waitForJobs();
+}
+
+bool Renderer::updateSceneAnimation(double time) {
+	if (scene.waves.empty()) return true;
+	makeCurrent();
+
+	SceneChanges changes = animateScene(scene, buffers, time);
+	updateSceneBuffer(VERTICES, buffers.vertices.data(), changes.vertices, 4 * sizeof(float));
+	updateSceneBuffer(TRIANGLES, buffers.triangles.data(), changes.triangles, 4 * sizeof(unsigned int));
+	updateSceneBuffer(NODES, buffers.nodes.data(), changes.nodes, sizeof(BVHNode));
+
+	// A rebuilt top level can come out a different size, so it gets new buffers outright //
+	bool successState = true;
+	if (changes.topLevelRebuilt) {
+		successState &= uploadSceneBuffer(INSTANCE_NODES, buffers.instanceNodes.data(), buffers.instanceNodes.size() * sizeof(BVHNode), "InstanceNodes");
+		successState &= uploadSceneBuffer(INSTANCES, buffers.instances.data(), buffers.instances.size() * sizeof(GPUInstance), "Instances");
+	} else {
+		updateSceneBuffer(INSTANCE_NODES, buffers.instanceNodes.data(), changes.instanceNodes, sizeof(BVHNode));
+	}
+	if (changes.rebuilds > 0) debug("Animation", std::to_string(changes.rebuilds) + " BVHs degraded too far & got rebuilt");
+
+	// Anything that was accumulated was of the scene as it used to be //
+	dirtyAllViews();
+	return successState;
+}
+
+///////////////////////
+// Bounce Statistics //
+///////////////////////
+
+// Reading the counts back stalls the GPU, so it only happens about once a second, & only while they're on //
+const double BounceStatsInterval = 1.0;
+
+// Bound just after the scene's buffers //
+const unsigned int BounceStatsBinding = SCENE_BINDING_COUNT;
+
+bool Renderer::createBounceStats() {
+	bounceStatsBuffer = acquireBuffer(MaxDepthLimit * sizeof(unsigned int), GL_DYNAMIC_READ, "BounceStats");
+	if (bounceStatsBuffer == 0) { error("Could not create the bounce statistics buffer."); return false; }
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bounceStatsBuffer);
+	unsigned int zeros[MaxDepthLimit] = {};
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BounceStatsBinding, bounceStatsBuffer);
+	return true;
+}
+
+void Renderer::toggleBounceStats() {
+	bounceStats = !bounceStats;
+	bounceStatsStart = glfwGetTime();
+	print(std::string("Bounce statistics ") + (bounceStats ? "on" : "off") + ".");
+}
+
+// Prints how many paths made it to each depth since the last report, then starts counting again //
+void Renderer::reportBounceStats() {
+	if (!bounceStats || glfwGetTime() - bounceStatsStart < BounceStatsInterval) return;
+	bounceStatsStart = glfwGetTime();
+	makeCurrent();
+
+	unsigned int counts[MaxDepthLimit] = {};
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bounceStatsBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+	if (counts[0] == 0) return;
+
+	// Each depth's share of the camera paths, plus the average number of segments per path //
+	std::string line;
+	double segments = 0;
+	for (unsigned int depth = 0; depth <= maxBounces; depth++) {
+		segments += counts[depth];
+		char share[32];
+		std::snprintf(share, sizeof(share), "%s%u: %.1f%%", depth > 0 ? ", " : "", depth, 100.0 * counts[depth] / counts[0]);
+		line += share;
+	}
+	debug("PathsAlive", line);
+	debug("PathLength", std::to_string(segments / counts[0]) + " segments per path, over " + std::to_string(counts[0]) + " paths");
+
+	unsigned int zeros[MaxDepthLimit] = {};
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+}
+
+///////////////////
+// Render Passes //
+///////////////////
+
+// Every view gets its own clear, trace & output passes, all sharing the one trace program & the scene's buffers //
+
+// Throws away everything the view accumulated so far (the camera moved, the resolution changed, etc.) //
+bool Renderer::clearPass(View& view) {
+	if (!view.accumulationDirty) return true;
+
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	view.accumulatedSamples = 0;
+	view.accumulationDirty = false;
+
+	return true;
+}
+
+// Traces this frame's samples on top of the ones the view already has //
+bool Renderer::tracePass(View& view) {
+	// No point once the image has converged though //
+	if (view.accumulatedSamples >= MaxAccumulatedSamples) return true;
+
+	glViewport(0, 0, (int)view.renderWidth, (int)view.renderHeight);
+	glUseProgram(traceProgram);
+
+	// Pass all updated parameters to the GPU //
+	if (!setPerFrameUniforms(view)) return false;
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, graphTexture(environmentResource));
+	glActiveTexture(GL_TEXTURE0);
+	bindMaterialTextures();
+
+	// Draw our beautifully decorated rectangle //
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	glDisable(GL_BLEND);
+
+	view.accumulatedSamples += (unsigned int)samples;
+	return true;
+}
+
+// Upscales the view's accumulated samples to its part of the window //
+bool Renderer::outputPass(const View& view) {
+	glViewport(view.x, view.y, view.width, view.height);
+	glUseProgram(outputProgram);
+	if (!setOutputUniforms(view)) return false;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, graphTexture(view.accumulationResource));
+
+	// Clear the view's part of the screen & draw //
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(view.x, view.y, view.width, view.height);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+
+	return true;
+}
+
+// Lays out every pass in a frame and what it touches, so the render graph can work out the rest //
+// (New passes go in here, in the order their effects should happen) //
+// Hidden windows never get looked at, so they don't get output passes (the trace passes still write to the //
+// accumulation textures, which are imported, so they never get culled) //
+bool Renderer::createRenderGraph() {
+	print("Building render graph...");
+	makeCurrent();
+
+	windowResource = graphImportWindow("Window");
+	environmentResource = graphImportTexture("Environment", environmentTexture);
+	bounceStatsResource = graphImportBuffer("BounceStats", bounceStatsBuffer);
+	tilePoolResource = graphImportTexture("TilePool", tilePoolTexture());
+	pageTableResource = graphImportBuffer("PageTable", pageTableBuffer());
+	feedbackResource = graphImportBuffer("TextureFeedback", feedbackBuffer());
+
+	const char* sceneNames[SCENE_BINDING_COUNT] = {"Vertices", "Triangles", "Nodes", "InstanceNodes", "Instances", "Materials", "WideNodes", "PrimitiveShapes", "PrimitiveExtras", "PrimitiveKinds", "Lights", "LightNodes", "EnvironmentTable"};
+	for (int i = 0; i < SCENE_BINDING_COUNT; i++) sceneResources[i] = graphImportBuffer(sceneNames[i], sceneStorage[i]);
+
+	// Views that are turned off don't get any passes (or a render target) at all //
+	for (View& view : views) {
+		if (!view.enabled) { view.accumulationResource = -1; continue; }
+		std::string suffix = " (" + view.name + ")";
+		view.accumulationResource = graphImportTexture(view.name + "Accumulation", view.accumulationTexture);
+
+		int clear = graphAddPass("Clear" + suffix, [this, &view]() { return clearPass(view); });
+		graphWrite(clear, view.accumulationResource, Access::ATTACHMENT);
+
+		// Blending reads the accumulation as well as writing it //
+		int trace = graphAddPass("Trace" + suffix, [this, &view]() { return tracePass(view); });
+		graphRead(trace, view.accumulationResource, Access::ATTACHMENT);
+		graphWrite(trace, view.accumulationResource, Access::ATTACHMENT);
+		for (int i = 0; i < SCENE_BINDING_COUNT; i++) graphRead(trace, sceneResources[i], Access::STORAGE);
+		graphRead(trace, environmentResource, Access::SAMPLED);
+		graphWrite(trace, bounceStatsResource, Access::STORAGE);
+		graphRead(trace, tilePoolResource, Access::SAMPLED);
+		graphRead(trace, pageTableResource, Access::STORAGE);
+		graphWrite(trace, feedbackResource, Access::STORAGE);
+
+		// (Material textures aren't in here, since only the CPU ever writes them, so they never need a barrier) //
+
+		if (!visible) continue;
+		int output = graphAddPass("Output" + suffix, [this, &view]() { return outputPass(view); }, true);
+		graphRead(output, view.accumulationResource, Access::SAMPLED);
+		graphWrite(output, windowResource, Access::ATTACHMENT);
+	}
+
+	return compileRenderGraph();
+}
+
+bool Renderer::setTopView(bool enabled) {
+	makeCurrent();
+	views[TOP_VIEW].enabled = enabled;
+	views[TOP_VIEW].accumulationDirty = true;
+	layoutViews();
+	if (!ensureRenderTargetCapacity()) return false;
+	clearRenderGraph();
+	return createRenderGraph();
+}
+
+////////////
+// Frames //
+////////////
+
+bool Renderer::prepareFrame(double alpha) {
+	makeCurrent();
+
+	// Calculate each view's camera rotation matrix //
+	for (View& view : views) {
+		if (view.enabled && !calculateCamera(view, alpha)) { error("Could not calculate rotation matrix for the " + view.name + " camera."); return false; }
+	}
+
+	// Keep the origin near the main camera, so whatever it's looking at is always in small numbers //
+	const View& main = views[MAIN_VIEW];
+	if (length(main.cameraPosition - buffers.origin) > RebaseDistance && !rebaseScene(main.cameraPosition)) { error("Could not move the scene's origin."); return false; }
+
+	// Swap in any streamed texture tiles that have loaded, since they'd make everything so far out of date //
+	if (updateStreamedTextures(frame) > 0) dirtyAllViews();
+	graphSetBuffer(feedbackResource, feedbackBuffer());
+	return true;
+}
+
+// Runs every pass in the frame (clearing, tracing & output, for every view) //
+// (The feedback fence goes after every view's trace, since they all write to the same feedback buffer) //
+bool Renderer::renderFrame() {
+	makeCurrent();
+	if (!executeRenderGraph()) return false;
+	fenceTextureFeedback();
+	fenceUploads();
+	return true;
+}
+
+// render never traces more than this many samples a frame, so no one draw runs long enough for the driver to give up on it //
+const unsigned int RenderChunkSamples = 16;
+
+bool Renderer::render(const RenderCamera& camera, int renderWidth, int renderHeight, unsigned int renderSamples, float* pixels) {
+	if (views[TOP_VIEW].enabled && !setTopView(false)) return false;
+	if (!resize(renderWidth, renderHeight)) return false;
+	setRenderScale(1);
+
+	View& view = views[MAIN_VIEW];
+	view.cameraPosition = camera.position;
+	view.rotation[0] = view.prevRotation[0] = camera.pitch;
+	view.rotation[1] = view.prevRotation[1] = camera.yaw;
+
+	// Streamed texture tiles that turn up partway through start it all over again, so it's never a mix of mips //
+	unsigned int accumulated = 0;
+	while (accumulated < renderSamples) {
+		frame++;
+		if (!prepareFrame(1)) return false;
+		if (view.accumulationDirty) accumulated = 0;
+		samples = (float)std::min(RenderChunkSamples, renderSamples - accumulated);
+		if (!renderFrame()) { error("Could not render frame."); return false; }
+		accumulated += (unsigned int)samples;
+	}
+
+	// Read the accumulation back & average out its samples //
+	std::vector<float> accumulation((size_t)renderWidth * renderHeight * 4);
+	unsigned int framebuffer;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, view.accumulationTexture, 0);
+	glReadPixels(0, 0, renderWidth, renderHeight, GL_RGBA, GL_FLOAT, accumulation.data());
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+
+	for (size_t pixel = 0; pixel < (size_t)renderWidth * renderHeight; pixel++) {
+		float count = std::max(accumulation[pixel * 4 + 3], 1.0f);
+		for (int channel = 0; channel < 3; channel++) pixels[pixel * 3 + channel] = accumulation[pixel * 4 + channel] / count;
+	}
+	return true;
+}
+
+/////////////
+// Startup //
+/////////////
+
+// Everything from here on is jobs, so the scene can load & build on other threads while the main one sets up GL //
+// (Every GL job runs on the main thread, in whatever order they become ready) //
+JobID Renderer::addCreateJobs(std::string scenePath) {
+	// Create a vertex buffer and populate it with a rectangle that covers the whole screen //
+	addJob("Create vertex buffer", MAIN_THREAD, {}, [this] {
+		makeCurrent();
+		if (!createVertexBuffer()) { error("Could not create and populate vertex buffer."); return false; }
+		return true;
+	});
+
+	// Create a shader program and shader objects //
+	JobID shaders = addJob("Create shaders", MAIN_THREAD, {}, [this] {
+		makeCurrent();
+		if (!createShaders()) { error("Could not create shaders."); return false; }
+		return true;
+	});
+
+	// Compile the shaders! (Each one gets preprocessed on another thread first) //
+	// The trace shader's left until the scene's loaded, since it gets specialized for it //
+	std::string shaderPaths[2] = {"../Shaders/vert.glsl", "../Shaders/output.glsl"};
+	unsigned int* shaderObjects[2] = {&vertexShader, &outputShader};
+	JobID compiled[2];
+	for (int i = 0; i < 2; i++) {
+		JobID preprocessed = addJob("Preprocess " + shaderPaths[i], ANY_THREAD, {}, [path = shaderPaths[i], &source = shaderSources[i]] { return preprocessShader(path, {}, source); });
+		compiled[i] = addJob("Compile " + shaderPaths[i], MAIN_THREAD, {shaders, preprocessed}, [this, shader = shaderObjects[i], &source = shaderSources[i]] {
+			makeCurrent();
+			return compileShader(*shader, source);
+		});
+	}
+
+	// Finally, link and use the output program //
+	JobID linked = addJob("Link output program", MAIN_THREAD, {compiled[0], compiled[1]}, [this] {
+		makeCurrent();
+		return linkProgram(outputProgram, outputShader, vertexShader);
+	});
+
+	// Work out whether material textures can be bindless (SPIR-V can't do it, so it always gets the array) //
+	JobID textures = addJob("Material textures", MAIN_THREAD, {}, [this] {
+		makeCurrent();
+		return initMaterialTextures(!useSPIRV);
+	});
+
+	// Make somewhere for the shader to count bounces //
+	JobID bounceStats = addJob("Bounce stats", MAIN_THREAD, {}, [this] {
+		makeCurrent();
+		return createBounceStats();
+	});
+
+	// Work out how each frame gets rendered //
+	JobID graph = addJob("Render graph", MAIN_THREAD, {textures, bounceStats}, [this] {
+		if (!createRenderGraph()) { error("Could not build render graph."); return false; }
+		return true;
+	});
+
+	// Create the textures each view accumulates samples into //
+	JobID targets = addJob("Render targets", MAIN_THREAD, {graph}, [this] {
+		makeCurrent();
+		layoutViews();
+		if (!ensureRenderTargetCapacity()) { error("Could not allocate render targets."); return false; }
+		return true;
+	});
+
+	// Load the scene (either the one we were given, or the default one), which sets the uniforms once it's done //
+	return addSceneJobs(scenePath, {graph, targets, linked});
+}
+
+bool Renderer::create(std::string scenePath) {
+	addCreateJobs(scenePath);
+	return waitForJobs();
+}
\ No newline at end of file
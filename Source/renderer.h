@@ -0,0 +1,266 @@
+#pragma once
+
+#include "scene.h"
+#include "shaders.h"
+#include "parallel.h"
+
+#include <string>
+#include <vector>
+
+struct GLFWwindow;
+struct RenderGraph;
+struct SceneTextures;
+
+///////////
+// Views //
+///////////
+
+// Every view has its own camera, which gets traced into its own accumulation texture & then drawn into its own part //
+// of the window. Everything else (the scene's buffers, the trace program, material textures, etc.) is shared by all //
+// of them, since they're all drawn with the one context //
+// (Shared contexts could share buffers & textures between windows, but not vertex arrays, framebuffers or bindings, //
+// so every window would need all of those set up again, when a viewport costs nothing) //
+struct View {
+	std::string name;
+	bool enabled;
+
+	// Which part of the window it covers, as fractions of the window from the bottom left (x, y, width, height) //
+	float area[4];
+
+	// The camera: where it is in the world, & its pitch, yaw & roll in radians (rotation's kept from the previous //
+	// simulation step too, so rendering can blend between the two). The shader only gets told where it is relative to //
+	// the scene buffers' origin //
+	DVec3 cameraPosition;
+	float rotation[3] = {0, 0, 0};
+	float prevRotation[3] = {0, 0, 0};
+	float rotationMatrix[9] = {};
+
+	// Its part of the window in pixels, & the size of the render this frame, which can be smaller (the aspect ratio //
+	// always goes by the window though, so the picture doesn't stretch when the render shrinks) //
+	int x = 0, y = 0, width = 1, height = 1;
+	float renderWidth = 1, renderHeight = 1;
+
+	// Samples accumulate in here (see Render Targets) //
+	unsigned int accumulationTexture = 0;
+	int accumulationResource = -1;
+	int targetWidth = 0, targetHeight = 0;
+	unsigned int accumulatedSamples = 0;
+	bool accumulationDirty = true;
+};
+
+// The main view fills the window, & it's the one nel's arrow keys steer //
+// The top view looks straight down on the whole scene from a corner of the window, to see what's going on from above //
+enum ViewIndex {
+	MAIN_VIEW,
+	TOP_VIEW,
+	VIEW_COUNT
+};
+
+float viewAspectRatio(const View& view);
+
+// Once a pixel has this many samples there's not much point in tracing more //
+const unsigned int MaxAccumulatedSamples = 65536;
+
+// The deepest the shader can count bounces to (see Bounce Statistics) //
+const unsigned int MaxDepthLimit = 32;
+
+// The scene lives in a handful of storage buffers, bound to the same slots the shader expects //
+enum SceneBinding {
+	VERTICES,
+	TRIANGLES,
+	NODES,
+	INSTANCE_NODES,
+	INSTANCES,
+	MATERIALS,
+	WIDE_NODES,
+	PRIMITIVE_SHAPES,
+	PRIMITIVE_EXTRAS,
+	PRIMITIVE_KINDS,
+	LIGHTS,
+	LIGHT_NODES,
+	ENVIRONMENT_TABLE,
+	SCENE_BINDING_COUNT
+};
+
+//////////////
+// Renderer //
+//////////////
+
+// Everything it takes to path trace a scene on the GPU: a window & its GL context, the scene & its buffers, the //
+// programs, the views & their render targets, & a render graph to draw them with. nel itself is one renderer with a //
+// visible window & a loop around it (see Source/main.cpp), but anything can make as many as it likes, to render into //
+// its own buffers (see render) //
+// Every renderer's context shares objects with the first one's, so the resource pool, the upload ring & the trace //
+// program's variants all work for any of them, & a scene two of them load only ever compiles one program //
+// (GLFW only lets the main thread make windows, & GL work only ever happens on one thread at a time, so renderers //
+// all have to be driven from the main thread. Scene loading still spreads over every core, see Source/parallel.h) //
+
+// Where the camera is & which way it looks, like a scene's camera (pitch & yaw are in radians) //
+struct RenderCamera {
+	DVec3 position;
+	float pitch = 0, yaw = 0;
+};
+
+class Renderer {
+public:
+	Renderer() = default;
+	~Renderer();
+	Renderer(const Renderer&) = delete;
+	Renderer& operator=(const Renderer&) = delete;
+
+	// Settings, which go in before create (or loadScene, for the ones the trace program gets specialized with) //
+	// --spirv makes the trace program from precompiled SPIR-V instead (see Source/shaders.h) //
+	// layoutOverride forces every scene into one node layout, whatever the scene file says (-1 leaves it up to the scene) //
+	// Paths always make it to minBounces bounces, then Russian roulette decides, up to a hard limit of maxBounces //
+	bool useSPIRV = false;
+	int layoutOverride = -1;
+	unsigned int minBounces = 3;
+	unsigned int maxBounces = 8;
+
+	// The frame counter seeds the shader's random numbers, & samples is how many every pixel gets per frame //
+	unsigned int frame = 0;
+	float samples = 1;
+
+	Scene scene;
+	SceneBuffers buffers;
+
+	View views[VIEW_COUNT] = {
+		{"Main", true, {0, 0, 1, 1}},
+		{"Top", false, {0.65f, 0.02f, 0.33f, 0.33f}}
+	};
+
+	GLFWwindow* window = nullptr;
+	int width = 1, height = 1;
+
+	// Makes the window & its context, & loads GL. Visible windows get drawn to (which is how nel shows its views), //
+	// hidden ones are only there for their context //
+	bool createContext(bool visible);
+
+	// Makes this renderer's context current, with its render graph & scene textures bound //
+	// (Everything else here does this itself, so it only matters for GL calls of your own) //
+	void makeCurrent();
+
+	// Gives back the window, its context & everything the renderer made (the destructor does this too, but GLFW has //
+	// to still be around for it, so anything that calls glfwTerminate should destroy its renderers first) //
+	void destroy();
+
+	// Starting up is jobs, so scenes can load & build on other threads while the main one sets up GL //
+	// addCreateJobs adds them all & returns the last one, create runs them too //
+	JobID addCreateJobs(std::string scenePath);
+	bool create(std::string scenePath);
+
+	// Loading a scene is jobs too, & the GPU's copy only gets replaced once the new one's completely built //
+	JobID addSceneJobs(std::string path, std::vector<JobID> dependencies);
+	bool loadScene(std::string path);
+
+	// Moves anything animated to where it is at the given time, & uploads only the bits of the buffers that changed //
+	bool updateSceneAnimation(double time);
+
+	// Moves the scene's floating origin (see SceneBuffers), & uploads everything that moved with it //
+	// prepareFrame does this whenever the main camera gets too far from it, so it's rarely worth calling yourself //
+	bool rebaseScene(const DVec3& origin);
+
+	// Compiles every shader again, from the files as they are now //
+	bool recompileShaders();
+
+	// Fits the views to a new window size (or render size, for hidden windows), making their render targets bigger if //
+	// they need to be //
+	bool resize(int newWidth, int newHeight);
+
+	// Turns the top view on or off, which changes which passes there are, so the graph gets built again //
+	bool setTopView(bool enabled);
+
+	// Sizes every view's render as a fraction of its part of the window, marking any whose size changed dirty //
+	void setRenderScale(float scale);
+
+	// Throws away everything every view has accumulated (the scene changed, the shaders changed, etc.) //
+	void dirtyAllViews();
+
+	// How many pixels get traced next frame, over every view that still needs samples //
+	double tracedPixels() const;
+
+	// A frame is two steps, so it can be timed around just the GPU work: working out the cameras (between the last two //
+	// simulation steps, see View) & swapping in streamed texture tiles, then running every pass //
+	bool prepareFrame(double alpha);
+	bool renderFrame();
+
+	// Renders samples samples per pixel from the camera, & writes width * height RGB triples into pixels (bottom row //
+	// first, averaged over every sample, like Source/tracer.h's traceImage). The main view's used for it, resized to //
+	// match, so it's best not mixed with drawing frames to a visible window //
+	bool render(const RenderCamera& camera, int renderWidth, int renderHeight, unsigned int renderSamples, float* pixels);
+
+	// Where the scene wants the camera to start //
+	RenderCamera sceneCamera() const;
+
+	// The shader counts how many paths reach each depth, so it's easy to see what each extra bounce costs //
+	void toggleBounceStats();
+	void reportBounceStats();
+
+private:
+	bool visible = false;
+	RenderGraph* graph = nullptr;
+	SceneTextures* textures = nullptr;
+
+	// Shaders & programs. The trace program is whichever variant of it suits the current scene (see //
+	// specializeTraceProgram), so it doesn't exist until there's a scene //
+	// A program can't mix SPIR-V & GLSL, so SPIR-V needs a vertex shader of its own, which only exists once it's been loaded //
+	unsigned int traceProgram = 0, vertexShader = 0;
+	unsigned int outputProgram = 0, outputShader = 0;
+	// The sources & modules are kept around, since the trace program's variants are keyed by them (see programKey) //
+	SPIRVModule traceModule, vertexModule;
+	unsigned int spirvVertexShader = 0;
+	ShaderSource shaderSources[2];
+
+	unsigned int vertexBuffer = 0, vertexArray = 0;
+
+	// Render graph handles for everything the passes read & write (each view has its own accumulation too) //
+	int windowResource = -1;
+	unsigned int sceneStorage[SCENE_BINDING_COUNT] = {};
+	int sceneResources[SCENE_BINDING_COUNT] = {};
+	unsigned int environmentTexture = 0;
+	int environmentResource = -1;
+	int tilePoolResource = -1, pageTableResource = -1, feedbackResource = -1;
+	unsigned int bounceStatsBuffer = 0;
+	int bounceStatsResource = -1;
+	double bounceStatsStart = 0;
+
+	// The scene's numbers, for the per-frame uniforms //
+	unsigned int instanceCount = 0;
+	unsigned int planeCount = 0;
+	unsigned int primitiveCount = 0;
+	unsigned int primitiveRoot = 0;
+	unsigned int lightCount = 0;
+	float environmentChance = 1;
+	unsigned int environmentWidth = 0;
+	unsigned int environmentHeight = 0;
+	float environmentRotation = 0;
+	unsigned int bounceStats = 0;
+
+	bool createShaders();
+	bool createVertexBuffer();
+	bool createBounceStats();
+	bool createRenderGraph();
+	void layoutViews();
+	bool ensureRenderTargetCapacity();
+	void placeTopView();
+
+	bool uniformMissing(unsigned int program, int location) const;
+	int uniformLocation(unsigned int program, const char* name) const;
+	bool setUniform(unsigned int program, const char* name, float* data, unsigned int type);
+	bool setInitialUniforms();
+	bool setPerFrameUniforms(const View& view);
+	bool setOutputUniforms(const View& view);
+	bool calculateCamera(View& view, double alpha);
+
+	bool uploadSceneBuffer(SceneBinding binding, const void* data, size_t size, std::string name);
+	void updateSceneBuffer(SceneBinding binding, const void* data, BufferRange range, size_t elementSize);
+	bool uploadEnvironment(const Image& image);
+	bool uploadScene();
+	bool uploadWorldBuffers();
+	bool loadTraceSPIRV();
+	bool specializeTraceProgram();
+
+	bool clearPass(View& view);
+	bool tracePass(View& view);
+	bool outputPass(const View& view);
+};
\ No newline at end of file
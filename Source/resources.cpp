@@ -0,0 +1,401 @@
+#include "resources.h"
+#include "print.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+///////////////////
+// GPU Resources //
+///////////////////
+
+struct PooledResource {
+	unsigned int id;
+	bool isTexture;
+	TextureDescription description;
+	GLenum usage;
+	size_t bytes;
+	std::string name;
+	bool inUse;
+	unsigned int lastUsedFrame;
+};
+
+// Pooled resources that haven't been used for this many frames get freed for real //
+const unsigned int PoolRetainFrames = 120;
+
+// A pooled render target can be at most this many times bigger than what was asked for //
+// (Otherwise a tiny target could end up pinning a huge texture) //
+const size_t MaxPoolWaste = 2;
+
+static std::vector<PooledResource> Pool;
+static unsigned int CurrentFrame = 0;
+static size_t PeakMemoryUsage = 0;
+static size_t AliasedBytesSaved = 0;
+
+static std::string describeBytes(size_t bytes) {
+	if (bytes >= 1024 * 1024) return std::to_string(bytes / (1024 * 1024)) + "MiB";
+	if (bytes >= 1024) return std::to_string(bytes / 1024) + "KiB";
+	return std::to_string(bytes) + "B";
+}
+
+// Bytes per texel for every format nel uses //
+static size_t formatBytes(GLenum format) {
+	switch (format) {
+		case GL_R8: return 1;
+		case GL_RG8: case GL_R16F: return 2;
+		case GL_RGBA8: case GL_SRGB8_ALPHA8: case GL_RG16F: case GL_R32F: case GL_R32UI: case GL_DEPTH24_STENCIL8: return 4;
+		case GL_RGBA16F: case GL_RG32F: return 8;
+		case GL_RGB32F: return 12;
+		case GL_RGBA32F: case GL_RGBA32UI: return 16;
+		default:
+			error("Don't know how big texture format " + std::to_string(format) + " is.");
+			return 0;
+	}
+}
+
+// Block compressed formats store every 4x4 block (even the ones hanging off the edge) in a fixed number of bytes //
+static size_t formatBlockBytes(GLenum format) {
+	switch (format) {
+		case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: return 8;
+		case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return 16;
+		default: return 0;
+	}
+}
+
+size_t textureBytes(const TextureDescription& description) {
+	size_t total = 0;
+	int levelWidth = description.width, levelHeight = description.height;
+	size_t blockBytes = formatBlockBytes(description.format);
+	for (int level = 0; level < description.levels; level++) {
+		if (blockBytes > 0) total += (size_t)((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockBytes;
+		else total += (size_t)levelWidth * levelHeight * formatBytes(description.format);
+		levelWidth = std::max(1, levelWidth / 2);
+		levelHeight = std::max(1, levelHeight / 2);
+	}
+	return total * std::max(1, description.layers);
+}
+
+size_t resourceMemoryUsage() {
+	size_t total = 0;
+	for (const PooledResource& resource : Pool) total += resource.bytes;
+	return total;
+}
+
+static void trackPeak() {
+	PeakMemoryUsage = std::max(PeakMemoryUsage, resourceMemoryUsage());
+}
+
+static PooledResource* findResource(unsigned int id, bool isTexture) {
+	for (PooledResource& resource : Pool) if (resource.id == id && resource.isTexture == isTexture) return &resource;
+	return nullptr;
+}
+
+//////////////
+// Textures //
+//////////////
+
+static bool textureFits(const PooledResource& resource, const TextureDescription& description) {
+	const TextureDescription& pooled = resource.description;
+	if (pooled.format != description.format || pooled.levels != description.levels || pooled.layers != description.layers) return false;
+	if (description.exactSize) return pooled.exactSize && pooled.width == description.width && pooled.height == description.height;
+	if (pooled.exactSize || pooled.width < description.width || pooled.height < description.height) return false;
+	return resource.bytes <= textureBytes(description) * MaxPoolWaste;
+}
+
+unsigned int acquireTexture(TextureDescription description, std::string name) {
+	// Reuse the smallest free texture that fits, if there is one //
+	PooledResource* best = nullptr;
+	for (PooledResource& resource : Pool) {
+		if (resource.inUse || !resource.isTexture || !textureFits(resource, description)) continue;
+		if (!best || resource.bytes < best->bytes) best = &resource;
+	}
+	if (best) {
+		best->inUse = true;
+		best->name = name;
+		best->lastUsedFrame = CurrentFrame;
+		return best->id;
+	}
+
+	// Nothing fits, so make a new one //
+	unsigned int texture;
+	glGenTextures(1, &texture);
+	if (texture == 0) { error("Could not create texture '" + name + "'."); return 0; }
+	GLenum target = description.layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+	glBindTexture(target, texture);
+	if (description.layers > 0) glTexStorage3D(target, description.levels, description.format, description.width, description.height, description.layers);
+	else glTexStorage2D(target, description.levels, description.format, description.width, description.height);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, description.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, description.levels > 1 ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	Pool.push_back({texture, true, description, 0, textureBytes(description), name, true, CurrentFrame});
+	trackPeak();
+	std::string size = std::to_string(description.width) + "x" + std::to_string(description.height) + (description.layers > 0 ? "x" + std::to_string(description.layers) : "");
+	debug("acquireTexture", name + " (" + size + ", " + describeBytes(textureBytes(description)) + ")");
+	return texture;
+}
+
+void releaseTexture(unsigned int texture) {
+	PooledResource* resource = findResource(texture, true);
+	if (!resource) { error("Tried to release texture " + std::to_string(texture) + ", which isn't from the pool."); return; }
+	resource->inUse = false;
+	resource->lastUsedFrame = CurrentFrame;
+}
+
+/////////////
+// Buffers //
+/////////////
+
+unsigned int acquireBuffer(size_t size, GLenum usage, std::string name) {
+	// Reuse the smallest free buffer that's big enough (but not ridiculously so) //
+	PooledResource* best = nullptr;
+	for (PooledResource& resource : Pool) {
+		if (resource.inUse || resource.isTexture || resource.usage != usage) continue;
+		if (resource.bytes < size || resource.bytes > size * MaxPoolWaste) continue;
+		if (!best || resource.bytes < best->bytes) best = &resource;
+	}
+	if (best) {
+		best->inUse = true;
+		best->name = name;
+		best->lastUsedFrame = CurrentFrame;
+		return best->id;
+	}
+
+	// Nothing fits, so make a new one //
+	// (Bound to the copy target so we don't mess with whatever's bound as a vertex buffer etc.) //
+	unsigned int buffer;
+	glGenBuffers(1, &buffer);
+	if (buffer == 0) { error("Could not create buffer '" + name + "'."); return 0; }
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, usage);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	Pool.push_back({buffer, false, {0, 0, 0}, usage, size, name, true, CurrentFrame});
+	trackPeak();
+	debug("acquireBuffer", name + " (" + describeBytes(size) + ")");
+	return buffer;
+}
+
+void releaseBuffer(unsigned int buffer) {
+	PooledResource* resource = findResource(buffer, false);
+	if (!resource) { error("Tried to release buffer " + std::to_string(buffer) + ", which isn't from the pool."); return; }
+	resource->inUse = false;
+	resource->lastUsedFrame = CurrentFrame;
+}
+
+size_t bufferCapacity(unsigned int buffer) {
+	PooledResource* resource = findResource(buffer, false);
+	return resource ? resource->bytes : 0;
+}
+
+/////////////////
+// Upload Ring //
+/////////////////
+
+// Once a fence has gone by, the bytes staged before it are free again //
+struct UploadFence {
+	GLsync fence;
+	size_t bytes;
+};
+
+static unsigned int RingBuffer = 0;
+static char* RingData = nullptr;
+static size_t RingAlignment = 16;
+static size_t RingHead = 0, RingUsed = 0, RingUnfenced = 0;
+static std::deque<UploadFence> RingFences;
+
+static bool createUploadRing() {
+	int uniformAlignment = 16;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	RingAlignment = std::max<size_t>(16, uniformAlignment);
+
+	glGenBuffers(1, &RingBuffer);
+	if (RingBuffer == 0) { error("Could not create the upload ring."); return false; }
+	glBindBuffer(GL_COPY_WRITE_BUFFER, RingBuffer);
+	if (GLAD_GL_VERSION_4_4) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, UploadRingSize, nullptr, flags);
+		RingData = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, UploadRingSize, flags);
+		if (!RingData) { error("Could not map the upload ring."); return false; }
+	} else {
+		glBufferData(GL_COPY_WRITE_BUFFER, UploadRingSize, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	Pool.push_back({RingBuffer, false, {0, 0, 0}, 0, UploadRingSize, "UploadRing", true, CurrentFrame});
+	trackPeak();
+	debug("UploadRing", describeBytes(UploadRingSize) + (RingData ? ", persistently mapped" : ", written with glBufferSubData (no GL 4.4)"));
+	return true;
+}
+
+// Frees up whatever the GPU's finished with, waiting for the oldest frame until there's enough room //
+// (If everything's from this frame, it gets fenced & waited on right away, since it's all been submitted) //
+static void makeRingRoom(size_t bytes) {
+	while (!RingFences.empty() || RingUsed + bytes > UploadRingSize) {
+		if (RingFences.empty()) fenceUploads();
+		bool full = RingUsed + bytes > UploadRingSize;
+		GLenum status = glClientWaitSync(RingFences.front().fence, full ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, full ? GL_TIMEOUT_IGNORED : 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			if (!full) return;
+			error("Gave up waiting for the GPU to finish with the upload ring.");
+		}
+		glDeleteSync(RingFences.front().fence);
+		RingUsed -= RingFences.front().bytes;
+		RingFences.pop_front();
+	}
+}
+
+bool stageUpload(const void* data, size_t size, UploadSpace& space) {
+	if (size > MaxRingUpload) { error("Tried to stage " + describeBytes(size) + " through the upload ring, which only takes " + describeBytes(MaxRingUpload) + " at a time."); return false; }
+	if (RingBuffer == 0 && !createUploadRing()) return false;
+
+	// Whatever doesn't fit before the end gets put back at the start, & the bit it skipped counts as used too //
+	size_t start = (RingHead + RingAlignment - 1) / RingAlignment * RingAlignment;
+	if (start + size > UploadRingSize) start = 0;
+	size_t bytes = (start >= RingHead ? start - RingHead : UploadRingSize - RingHead + start) + size;
+	makeRingRoom(bytes);
+
+	if (RingData) std::memcpy(RingData + start, data, size);
+	else {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, RingBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, start, size, data);
+	}
+	RingHead = start + size;
+	RingUsed += bytes;
+	RingUnfenced += bytes;
+
+	space.buffer = RingBuffer;
+	space.offset = start;
+	return true;
+}
+
+void uploadBuffer(unsigned int buffer, size_t offset, const void* data, size_t size) {
+	if (size == 0) return;
+	UploadSpace space;
+	if (size <= MaxRingUpload && stageUpload(data, size, space)) {
+		glBindBuffer(GL_COPY_READ_BUFFER, space.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, space.offset, offset, size);
+	} else {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void fenceUploads() {
+	if (RingUnfenced == 0) return;
+	RingFences.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), RingUnfenced});
+	RingUnfenced = 0;
+}
+
+static void releaseUploadRing() {
+	for (UploadFence& fence : RingFences) glDeleteSync(fence.fence);
+	RingFences.clear();
+	RingBuffer = 0;
+	RingData = nullptr;
+	RingHead = RingUsed = RingUnfenced = 0;
+}
+
+////////////////
+// Transients //
+////////////////
+
+// Hands out textures to a frame's transient targets, sharing one texture between //
+// any targets whose lifetimes don't overlap (as long as the format & size work out) //
+bool allocateTransientTextures(std::vector<TransientTexture>& transients) {
+	// Go through them in the order they start being used //
+	std::vector<TransientTexture*> order;
+	for (TransientTexture& transient : transients) order.push_back(&transient);
+	std::sort(order.begin(), order.end(), [](TransientTexture* a, TransientTexture* b) { return a->firstUse < b->firstUse; });
+
+	// Every texture we've handed out this frame, and the last pass that's still using it //
+	AliasedBytesSaved = 0;
+	struct Slot { unsigned int texture; TextureDescription description; int busyUntil; };
+	std::vector<Slot> slots;
+
+	for (TransientTexture* transient : order) {
+		// Look for a texture whose previous owner is done with it by the time this one starts //
+		Slot* reuse = nullptr;
+		for (Slot& slot : slots) {
+			if (slot.busyUntil >= transient->firstUse) continue;
+			const TextureDescription& have = slot.description, & want = transient->description;
+			if (have.format != want.format || have.levels != want.levels) continue;
+			if (want.exactSize ? (have.width != want.width || have.height != want.height) : (have.width < want.width || have.height < want.height)) continue;
+			reuse = &slot;
+			break;
+		}
+
+		if (reuse) {
+			transient->texture = reuse->texture;
+			reuse->busyUntil = transient->lastUse;
+			AliasedBytesSaved += textureBytes(transient->description);
+			continue;
+		}
+
+		transient->texture = acquireTexture(transient->description, "Transient");
+		if (transient->texture == 0) return false;
+		slots.push_back({transient->texture, transient->description, transient->lastUse});
+	}
+
+	return true;
+}
+
+void releaseTransientTextures(std::vector<TransientTexture>& transients) {
+	// Aliased transients share textures, so make sure each one only goes back once //
+	std::vector<unsigned int> released;
+	for (TransientTexture& transient : transients) {
+		if (transient.texture == 0) continue;
+		if (std::find(released.begin(), released.end(), transient.texture) == released.end()) {
+			releaseTexture(transient.texture);
+			released.push_back(transient.texture);
+		}
+		transient.texture = 0;
+	}
+}
+
+/////////////////
+// Bookkeeping //
+/////////////////
+
+static void freeResource(PooledResource& resource) {
+	if (resource.isTexture) glDeleteTextures(1, &resource.id);
+	else glDeleteBuffers(1, &resource.id);
+}
+
+// Frees anything that's been sitting unused in the pool for too long //
+void trimResourcePool(unsigned int frame) {
+	CurrentFrame = frame;
+	for (size_t i = 0; i < Pool.size();) {
+		if (!Pool[i].inUse && CurrentFrame - Pool[i].lastUsedFrame > PoolRetainFrames) {
+			debug("trimResourcePool", "Freeing " + Pool[i].name + " (" + describeBytes(Pool[i].bytes) + ")");
+			freeResource(Pool[i]);
+			Pool.erase(Pool.begin() + i);
+		} else {
+			i++;
+		}
+	}
+}
+
+// Frees everything, in use or not (only for shutting down) //
+void freeResourcePool() {
+	releaseUploadRing();
+	for (PooledResource& resource : Pool) freeResource(resource);
+	Pool.clear();
+}
+
+size_t aliasedBytesSaved() {
+	return AliasedBytesSaved;
+}
+
+void reportResourceUsage() {
+	size_t used = 0, pooled = 0;
+	for (const PooledResource& resource : Pool) {
+		(resource.inUse ? used : pooled) += resource.bytes;
+		debug(resource.isTexture ? "Texture" : "Buffer", resource.name + ": " + describeBytes(resource.bytes) + (resource.inUse ? "" : " (pooled)"));
+	}
+	debug("GPUMemory", describeBytes(used) + " in use, " + describeBytes(pooled) + " pooled, " + describeBytes(PeakMemoryUsage) + " peak");
+	debug("GPUMemoryAliased", describeBytes(AliasedBytesSaved) + " saved by aliasing transients last frame");
+}
\ No newline at end of file
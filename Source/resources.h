@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../Dependencies/glad/include/glad/glad.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+///////////////////
+// GPU Resources //
+///////////////////
+
+// Every texture & buffer nel makes goes through here, so we always know how much VRAM we're sitting on //
+// Released resources hang around in a pool for a bit, in case something the same shape gets asked for again //
+
+// glad was generated without any extensions, so anything nel uses from one gets defined here //
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+
+struct TextureDescription {
+	int width, height;
+	GLenum format;
+	int levels = 1;
+
+	// Anything above 0 makes it a 2D array texture with this many layers //
+	int layers = 0;
+
+	// Render targets only ever use a corner of their texture, so they're happy with a bigger one //
+	// Anything that gets sampled with normalized coordinates needs the exact size though //
+	bool exactSize = true;
+};
+
+// A texture that's only needed for part of a frame //
+// firstUse & lastUse are the (inclusive) indices of the passes that touch it //
+// Any two transients whose lifetimes don't overlap can end up sharing the same texture //
+struct TransientTexture {
+	TextureDescription description;
+	int firstUse, lastUse;
+	unsigned int texture = 0;
+};
+
+// Textures //
+unsigned int acquireTexture(TextureDescription description, std::string name);
+void releaseTexture(unsigned int texture);
+size_t textureBytes(const TextureDescription& description);
+
+// Buffers //
+unsigned int acquireBuffer(size_t size, GLenum usage, std::string name);
+void releaseBuffer(unsigned int buffer);
+size_t bufferCapacity(unsigned int buffer);
+
+// Upload Ring //
+// Per-frame data gets written straight into one big buffer that stays mapped for good (persistently & coherently, //
+// so nothing ever needs flushing), & then gets copied or bound from there on the GPU's side. Space gets handed out //
+// round & round the ring, & each frame's share of it is fenced once the frame's been submitted, so the CPU only ever //
+// waits if it's a whole ring ahead of the GPU. glBufferSubData into something the GPU's still reading can quietly //
+// stall until it's done, where this never touches anything that's in flight //
+// (Without GL 4.4's glBufferStorage the ring's an ordinary buffer & space gets written with glBufferSubData, which //
+// still never touches anything in flight) //
+struct UploadSpace {
+	unsigned int buffer = 0;
+	size_t offset = 0;
+};
+
+// Copies data into the ring, aligned enough to bind as a uniform buffer (which is as picky as anything gets) //
+// Anything over MaxRingUpload can't go through it, since that would mean waiting for most of the ring //
+const size_t UploadRingSize = 8 * 1024 * 1024;
+const size_t MaxRingUpload = UploadRingSize / 4;
+bool stageUpload(const void* data, size_t size, UploadSpace& space);
+
+// Writes part of a buffer through the ring & copies it over on the GPU (or straight in, if it's too big for the ring) //
+void uploadBuffer(unsigned int buffer, size_t offset, const void* data, size_t size);
+
+// Fences off everything staged since last time, once the frame that uses it has been submitted //
+void fenceUploads();
+
+// Transients //
+bool allocateTransientTextures(std::vector<TransientTexture>& transients);
+void releaseTransientTextures(std::vector<TransientTexture>& transients);
+
+// Bookkeeping //
+void trimResourcePool(unsigned int frame);
+void freeResourcePool();
+size_t resourceMemoryUsage();
+
+// How much memory aliasing saved in the last allocateTransientTextures //
+size_t aliasedBytesSaved();
+void reportResourceUsage();
\ No newline at end of file
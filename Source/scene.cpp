@@ -0,0 +1,931 @@
+#include "scene.h"
+#include "print.h"
+#include "parallel.h"
+
+#include <charconv>
+#include <cstring>
+#include <functional>
+#include <fstream>
+#include <sstream>
+
+#define PI 3.1415926535897932384626433832795028841971693993
+
+////////////
+// Meshes //
+////////////
+
+// A unit cube centred on the origin //
+// Each face gets its own 4 corners, so each one can have the whole texture on it //
+static void makeCube(Mesh& mesh) {
+	for (int axis = 0; axis < 3; axis++) {
+		for (int side = -1; side <= 1; side += 2) {
+			unsigned int first = (unsigned int)mesh.vertices.size();
+			for (int corner = 0; corner < 4; corner++) {
+				float u = (float)(corner & 1), v = (float)(corner >> 1);
+				Vec3 position;
+				position[axis] = 0.5f * side;
+				position[(axis + 1) % 3] = u - 0.5f;
+				position[(axis + 2) % 3] = v - 0.5f;
+				mesh.vertices.push_back(position);
+				mesh.uvs.insert(mesh.uvs.end(), {u, v});
+			}
+
+			// Wound so the normal points out of the cube //
+			if (side > 0) mesh.indices.insert(mesh.indices.end(), {first, first + 1, first + 3,  first, first + 3, first + 2});
+			else mesh.indices.insert(mesh.indices.end(), {first, first + 3, first + 1,  first, first + 2, first + 3});
+		}
+	}
+}
+
+// A unit square in the XZ plane, facing up, cut into a grid of smaller squares //
+static void makePlane(Mesh& mesh, unsigned int subdivisions) {
+	for (unsigned int z = 0; z <= subdivisions; z++) {
+		for (unsigned int x = 0; x <= subdivisions; x++) {
+			mesh.vertices.push_back({(float)x / subdivisions - 0.5f, 0, (float)z / subdivisions - 0.5f});
+			mesh.uvs.insert(mesh.uvs.end(), {(float)x / subdivisions, (float)z / subdivisions});
+		}
+	}
+	for (unsigned int z = 0; z < subdivisions; z++) {
+		for (unsigned int x = 0; x < subdivisions; x++) {
+			unsigned int a = z * (subdivisions + 1) + x, b = a + subdivisions + 1;
+			mesh.indices.insert(mesh.indices.end(), {a, b, a + 1,  a + 1, b, b + 1});
+		}
+	}
+}
+
+// A sphere with a radius of 0.5, so it fits in the same box as the cube //
+static void makeSphere(Mesh& mesh) {
+	const int Rings = 16, Segments = 32;
+	for (int ring = 0; ring <= Rings; ring++) {
+		float theta = PI * ring / Rings;
+		for (int segment = 0; segment <= Segments; segment++) {
+			float phi = 2 * PI * segment / Segments;
+			mesh.vertices.push_back({0.5f * std::sin(theta) * std::cos(phi), 0.5f * std::cos(theta), 0.5f * std::sin(theta) * std::sin(phi)});
+			mesh.uvs.insert(mesh.uvs.end(), {(float)segment / Segments, (float)ring / Rings});
+		}
+	}
+	for (int ring = 0; ring < Rings; ring++) {
+		for (int segment = 0; segment < Segments; segment++) {
+			unsigned int a = ring * (Segments + 1) + segment, b = a + Segments + 1;
+			mesh.indices.insert(mesh.indices.end(), {a, a + 1, b,  a + 1, b + 1, b});
+		}
+	}
+}
+
+// Reads one of a face corner's indices, from start up to the next slash (or the end) //
+static bool readIndex(const std::string& corner, size_t start, int& index) {
+	const char* end = corner.data() + corner.size();
+	auto [next, result] = std::from_chars(corner.data() + start, end, index);
+	return result == std::errc() && (next == end || *next == '/');
+}
+
+bool loadOBJ(Mesh& mesh, std::string path) {
+	std::ifstream fileStream(path);
+	if (!fileStream.is_open()) { error("Could not open mesh '" + path + "'."); return false; }
+
+	// We only care about positions, UVs & faces, everything else gets skipped //
+	// The shader only has one index per corner though, so every different position & UV pair becomes its own vertex //
+	std::vector<Vec3> positions;
+	std::vector<float> uvs;
+	std::unordered_map<uint64_t, unsigned int> vertices;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(fileStream, line)) {
+		lineNumber++;
+		std::string where = path + ":" + std::to_string(lineNumber) + ": ";
+		std::istringstream tokens(line);
+		std::string type;
+		tokens >> type;
+
+		if (type == "v") {
+			Vec3 position;
+			tokens >> position.x >> position.y >> position.z;
+			positions.push_back(position);
+		} else if (type == "vt") {
+			// OBJ's v goes up the image, but nel's goes down it (images are stored top row first) //
+			float u = 0, v = 0;
+			tokens >> u >> v;
+			uvs.insert(uvs.end(), {u, 1 - v});
+		} else if (type == "f") {
+			// Faces can be any polygon, so fan them out into triangles //
+			// (Corners look like "1", "1/2", "1//3" or "1/2/3", and can count back from the end if negative) //
+			std::vector<unsigned int> face;
+			std::string corner;
+			while (tokens >> corner) {
+				size_t slash = corner.find('/');
+				int index = 0, uvIndex = 0;
+				bool hasUV = slash != std::string::npos && slash + 1 < corner.size() && corner[slash + 1] != '/';
+				if (!readIndex(corner, 0, index) || (hasUV && !readIndex(corner, slash + 1, uvIndex))) { error(where + "Can't make sense of the face corner '" + corner + "'."); return false; }
+				long position = index < 0 ? (long)positions.size() + index : index - 1;
+				long uv = uvIndex < 0 ? (long)uvs.size() / 2 + uvIndex : uvIndex - 1;
+				if (position < 0 || position >= (long)positions.size() || uv >= (long)uvs.size() / 2 || (uvIndex != 0 && uv < 0)) { error(where + "This face points at a vertex that doesn't exist."); return false; }
+
+				// Corners without a UV get a UV of 0 //
+				uint64_t key = (uint64_t)position << 32 | (uint32_t)(uv + 1);
+				auto [found, added] = vertices.try_emplace(key, (unsigned int)mesh.vertices.size());
+				if (added) {
+					mesh.vertices.push_back(positions[position]);
+					mesh.uvs.insert(mesh.uvs.end(), {uv >= 0 ? uvs[uv * 2] : 0.0f, uv >= 0 ? uvs[uv * 2 + 1] : 0.0f});
+				}
+				face.push_back(found->second);
+			}
+			for (size_t i = 2; i < face.size(); i++) mesh.indices.insert(mesh.indices.end(), {face[0], face[i - 1], face[i]});
+		}
+	}
+
+	if (uvs.empty()) mesh.uvs.clear();
+	return true;
+}
+
+///////////////////
+// Scene Loading //
+///////////////////
+
+static Vec3 readVec3(std::istringstream& tokens) {
+	Vec3 v;
+	tokens >> v.x >> v.y >> v.z;
+	return v;
+}
+
+// Positions get read as doubles, so a scene can be a long way from the origin without losing anything //
+static DVec3 readDVec3(std::istringstream& tokens) {
+	DVec3 v;
+	tokens >> v.x >> v.y >> v.z;
+	return v;
+}
+
+static Vec3 radians(Vec3 degrees) {
+	return degrees * (float)(PI / 180);
+}
+
+// A cheap hash so big grids of instances don't all face the same way //
+static float hashAngle(unsigned int x) {
+	x ^= x >> 16; x *= 0x7feb352du;
+	x ^= x >> 15; x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return (float)(x / 4294967296.0 * 2 * PI);
+}
+
+static bool findMaterial(Scene& scene, std::string name, unsigned int& material, std::string where) {
+	if (!scene.materialNames.count(name)) { error(where + "No material called '" + name + "'."); return false; }
+	material = scene.materialNames[name];
+	return true;
+}
+
+static bool addInstance(Scene& scene, std::string meshName, std::string materialName, DAffine transform, std::string where) {
+	if (!scene.meshNames.count(meshName)) { error(where + "No mesh called '" + meshName + "'."); return false; }
+	if (!scene.materialNames.count(materialName)) { error(where + "No material called '" + materialName + "'."); return false; }
+	scene.instances.push_back({transform, scene.meshNames[meshName], scene.materialNames[materialName]});
+	return true;
+}
+
+// Anything the scene needs out of another file only gets loaded once the whole scene's been read, so it can all load at once //
+struct PendingLoad {
+	std::string failure;
+	std::function<bool()> load;
+};
+
+// Scene files are plain text, one thing per line (see Scenes/default.nel for what's allowed) //
+bool loadScene(Scene& scene, std::string path) {
+	std::ifstream fileStream(path);
+	if (!fileStream.is_open()) { error("Could not open scene '" + path + "'."); return false; }
+
+	// Mesh, texture & environment paths are relative to the scene file //
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+	std::vector<PendingLoad> loads;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(fileStream, line)) {
+		lineNumber++;
+		std::string where = path + ":" + std::to_string(lineNumber) + ": ";
+		line = line.substr(0, line.find('#'));
+		std::istringstream tokens(line);
+		std::string command;
+		if (!(tokens >> command)) continue;
+
+		if (command == "material") {
+			// material <name> <r> <g> <b> [emission <r> <g> <b>] [texture <name> [<tiling>]] //
+			std::string name, keyword;
+			Vec3 albedo, emission;
+			tokens >> name;
+			albedo = readVec3(tokens);
+			Material material = {};
+			while (tokens >> keyword) {
+				if (keyword == "emission") emission = readVec3(tokens);
+				else if (keyword == "texture") {
+					std::string textureName;
+					tokens >> textureName;
+					if (!scene.textureNames.count(textureName)) { error(where + "No texture called '" + textureName + "'."); return false; }
+					material.texture = scene.textureNames[textureName];
+					// The tiling's optional, so if what's next isn't a number, it gets left for the next keyword //
+					// (A failed read still writes 0, hence reading it somewhere else first. At the end of the line there's //
+					// nowhere to go back to, & nothing to leave) //
+					std::streampos next = tokens.tellg();
+					float tiling;
+					if (tokens >> tiling) material.tiling = tiling;
+					else {
+						tokens.clear();
+						if (next != std::streampos(-1)) tokens.seekg(next);
+					}
+				}
+				else { error(where + "Materials don't have a '" + keyword + "'."); return false; }
+			}
+			std::copy(&albedo.x, &albedo.x + 3, material.albedo);
+			std::copy(&emission.x, &emission.x + 3, material.emission);
+			scene.materialNames[name] = (unsigned int)scene.materials.size();
+			scene.materials.push_back(material);
+		} else if (command == "texture") {
+			// texture <name> <path/to/file.ppm | .hdr | .exr> [streamed] //
+			// Textures don't actually get loaded until the whole file's been read, so they can all load at once //
+			Texture texture;
+			std::string keyword;
+			tokens >> texture.name >> texture.path;
+			if (tokens >> keyword) {
+				if (keyword != "streamed") { error(where + "Textures don't have a '" + keyword + "'."); return false; }
+				texture.streamed = true;
+			}
+			scene.textureNames[texture.name] = (unsigned int)scene.textures.size();
+			scene.textures.push_back(texture);
+		} else if (command == "mesh") {
+			// mesh <name> <cube | plane [<subdivisions>] | sphere | path/to/file.obj> //
+			std::string name, source;
+			tokens >> name >> source;
+			Mesh mesh;
+			mesh.name = name;
+			if (source == "cube") makeCube(mesh);
+			else if (source == "plane") {
+				unsigned int subdivisions = 1;
+				if (!(tokens >> subdivisions)) tokens.clear();
+				makePlane(mesh, std::max(1u, subdivisions));
+			}
+			else if (source == "sphere") makeSphere(mesh);
+			else {
+				// (Nothing else in the file cares what's in a mesh, only that it exists) //
+				unsigned int index = (unsigned int)scene.meshes.size();
+				loads.push_back({where + "Could not load mesh '" + name + "'.", [&scene, index, file = directory + source] {
+					Mesh& mesh = scene.meshes[index];
+					if (!loadOBJ(mesh, file)) return false;
+					for (const Vec3& vertex : mesh.vertices) mesh.bounds.grow(vertex);
+					return true;
+				}});
+			}
+			for (const Vec3& vertex : mesh.vertices) mesh.bounds.grow(vertex);
+			scene.meshNames[name] = (unsigned int)scene.meshes.size();
+			scene.meshes.push_back(mesh);
+		} else if (command == "instance") {
+			// instance <mesh> <material> <x> <y> <z> [<pitch> <yaw> <roll> [<scale>]] //
+			std::string meshName, materialName;
+			tokens >> meshName >> materialName;
+			DVec3 position = readDVec3(tokens);
+			Vec3 rotation;
+			float scale = 1;
+			if (tokens >> rotation.x >> rotation.y >> rotation.z) tokens >> scale;
+			DAffine transform = DAffine::translate(position, Affine::rotation(radians(rotation)) * Affine::scale({scale, scale, scale}));
+			if (!addInstance(scene, meshName, materialName, transform, where)) return false;
+		} else if (command == "grid") {
+			// grid <mesh> <material> <nx> <ny> <nz> <spacing> <x> <y> <z> [<scale>] //
+			// Lays out a whole block of instances at once (handy for stress testing) //
+			std::string meshName, materialName;
+			unsigned int counts[3];
+			float spacing, scale = 1;
+			tokens >> meshName >> materialName >> counts[0] >> counts[1] >> counts[2] >> spacing;
+			DVec3 centre = readDVec3(tokens);
+			tokens >> scale;
+			DVec3 corner = centre - DVec3((double)counts[0] - 1, (double)counts[1] - 1, (double)counts[2] - 1) * (spacing / 2.0);
+			for (unsigned int x = 0; x < counts[0]; x++) for (unsigned int y = 0; y < counts[1]; y++) for (unsigned int z = 0; z < counts[2]; z++) {
+				DVec3 position = corner + DVec3(x, y, z) * spacing;
+				float yaw = hashAngle((unsigned int)scene.instances.size());
+				DAffine transform = DAffine::translate(position, Affine::rotation({0, yaw, 0}) * Affine::scale({scale, scale, scale}));
+				if (!addInstance(scene, meshName, materialName, transform, where)) return false;
+			}
+		} else if (command == "wave") {
+			// wave <mesh> <amplitude> <wavelength> <speed> //
+			// Distances are in the mesh's own space, & speed is in wavelengths per second //
+			std::string meshName;
+			Wave wave;
+			tokens >> meshName >> wave.amplitude >> wave.wavelength >> wave.speed;
+			if (!scene.meshNames.count(meshName)) { error(where + "No mesh called '" + meshName + "'."); return false; }
+			wave.mesh = scene.meshNames[meshName];
+			for (const Wave& other : scene.waves) {
+				if (other.mesh == wave.mesh) { error(where + "Mesh '" + meshName + "' already has a wave."); return false; }
+			}
+			if (wave.wavelength <= 0) { error(where + "Waves need a wavelength above zero."); return false; }
+			scene.waves.push_back(wave);
+		} else if (command == "layout") {
+			// layout <full | compressed> //
+			std::string layout;
+			tokens >> layout;
+			if (layout == "full") scene.layout = FULL_NODES;
+			else if (layout == "compressed") scene.layout = COMPRESSED_NODES;
+			else { error(where + "Don't know of a node layout called '" + layout + "'."); return false; }
+		} else if (command == "sphere" || command == "box" || command == "plane" || command == "disk") {
+			// sphere <material> <x> <y> <z> <radius> //
+			// box <material> <min x> <min y> <min z> <max x> <max y> <max z> //
+			// plane <material> <normal x> <normal y> <normal z> <offset> //
+			// disk <material> <x> <y> <z> <normal x> <normal y> <normal z> <radius> //
+			std::string materialName;
+			tokens >> materialName;
+			Primitive primitive = {};
+			if (!findMaterial(scene, materialName, primitive.material, where)) return false;
+
+			DVec3 first = readDVec3(tokens), second;
+			double scalar = 0;
+			if (command == "sphere") {
+				primitive.type = SPHERE;
+				tokens >> scalar;
+			} else if (command == "box") {
+				primitive.type = BOX;
+				second = readDVec3(tokens);
+				for (int axis = 0; axis < 3; axis++) if (first[axis] > second[axis]) std::swap(first[axis], second[axis]);
+			} else if (command == "plane") {
+				// (Normals are directions, so they're never big enough to need doubles) //
+				primitive.type = PLANE;
+				tokens >> scalar;
+				first = DVec3(normalize(first.relativeTo({})));
+			} else {
+				primitive.type = DISK;
+				second = DVec3(normalize(readVec3(tokens)));
+				tokens >> scalar;
+			}
+			for (int axis = 0; axis < 3; axis++) {
+				primitive.shape[axis] = first[axis];
+				primitive.extra[axis] = second[axis];
+			}
+			primitive.shape[3] = scalar;
+			scene.primitives.push_back(primitive);
+		} else if (command == "environment") {
+			// environment <path/to/file.hdr | path/to/file.exr> [<intensity> [<rotation>]] //
+			// Brightness gets baked straight into the image, since it never changes //
+			std::string source;
+			float intensity = 1, rotation = 0;
+			tokens >> source >> intensity >> rotation;
+			loads.push_back({where + "Could not load environment '" + source + "'.", [&scene, intensity, file = directory + source] {
+				if (!loadImage(scene.environment, file)) return false;
+				for (float& value : scene.environment.pixels) value *= intensity;
+				return true;
+			}});
+			scene.environmentRotation = rotation * (float)(PI / 180);
+		} else if (command == "camera") {
+			// camera <x> <y> <z> <pitch> <yaw> //
+			scene.cameraPosition = readDVec3(tokens);
+			tokens >> scene.cameraPitch >> scene.cameraYaw;
+			scene.cameraPitch *= (float)(PI / 180);
+			scene.cameraYaw *= (float)(PI / 180);
+		} else {
+			error(where + "Don't know what '" + command + "' means.");
+			return false;
+		}
+
+		if (tokens.fail() && !tokens.eof()) { error(where + "Couldn't make sense of this line."); return false; }
+	}
+
+	// Decoding images & building their mips is easily the slowest part of loading, so every texture (along with //
+	// every mesh & the environment) gets loaded at once. (With only one of them, the mips get split across threads instead) //
+	// Streamed textures only need their tile cache, which is just a quick check unless it has to be built //
+	// & compressed ones just get read in, since nelcompress already did all the work //
+	for (Texture& texture : scene.textures) {
+		loads.push_back({path + ": Could not load texture '" + texture.name + "'.", [&texture, file = directory + texture.path] {
+			if (texture.streamed) return openTileCache(texture.cache, file);
+			if (findCompressedTexture(texture.compressed, file)) return true;
+			Image image;
+			if (!loadImage(image, file)) return false;
+			texture.levels = {encodeLevel(image)};
+			buildMips(texture.levels);
+			return true;
+		}});
+	}
+	std::vector<char> loaded(loads.size(), false);
+	parallelFor(loads.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) loaded[i] = loads[i].load();
+	});
+	for (size_t i = 0; i < loads.size(); i++) {
+		if (!loaded[i]) { error(loads[i].failure); return false; }
+	}
+
+	debug("Scene", std::to_string(scene.meshes.size()) + " meshes, " + std::to_string(scene.instances.size()) + " instances, " + std::to_string(scene.primitives.size()) + " primitives, " + std::to_string(scene.materials.size()) + " materials, " + std::to_string(scene.textures.size()) + " textures");
+	return true;
+}
+
+////////////////////
+// GPU Conversion //
+////////////////////
+
+// Anything refitting makes this much worse than when it was built gets rebuilt instead //
+const float RebuildThreshold = 1.3f;
+
+static Vec3 vertexPosition(const SceneBuffers& buffers, unsigned int vertex) {
+	return {buffers.vertices[vertex * 4], buffers.vertices[vertex * 4 + 1], buffers.vertices[vertex * 4 + 2]};
+}
+
+// Builds a mesh's BVH around wherever its vertices are right now. corners has 3 (global) vertex indices per triangle //
+static BVH buildMeshBVH(const SceneBuffers& buffers, const MeshRange& range, const std::vector<unsigned int>& corners) {
+	std::vector<AABB> triangleBounds(range.triangleCount);
+	for (size_t i = 0; i < triangleBounds.size(); i++) {
+		for (int corner = 0; corner < 3; corner++) triangleBounds[i].grow(vertexPosition(buffers, corners[i * 3 + corner]));
+	}
+	// (Compressed meshes can't have any bigger leaves, & there's no reason for the rest to be different) //
+	return buildBVH(triangleBounds, CompressedLeafSize);
+}
+
+// Writes a mesh's triangles (in BVH order) & nodes into the mesh's spot in the buffers //
+static void buildMeshRange(SceneBuffers& buffers, MeshRange& range, const std::vector<unsigned int>& corners, const BVH& bvh) {
+	range.bounds = nodeBounds(bvh.nodes[0]);
+
+	// Compressed meshes store their triangles in the order the wide nodes want them instead //
+	if (range.compressed) {
+		WideBVH wide = compressBVH(bvh);
+		for (size_t i = 0; i < wide.order.size(); i++) {
+			unsigned int* triangle = &buffers.triangles[(range.firstTriangle + i) * 4];
+			for (int corner = 0; corner < 3; corner++) triangle[corner] = corners[bvh.order[wide.order[i]] * 3 + corner];
+			triangle[3] = 0;
+		}
+		range.nodeCount = (unsigned int)wide.nodes.size();
+		for (WideBVHNode node : wide.nodes) {
+			node.firstChild += range.firstNode;
+			node.firstPrimitive += range.firstTriangle;
+			buffers.wideNodes.push_back(node);
+		}
+		return;
+	}
+
+	// Store the triangles in BVH order //
+	for (size_t i = 0; i < bvh.order.size(); i++) {
+		unsigned int* triangle = &buffers.triangles[(range.firstTriangle + i) * 4];
+		for (int corner = 0; corner < 3; corner++) triangle[corner] = corners[bvh.order[i] * 3 + corner];
+		triangle[3] = 0;
+	}
+
+	// Shift the nodes' indices so they still point at the right things once everything's in one buffer //
+	range.nodeCount = std::max(range.nodeCount, (unsigned int)bvh.nodes.size());
+	if (buffers.nodes.size() < range.firstNode + range.nodeCount) buffers.nodes.resize(range.firstNode + range.nodeCount, {});
+	for (size_t i = 0; i < bvh.nodes.size(); i++) {
+		BVHNode node = bvh.nodes[i];
+		node.leftOrFirst += node.count > 0 ? range.firstTriangle : range.firstNode;
+		buffers.nodes[range.firstNode + i] = node;
+	}
+
+	if (!range.animated) return;
+	range.refit = prepareRefit(&buffers.nodes[range.firstNode], (unsigned int)bvh.nodes.size(), range.firstNode);
+
+	// Work out which leaves each vertex feeds into, so moving a few vertices only refits a few leaves //
+	std::vector<std::pair<unsigned int, unsigned int>> uses;
+	for (unsigned int leaf = 0; leaf < bvh.nodes.size(); leaf++) {
+		const BVHNode& node = bvh.nodes[leaf];
+		for (unsigned int i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+			for (int corner = 0; corner < 3; corner++) uses.push_back({corners[bvh.order[i] * 3 + corner] - range.firstVertex, leaf});
+		}
+	}
+	std::sort(uses.begin(), uses.end());
+	uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+	range.vertexLeafStart.assign(range.vertexCount + 1, 0);
+	range.vertexLeaves.clear();
+	for (const auto& [vertex, leaf] : uses) {
+		range.vertexLeafStart[vertex + 1]++;
+		range.vertexLeaves.push_back(leaf);
+	}
+	for (unsigned int i = 0; i < range.vertexCount; i++) range.vertexLeafStart[i + 1] += range.vertexLeafStart[i];
+}
+
+// Builds the top level over the instances' world space bounds //
+// (Instances of empty meshes can't ever be hit, so they're left out) //
+static void buildTopLevel(const Scene& scene, SceneBuffers& buffers) {
+	std::vector<unsigned int> kept;
+	std::vector<AABB> instanceBounds;
+	for (unsigned int i = 0; i < scene.instances.size(); i++) {
+		const Instance& instance = scene.instances[i];
+		const MeshRange& range = buffers.meshes[instance.mesh];
+		if (range.triangleCount == 0) continue;
+		kept.push_back(i);
+		instanceBounds.push_back(instance.transform.relativeTo(buffers.origin).transformBounds(range.bounds));
+	}
+	BVH topLevel = buildBVH(instanceBounds, 2);
+	buffers.instanceNodes = topLevel.nodes;
+	buffers.instanceRefit = prepareRefit(buffers.instanceNodes.data(), (unsigned int)buffers.instanceNodes.size(), 0);
+
+	buffers.instances.clear();
+	buffers.instanceOrder.clear();
+	for (unsigned int index : topLevel.order) {
+		const Instance& instance = scene.instances[kept[index]];
+		GPUInstance packed = {};
+		Affine worldToObject = instance.transform.relativeTo(buffers.origin).inverse();
+		for (int row = 0; row < 3; row++) for (int column = 0; column < 4; column++) packed.worldToObject[row][column] = worldToObject.m[row][column];
+		packed.rootNode = buffers.meshes[instance.mesh].firstNode;
+		packed.material = instance.material;
+		packed.compressed = buffers.meshes[instance.mesh].compressed;
+		packed.lightBase = buffers.instanceLightBases.empty() ? 0 : buffers.instanceLightBases[kept[index]];
+		buffers.instances.push_back(packed);
+		buffers.instanceOrder.push_back(kept[index]);
+	}
+
+	// Remember which leaves each mesh shows up in, so a mesh changing shape only refits those //
+	buffers.meshInstanceLeaves.assign(scene.meshes.size(), {});
+	for (unsigned int leaf = 0; leaf < buffers.instanceNodes.size(); leaf++) {
+		const BVHNode& node = buffers.instanceNodes[leaf];
+		for (unsigned int i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+			std::vector<unsigned int>& leaves = buffers.meshInstanceLeaves[scene.instances[buffers.instanceOrder[i]].mesh];
+			if (leaves.empty() || leaves.back() != leaf) leaves.push_back(leaf);
+		}
+	}
+}
+
+// Packs a primitive's numbers the way the shader reads them, relative to origin //
+// (Positions move with the origin, & so does a plane's offset along its normal. Normals & sizes stay put) //
+static void packPrimitive(const Primitive& primitive, const DVec3& origin, float* shape, float* extra) {
+	DVec3 first = {primitive.shape[0], primitive.shape[1], primitive.shape[2]};
+	DVec3 second = {primitive.extra[0], primitive.extra[1], primitive.extra[2]};
+	Vec3 packedFirst = primitive.type == PLANE ? first.relativeTo({}) : first.relativeTo(origin);
+	Vec3 packedSecond = primitive.type == BOX ? second.relativeTo(origin) : second.relativeTo({});
+	for (int axis = 0; axis < 3; axis++) {
+		shape[axis] = packedFirst[axis];
+		extra[axis] = packedSecond[axis];
+	}
+	shape[3] = (float)(primitive.type == PLANE ? primitive.shape[3] - dot(first, origin) : primitive.shape[3]);
+	extra[3] = (float)primitive.extra[3];
+}
+
+// The box around a primitive that's already been packed //
+static AABB packedBounds(PrimitiveType type, const float* shape, const float* extra) {
+	Vec3 first = {shape[0], shape[1], shape[2]};
+	Vec3 second = {extra[0], extra[1], extra[2]};
+	float radius = shape[3];
+	AABB bounds;
+	switch (type) {
+		case SPHERE:
+			bounds.grow(first - Vec3(radius, radius, radius));
+			bounds.grow(first + Vec3(radius, radius, radius));
+			break;
+		case BOX:
+			bounds.grow(first);
+			bounds.grow(second);
+			break;
+		case DISK: {
+			// A disk only sticks out along an axis as far as it's tilted away from it //
+			Vec3 reach;
+			for (int axis = 0; axis < 3; axis++) reach[axis] = radius * std::sqrt(std::max(0.0f, 1 - second[axis] * second[axis]));
+			bounds.grow(first - reach);
+			bounds.grow(first + reach);
+			break;
+		}
+		case PLANE:
+			break;
+	}
+	return bounds;
+}
+
+AABB primitiveBounds(const Primitive& primitive, const DVec3& origin) {
+	float shape[4], extra[4];
+	packPrimitive(primitive, origin, shape, extra);
+	return packedBounds(primitive.type, shape, extra);
+}
+
+unsigned int packPrimitiveKind(const Primitive& primitive) {
+	return (unsigned int)primitive.type | primitive.material << 2;
+}
+
+// Packs the primitives into their own arrays, with a BVH over everything that isn't a plane //
+static void buildPrimitives(const Scene& scene, SceneBuffers& buffers) {
+	std::vector<unsigned int> order, bounded;
+	std::vector<AABB> bounds;
+	for (unsigned int i = 0; i < scene.primitives.size(); i++) {
+		if (scene.primitives[i].type == PLANE) { order.push_back(i); continue; }
+		bounded.push_back(i);
+		bounds.push_back(primitiveBounds(scene.primitives[i], buffers.origin));
+	}
+	buffers.planeCount = (unsigned int)order.size();
+
+	BVH bvh = buildBVH(bounds, 2);
+	for (unsigned int index : bvh.order) order.push_back(bounded[index]);
+
+	for (unsigned int index : order) {
+		const Primitive& primitive = scene.primitives[index];
+		float shape[4], extra[4];
+		packPrimitive(primitive, buffers.origin, shape, extra);
+		buffers.primitiveShapes.insert(buffers.primitiveShapes.end(), shape, shape + 4);
+		buffers.primitiveExtras.insert(buffers.primitiveExtras.end(), extra, extra + 4);
+		buffers.primitiveKinds.push_back(packPrimitiveKind(primitive));
+	}
+
+	// Leaves point straight at the primitive arrays, which start with the planes //
+	buffers.primitiveRoot = (unsigned int)buffers.nodes.size();
+	for (BVHNode node : bvh.nodes) {
+		node.leftOrFirst += node.count > 0 ? buffers.planeCount : buffers.primitiveRoot;
+		buffers.nodes.push_back(node);
+	}
+}
+
+// How much of the time light sampling goes for the sky rather than anything emissive //
+const float EnvironmentChance = 0.25f;
+
+static float luminance(const float* color) {
+	return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+}
+
+static void setLight(GPULight& light, LightType type, Vec3 a, Vec3 b, Vec3 c, float radius, float area, const float* emission) {
+	for (int axis = 0; axis < 3; axis++) {
+		light.a[axis] = a[axis];
+		light.b[axis] = b[axis];
+		light.c[axis] = c[axis];
+		light.emission[axis] = emission[axis];
+	}
+	light.a[3] = radius;
+	light.b[3] = (float)type;
+	light.c[3] = area;
+}
+
+// Gathers up everything emissive so the shader can aim rays straight at it //
+// Lights go in a light tree, so the shader can pick them by how much they'll light up each point //
+static void buildLights(const Scene& scene, SceneBuffers& buffers) {
+	std::vector<LightBounds> bounds;
+
+	// Every triangle of an emissive instance is a light, in the same order as the mesh's triangles //
+	buffers.instanceLightBases.assign(scene.instances.size(), 0);
+	for (size_t i = 0; i < scene.instances.size(); i++) {
+		const Instance& instance = scene.instances[i];
+		const float* emission = scene.materials[instance.material].emission;
+		if (luminance(emission) <= 0) continue;
+
+		const MeshRange& range = buffers.meshes[instance.mesh];
+		Affine transform = instance.transform.relativeTo(buffers.origin);
+		buffers.instanceLightBases[i] = (unsigned int)buffers.lights.size() - range.firstTriangle;
+		for (unsigned int triangle = range.firstTriangle; triangle < range.firstTriangle + range.triangleCount; triangle++) {
+			Vec3 corners[3];
+			LightBounds light;
+			for (int corner = 0; corner < 3; corner++) {
+				unsigned int vertex = buffers.triangles[triangle * 4 + corner];
+				corners[corner] = transform.transformPoint({buffers.vertices[vertex * 4], buffers.vertices[vertex * 4 + 1], buffers.vertices[vertex * 4 + 2]});
+				light.bounds.grow(corners[corner]);
+			}
+			Vec3 normal = cross(corners[1] - corners[0], corners[2] - corners[0]);
+			float area = length(normal) / 2;
+
+			GPULight gpuLight = {};
+			setLight(gpuLight, TRIANGLE_LIGHT, corners[0], corners[1], corners[2], 0, area, emission);
+			buffers.lights.push_back(gpuLight);
+
+			// Animated meshes move out from under their lights, so they're left out of the tree (but still light things up when hit) //
+			light.axis = normalize(normal);
+			light.power = range.animated ? 0 : luminance(emission) * area;
+			bounds.push_back(light);
+		}
+	}
+
+	// Spheres & disks can be sampled too, but boxes & planes just get found by bouncing into them //
+	for (unsigned int i = 0; i < buffers.primitiveKinds.size(); i++) {
+		unsigned int material = buffers.primitiveKinds[i] >> 2;
+		const float* emission = scene.materials[material].emission;
+		PrimitiveType type = (PrimitiveType)(buffers.primitiveKinds[i] & 3);
+		float* extra = &buffers.primitiveExtras[i * 4];
+		extra[3] = -1;
+		if (luminance(emission) <= 0 || (type != SPHERE && type != DISK)) continue;
+
+		const float* shape = &buffers.primitiveShapes[i * 4];
+		Vec3 centre = {shape[0], shape[1], shape[2]}, normal = {extra[0], extra[1], extra[2]};
+		float radius = shape[3];
+		float area = type == SPHERE ? (float)(4 * PI) * radius * radius : (float)PI * radius * radius;
+
+		GPULight gpuLight = {};
+		setLight(gpuLight, type == SPHERE ? SPHERE_LIGHT : DISK_LIGHT, centre, normal, {}, radius, area, emission);
+		extra[3] = (float)buffers.lights.size();
+		buffers.lights.push_back(gpuLight);
+
+		// Spheres face every way at once //
+		LightBounds light;
+		light.bounds = packedBounds(type, shape, extra);
+		light.axis = type == SPHERE ? Vec3(0, 1, 0) : normal;
+		light.cosSpread = type == SPHERE ? -1.0f : 1.0f;
+		light.power = luminance(emission) * area;
+		bounds.push_back(light);
+	}
+
+	for (size_t i = 0; i < buffers.instances.size(); i++) buffers.instances[i].lightBase = buffers.instanceLightBases[buffers.instanceOrder[i]];
+
+	LightTree tree = buildLightTree(bounds);
+	for (size_t i = 0; i < buffers.lights.size(); i++) buffers.lights[i].trail = tree.trails[i];
+	buffers.lightNodes = std::move(tree.nodes);
+	buffers.environmentChance = buffers.lightNodes.empty() ? 1 : EnvironmentChance;
+}
+
+/////////////////
+// Environment //
+/////////////////
+
+// Walker's alias method: every entry starts with its share of the total scaled so the average is 1, then the //
+// entries under 1 get topped up by ones over 1 until they're all full. Works out in O(n), and sampling's O(1) //
+static double buildAliasTable(const float* weights, unsigned int count, AliasEntry* table) {
+	double total = 0;
+	for (unsigned int i = 0; i < count; i++) total += weights[i];
+
+	std::vector<double> scaled(count);
+	std::vector<unsigned int> small, large;
+	for (unsigned int i = 0; i < count; i++) {
+		scaled[i] = total > 0 ? weights[i] * count / total : 0;
+		table[i] = {1, i, (float)scaled[i]};
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+	if (total <= 0) return 0;
+
+	while (!small.empty() && !large.empty()) {
+		unsigned int under = small.back(), over = large.back();
+		small.pop_back();
+		table[under].threshold = (float)scaled[under];
+		table[under].alias = over;
+		scaled[over] -= 1 - scaled[under];
+		if (scaled[over] < 1) { large.pop_back(); small.push_back(over); }
+	}
+
+	// Anything left over is (up to rounding) exactly full //
+	return total;
+}
+
+// Lets the shader pick environment texels in proportion to how much light comes from them //
+static void buildEnvironment(const Scene& scene, SceneBuffers& buffers) {
+	const Image& image = scene.environment;
+	if (image.width == 0) return;
+
+	unsigned int width = image.width, height = image.height;
+	buffers.environmentTable.resize(height + (size_t)width * height);
+	std::vector<float> rowWeights(height);
+	parallelFor(height, 16, [&](size_t begin, size_t end) {
+		std::vector<float> texelWeights(width);
+		for (size_t y = begin; y < end; y++) {
+			for (unsigned int x = 0; x < width; x++) texelWeights[x] = luminance(&image.pixels[(y * width + x) * 3]);
+
+			// Rows near the poles get squashed into less of the sphere, so they're worth less //
+			float sinTheta = (float)std::sin(PI * (y + 0.5) / height);
+			rowWeights[y] = (float)buildAliasTable(texelWeights.data(), width, &buffers.environmentTable[height + y * width]) * sinTheta;
+		}
+	});
+
+	// A pitch black environment isn't worth sampling at all //
+	if (buildAliasTable(rowWeights.data(), height, buffers.environmentTable.data()) <= 0 && !buffers.lightNodes.empty()) buffers.environmentChance = 0;
+}
+
+// Packs the scene into the buffers the shader reads //
+// Every mesh gets one BVH (a "bottom level"), shared by all its instances, and then //
+// one more BVH (the "top level") goes over the instances themselves //
+SceneBuffers buildSceneBuffers(const Scene& scene, const DVec3& origin) {
+	SceneBuffers buffers;
+	buffers.origin = origin;
+	std::vector<MeshRange> ranges(scene.meshes.size());
+	std::vector<std::vector<unsigned int>> meshCorners(scene.meshes.size());
+
+	for (unsigned int meshIndex = 0; meshIndex < scene.meshes.size(); meshIndex++) {
+		const Mesh& mesh = scene.meshes[meshIndex];
+		MeshRange& range = ranges[meshIndex];
+		range.firstVertex = (unsigned int)buffers.vertices.size() / 4;
+		range.vertexCount = (unsigned int)mesh.vertices.size();
+		range.firstTriangle = (unsigned int)buffers.triangles.size() / 4;
+		range.triangleCount = (unsigned int)mesh.indices.size() / 3;
+		for (const Wave& wave : scene.waves) range.animated |= wave.mesh == meshIndex;
+		range.compressed = scene.layout == COMPRESSED_NODES && !range.animated && range.triangleCount > 0;
+
+		// A BVH never has more than 2n - 1 nodes, so that's how much room an animated mesh gets (an empty one still //
+		// gets its one empty leaf, & 2n - 1 would wrap right round for it) //
+		if (range.animated) range.nodeCount = range.triangleCount > 0 ? range.triangleCount * 2 - 1 : 1;
+
+		for (size_t i = 0; i < mesh.vertices.size(); i++) {
+			uint32_t uv = mesh.uvs.empty() ? 0 : packHalf2(mesh.uvs[i * 2], mesh.uvs[i * 2 + 1]);
+			float packed;
+			std::memcpy(&packed, &uv, 4);
+			buffers.vertices.insert(buffers.vertices.end(), {mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z, packed});
+		}
+		buffers.triangles.resize(buffers.triangles.size() + range.triangleCount * 4);
+
+		meshCorners[meshIndex].resize(mesh.indices.size());
+		for (size_t i = 0; i < mesh.indices.size(); i++) meshCorners[meshIndex][i] = mesh.indices[i] + range.firstVertex;
+	}
+
+	// Every mesh's BVH gets built at once, since they don't depend on each other at all //
+	// Where their nodes go does though (each mesh's go after the last one's), so they get put in place one at a time //
+	std::vector<BVH> bvhs(scene.meshes.size());
+	parallelFor(bvhs.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) bvhs[i] = buildMeshBVH(buffers, ranges[i], meshCorners[i]);
+	});
+	for (size_t i = 0; i < ranges.size(); i++) {
+		ranges[i].firstNode = (unsigned int)(ranges[i].compressed ? buffers.wideNodes.size() : buffers.nodes.size());
+		buildMeshRange(buffers, ranges[i], meshCorners[i], bvhs[i]);
+		buffers.meshes.push_back(std::move(ranges[i]));
+	}
+
+	buildTopLevel(scene, buffers);
+	buildPrimitives(scene, buffers);
+	buildLights(scene, buffers);
+	buildEnvironment(scene, buffers);
+	return buffers;
+}
+
+// The meshes' BVHs don't care where the origin is, so they stay as they are, & the primitives' BVH just gets built again //
+// on the end of them. The lights keep their order, so the instances' lightBases still point at the right ones //
+void rebaseSceneBuffers(const Scene& scene, SceneBuffers& buffers, const DVec3& origin) {
+	buffers.origin = origin;
+	buildTopLevel(scene, buffers);
+
+	buffers.nodes.resize(buffers.primitiveRoot);
+	buffers.primitiveShapes.clear();
+	buffers.primitiveExtras.clear();
+	buffers.primitiveKinds.clear();
+	buildPrimitives(scene, buffers);
+
+	// (A pitch black sky stays unsampled, whatever buildLights thinks, see buildEnvironment) //
+	float environmentChance = buffers.environmentChance;
+	buffers.lights.clear();
+	buildLights(scene, buffers);
+	buffers.environmentChance = environmentChance;
+}
+
+///////////////
+// Animation //
+///////////////
+
+// Refits a mesh's BVH after some of its vertices moved, or rebuilds it if the tree's gotten too bad //
+static void refitMesh(SceneBuffers& buffers, MeshRange& range, const std::vector<unsigned int>& movedVertices, SceneChanges& changes) {
+	std::vector<unsigned int> dirtyLeaves;
+	for (unsigned int vertex : movedVertices) {
+		for (unsigned int i = range.vertexLeafStart[vertex]; i < range.vertexLeafStart[vertex + 1]; i++) dirtyLeaves.push_back(range.vertexLeaves[i]);
+	}
+
+	BVHNode* nodes = &buffers.nodes[range.firstNode];
+	std::vector<unsigned int> touched;
+	refitBVH(nodes, range.firstNode, range.refit, dirtyLeaves, [&](const BVHNode& leaf) {
+		AABB bounds;
+		for (unsigned int i = leaf.leftOrFirst; i < leaf.leftOrFirst + leaf.count; i++) {
+			for (int corner = 0; corner < 3; corner++) bounds.grow(vertexPosition(buffers, buffers.triangles[i * 4 + corner]));
+		}
+		return bounds;
+	}, touched);
+	range.bounds = nodeBounds(nodes[0]);
+
+	// Refitting never changes the tree's shape, so as things drift it slowly gets worse to trace //
+	// Once it's bad enough, it's worth the hit of building it again //
+	if (refitCost(nodes, range.refit) > range.refit.builtCost * RebuildThreshold) {
+		std::vector<unsigned int> corners(range.triangleCount * 3);
+		for (unsigned int i = 0; i < range.triangleCount; i++) {
+			for (int corner = 0; corner < 3; corner++) corners[i * 3 + corner] = buffers.triangles[(range.firstTriangle + i) * 4 + corner];
+		}
+		buildMeshRange(buffers, range, corners, buildMeshBVH(buffers, range, corners));
+		changes.triangles.add(range.firstTriangle, range.firstTriangle + range.triangleCount);
+		changes.nodes.add(range.firstNode, range.firstNode + range.nodeCount);
+		changes.rebuilds++;
+		return;
+	}
+
+	for (unsigned int node : touched) changes.nodes.add(range.firstNode + node, range.firstNode + node + 1);
+	changes.refits++;
+}
+
+SceneChanges animateScene(const Scene& scene, SceneBuffers& buffers, double time) {
+	SceneChanges changes;
+	std::vector<bool> meshChanged(scene.meshes.size(), false);
+
+	for (const Wave& wave : scene.waves) {
+		const Mesh& mesh = scene.meshes[wave.mesh];
+		MeshRange& range = buffers.meshes[wave.mesh];
+
+		// Keep the phase small before it turns into a float, or the waves get choppy after a while //
+		float offset = (float)std::fmod(time * wave.speed, 1.0);
+		parallelFor(range.vertexCount, 1024, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const Vec3& rest = mesh.vertices[i];
+				float distance = std::sqrt(rest.x * rest.x + rest.z * rest.z);
+				float height = wave.amplitude * std::sin((float)(2 * PI) * (distance / wave.wavelength - offset));
+				buffers.vertices[(range.firstVertex + i) * 4 + 1] = rest.y + height;
+			}
+		});
+		changes.vertices.add(range.firstVertex, range.firstVertex + range.vertexCount);
+
+		// Waves move every vertex, but refitting only cares about the ones it's told about //
+		std::vector<unsigned int> moved(range.vertexCount);
+		for (unsigned int i = 0; i < range.vertexCount; i++) moved[i] = i;
+		refitMesh(buffers, range, moved, changes);
+		meshChanged[wave.mesh] = true;
+	}
+
+	// Then the top level, but only the leaves holding instances of meshes that changed //
+	std::vector<unsigned int> dirtyLeaves;
+	for (unsigned int mesh = 0; mesh < scene.meshes.size(); mesh++) {
+		if (meshChanged[mesh]) dirtyLeaves.insert(dirtyLeaves.end(), buffers.meshInstanceLeaves[mesh].begin(), buffers.meshInstanceLeaves[mesh].end());
+	}
+	if (dirtyLeaves.empty()) return changes;
+
+	std::vector<unsigned int> touched;
+	refitBVH(buffers.instanceNodes.data(), 0, buffers.instanceRefit, dirtyLeaves, [&](const BVHNode& leaf) {
+		AABB bounds;
+		for (unsigned int i = leaf.leftOrFirst; i < leaf.leftOrFirst + leaf.count; i++) {
+			const Instance& instance = scene.instances[buffers.instanceOrder[i]];
+			bounds.grow(instance.transform.relativeTo(buffers.origin).transformBounds(buffers.meshes[instance.mesh].bounds));
+		}
+		return bounds;
+	}, touched);
+
+	if (refitCost(buffers.instanceNodes.data(), buffers.instanceRefit) > buffers.instanceRefit.builtCost * RebuildThreshold) {
+		buildTopLevel(scene, buffers);
+		changes.topLevelRebuilt = true;
+		changes.rebuilds++;
+	} else {
+		for (unsigned int node : touched) changes.instanceNodes.add(node, node + 1);
+		changes.refits++;
+	}
+
+	return changes;
+}
\ No newline at end of file
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "vec.h"
+#include "bvh.h"
+#include "image.h"
+#include "tiles.h"
+#include "compress.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+///////////
+// Scene //
+///////////
+
+// Materials are laid out exactly like the shader's Material struct //
+// texture is which of the scene's textures multiplies the albedo (NoTexture for none), repeated tiling times across //
+// the mesh's UVs. handle is only filled in on the GPU's copy, & only with bindless textures (see Source/textures.h) //
+// The GPU's copy also numbers streamed textures separately from the rest, with StreamedTexture set //
+const unsigned int NoTexture = 0xFFFFFFFFu;
+const unsigned int StreamedTexture = 0x80000000u;
+
+struct Material {
+	float albedo[4];
+	float emission[4];
+	unsigned int texture = NoTexture;
+	float tiling = 1;
+	unsigned int handle[2] = {};
+};
+
+// An image a material can be textured with, mips & all (biggest first) //
+// Images that nelcompress has been run on come with compressed levels instead (see Source/compress.h) //
+// Streamed textures never get loaded whole, they only have a tile cache, & the GPU streams in whatever tiles it needs //
+struct Texture {
+	std::string name;
+	std::string path;
+	std::vector<MipLevel> levels;
+	CompressedTexture compressed;
+	bool streamed = false;
+	TileCache cache;
+};
+
+// A mesh only ever exists once, no matter how many instances of it there are //
+// Its BVH is built in object space, so every instance can share it //
+// uvs has two floats per vertex, or is empty if the mesh doesn't have any (which leaves them all at 0) //
+struct Mesh {
+	std::string name;
+	std::vector<Vec3> vertices;
+	std::vector<float> uvs;
+	std::vector<unsigned int> indices;
+	AABB bounds;
+};
+
+// Ripples a mesh's vertices up & down over time, spreading out from its centre //
+// (Mostly here so there's something for the BVH refitting to chew on) //
+struct Wave {
+	unsigned int mesh;
+	float amplitude;
+	float wavelength;
+	float speed;
+};
+
+// One placement of a mesh in the world (where exactly it is is kept in doubles, see SceneBuffers' origin) //
+struct Instance {
+	DAffine transform;
+	unsigned int mesh;
+	unsigned int material;
+};
+
+// Shapes simple enough to intersect directly, without any triangles //
+enum PrimitiveType {
+	SPHERE,
+	BOX,
+	PLANE,
+	DISK
+};
+
+// Their numbers are packed the same way the shader reads them: //
+// SPHERE: shape = centre & radius //
+// BOX: shape = min, extra = max //
+// PLANE: shape = normal & offset along it (planes go on forever, so they never go in the BVH) //
+// DISK: shape = centre & radius, extra = normal //
+// They're in world space, so they're doubles here, & only turn into floats once they're packed for the GPU //
+struct Primitive {
+	PrimitiveType type;
+	unsigned int material;
+	double shape[4];
+	double extra[4];
+};
+
+// How the meshes' BVHs get laid out for the shader //
+// Compressed nodes take a lot less memory (and bandwidth), but cost a little extra maths per box //
+enum NodeLayout {
+	FULL_NODES,
+	COMPRESSED_NODES
+};
+
+struct Scene {
+	std::vector<Material> materials;
+	std::vector<Mesh> meshes;
+	std::vector<Instance> instances;
+	std::vector<Wave> waves;
+	std::vector<Primitive> primitives;
+	std::vector<Texture> textures;
+
+	std::unordered_map<std::string, unsigned int> materialNames;
+	std::unordered_map<std::string, unsigned int> meshNames;
+	std::unordered_map<std::string, unsigned int> textureNames;
+
+	// Where the camera starts out (pitch & yaw are in radians) //
+	DVec3 cameraPosition = {0, 0, 0};
+	float cameraPitch = 0, cameraYaw = 0;
+
+	NodeLayout layout = FULL_NODES;
+
+	// An equirectangular HDR image to light the scene with (empty means the usual sky gradient) //
+	// Rotation turns it around the y axis, in radians //
+	Image environment;
+	float environmentRotation = 0;
+};
+
+// Everything the shader needs, packed the way it expects //
+struct GPUInstance {
+	float worldToObject[3][4];
+	unsigned int rootNode;
+	unsigned int material;
+
+	// Whether rootNode points into the compressed nodes or the full ones //
+	unsigned int compressed;
+
+	// Adding a triangle's index to this gives its light (it wraps around, which is fine for unsigned maths) //
+	// Only means anything when the instance's material is emissive //
+	unsigned int lightBase;
+};
+
+// Emissive things that get sampled directly, laid out exactly like the shader's Light struct //
+// TRIANGLE_LIGHT: a, b & c are the world space corners, c[3] is the area //
+// SPHERE_LIGHT: a is the centre & radius //
+// DISK_LIGHT: a is the centre & radius, b is the normal, c[3] is the area //
+// b[3] is the type, and trail is the way down the light tree to it (see LightTree) //
+enum LightType {
+	TRIANGLE_LIGHT,
+	SPHERE_LIGHT,
+	DISK_LIGHT
+};
+
+struct GPULight {
+	float a[4];
+	float b[4];
+	float c[4];
+	float emission[3];
+	unsigned int trail;
+};
+
+// One entry of an alias table, laid out exactly like the shader's AliasEntry struct //
+// Picking entry i, then keeping it if a second random number is under threshold (or taking alias if not), //
+// picks every entry in proportion to its weight with only one lookup //
+// pdf is how likely that entry is to be picked, times the entry count //
+struct AliasEntry {
+	float threshold;
+	unsigned int alias;
+	float pdf;
+};
+
+// Where one mesh ended up in the buffers, plus what it takes to refit it later //
+struct MeshRange {
+	unsigned int firstVertex, vertexCount;
+	unsigned int firstTriangle, triangleCount;
+	unsigned int firstNode, nodeCount;
+	AABB bounds;
+
+	// Compressed meshes' nodes live in wideNodes instead of nodes //
+	// (Animated meshes always stay uncompressed, since they need refitting) //
+	bool compressed = false;
+
+	// Only animated meshes need refitting, so only they fill the rest of this in //
+	// Their node ranges are also padded out to the most a rebuild could ever need, so rebuilds fit in place //
+	bool animated = false;
+	BVHRefit refit;
+
+	// Which leaves use each vertex (vertex i's leaves are vertexLeaves[vertexLeafStart[i]] up to vertexLeafStart[i + 1]) //
+	std::vector<unsigned int> vertexLeafStart;
+	std::vector<unsigned int> vertexLeaves;
+};
+
+// Vertices are 4 floats each: the position, then the UV as two half floats packed into the last one's bits //
+// Everything in world space is relative to origin (a "floating origin"), which is kept near the camera, so the shader //
+// only ever sees small numbers & floats are plenty. Meshes are in their own space, so moving it never touches them //
+struct SceneBuffers {
+	DVec3 origin;
+
+	std::vector<float> vertices;
+	std::vector<unsigned int> triangles;
+	std::vector<BVHNode> nodes;
+	std::vector<WideBVHNode> wideNodes;
+	std::vector<BVHNode> instanceNodes;
+	std::vector<GPUInstance> instances;
+
+	std::vector<MeshRange> meshes;
+
+	// The top level gets refit too whenever a mesh changes shape //
+	BVHRefit instanceRefit;
+
+	// Which scene instance ended up in each slot of instances //
+	std::vector<unsigned int> instanceOrder;
+
+	// The top level leaves holding at least one instance of each mesh //
+	std::vector<std::vector<unsigned int>> meshInstanceLeaves;
+
+	// Primitives are stored as structure of arrays, one array per field, planes first & then the rest in BVH order //
+	// Their BVH goes at the end of nodes, whatever the layout, since it's never very big //
+	std::vector<float> primitiveShapes;
+	std::vector<float> primitiveExtras;
+	std::vector<unsigned int> primitiveKinds;
+	unsigned int planeCount = 0;
+	unsigned int primitiveRoot = 0;
+
+	// Emissive triangles & primitives, plus how often the sky gets sampled instead of them //
+	// (Emissive primitives keep their light's index in extra[3], or -1 if they can't be sampled) //
+	std::vector<GPULight> lights;
+	std::vector<LightTreeNode> lightNodes;
+	float environmentChance = 1;
+
+	// Alias tables for picking environment texels by brightness: one over the rows (scaled by how much of the //
+	// sphere each row covers), then one for each row over its texels, all one after another //
+	std::vector<AliasEntry> environmentTable;
+
+	// Each scene instance's lightBase, so a rebuilt top level can hand them back out //
+	std::vector<unsigned int> instanceLightBases;
+};
+
+// A range of elements in one of the buffers, [first, last) //
+struct BufferRange {
+	size_t first = 0, last = 0;
+
+	void add(size_t begin, size_t end) {
+		if (first == last) { first = begin; last = end; return; }
+		first = std::min(first, begin);
+		last = std::max(last, end);
+	}
+
+	bool empty() const { return first == last; }
+};
+
+// Which bits of the buffers animateScene changed, so only they need uploading //
+// (If the top level got rebuilt, its nodes & instances changed size too, so they need replacing outright) //
+struct SceneChanges {
+	BufferRange vertices;
+	BufferRange triangles;
+	BufferRange nodes;
+	BufferRange instanceNodes;
+	bool topLevelRebuilt = false;
+
+	unsigned int refits = 0;
+	unsigned int rebuilds = 0;
+};
+
+// The box around a primitive, relative to origin (planes are infinite, so they don't get one) //
+AABB primitiveBounds(const Primitive& primitive, const DVec3& origin);
+
+// Primitives' type & material share one number (the type's in the bottom 2 bits) //
+unsigned int packPrimitiveKind(const Primitive& primitive);
+
+bool loadScene(Scene& scene, std::string path);
+bool loadOBJ(Mesh& mesh, std::string path);
+SceneBuffers buildSceneBuffers(const Scene& scene, const DVec3& origin);
+
+// Moves the buffers' origin, which only means redoing the top level, the primitives & the lights //
+void rebaseSceneBuffers(const Scene& scene, SceneBuffers& buffers, const DVec3& origin);
+
+// Moves everything animated to where it should be at the given time, & refits whatever BVHs that //
+// touched. BVHs only get rebuilt from scratch once refitting has made them noticeably worse //
+SceneChanges animateScene(const Scene& scene, SceneBuffers& buffers, double time);
\ No newline at end of file
@@ -0,0 +1,291 @@
+#include "shaders.h"
+#include "resources.h"
+#include "print.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+/////////////////////////
+// Shader Preprocessor //
+/////////////////////////
+
+// Pastes a file onto the end of source, along with everything it includes //
+// defines only go into the first file, since that's the one with the #version //
+static bool appendFile(std::string path, unsigned int number, const ShaderDefines* defines, ShaderSource& source) {
+	std::ifstream fileStream(path);
+	if (!fileStream.is_open()) { error("Could not open file '" + path + "'."); return false; }
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+	std::string line;
+	unsigned int lineNumber = 0;
+	while (std::getline(fileStream, line)) {
+		lineNumber++;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		std::istringstream tokens(line);
+		std::string directive;
+		tokens >> directive;
+
+		if (directive == "#include") {
+			std::string name;
+			if (!(tokens >> std::quoted(name)) || name.empty()) { error(path + ":" + std::to_string(lineNumber) + ": #include needs a file name in quotes."); return false; }
+			std::string included = std::filesystem::path(directory + name).lexically_normal().string();
+
+			// Anything that's already been pasted in just leaves a blank line, so the line numbers stay right //
+			bool seen = false;
+			for (const std::string& file : source.files) seen |= file == included;
+			if (seen) { source.text += "\n"; continue; }
+
+			unsigned int includedNumber = (unsigned int)source.files.size();
+			source.files.push_back(included);
+			source.text += "#line 1 " + std::to_string(includedNumber) + "\n";
+			if (!appendFile(included, includedNumber, nullptr, source)) return false;
+			source.text += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(number) + "\n";
+			continue;
+		}
+
+		source.text += line + "\n";
+		if (directive == "#version" && defines) {
+			for (const auto& [name, value] : *defines) source.text += "#define " + name + " " + value + "\n";
+			source.text += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(number) + "\n";
+		}
+	}
+	return true;
+}
+
+bool preprocessShader(std::string path, const ShaderDefines& defines, ShaderSource& source) {
+	source.text.clear();
+	source.files = {std::filesystem::path(path).lexically_normal().string()};
+	return appendFile(source.files[0], 0, &defines, source);
+}
+
+ShaderDefines traceDefines(const Scene& scene, const SceneBuffers& buffers, unsigned int minBounces, unsigned int maxBounces) {
+	bool fullNodes = false, wideNodes = false;
+	for (const GPUInstance& instance : buffers.instances) (instance.compressed ? wideNodes : fullNodes) = true;
+
+	bool primitiveTypes[4] = {};
+	for (const Primitive& primitive : scene.primitives) primitiveTypes[primitive.type] = true;
+
+	bool textures = false, streamedTextures = false;
+	for (const Material& material : scene.materials) {
+		if (material.texture != NoTexture) (scene.textures[material.texture].streamed ? streamedTextures : textures) = true;
+	}
+
+	bool lightTypes[3] = {};
+	for (const GPULight& light : buffers.lights) lightTypes[(int)light.b[3]] = true;
+
+	auto flag = [](bool value) { return std::string(value ? "true" : "false"); };
+	return {
+		{"MIN_BOUNCES", std::to_string(minBounces) + "u"},
+		{"MAX_BOUNCES", std::to_string(maxBounces) + "u"},
+		{"HAS_MESHES", flag(!buffers.instances.empty())},
+		{"HAS_FULL_NODES", flag(fullNodes)},
+		{"HAS_WIDE_NODES", flag(wideNodes)},
+		{"HAS_PLANES", flag(buffers.planeCount > 0)},
+		{"HAS_PRIMITIVE_BVH", flag(buffers.primitiveKinds.size() > buffers.planeCount)},
+		{"HAS_SPHERES", flag(primitiveTypes[SPHERE])},
+		{"HAS_BOXES", flag(primitiveTypes[BOX])},
+		{"HAS_DISKS", flag(primitiveTypes[DISK])},
+		{"HAS_TEXTURES", flag(textures)},
+		{"HAS_STREAMED_TEXTURES", flag(streamedTextures)},
+		{"HAS_ENVIRONMENT_MAP", flag(scene.environment.width > 0)},
+		{"HAS_LIGHTS", flag(!buffers.lights.empty())},
+		{"HAS_TRIANGLE_LIGHTS", flag(lightTypes[TRIANGLE_LIGHT])},
+		{"HAS_SPHERE_LIGHTS", flag(lightTypes[SPHERE_LIGHT])},
+		{"HAS_DISK_LIGHTS", flag(lightTypes[DISK_LIGHT])}
+	};
+}
+
+//////////////////////
+// Program Variants //
+//////////////////////
+
+static std::unordered_map<uint64_t, unsigned int> Variants;
+
+// FNV-1a, with a separator after each piece so they can't run into each other //
+static void hashBytes(uint64_t& hash, const char* bytes, size_t size) {
+	for (size_t i = 0; i < size; i++) hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ull;
+	hash = (hash ^ 0xFF) * 1099511628211ull;
+}
+
+// A binary's only any good to the exact driver that made it, so that goes into the key too //
+static uint64_t driverHash() {
+	uint64_t hash = 14695981039346656037ull;
+	for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+		const char* text = (const char*)glGetString(name);
+		hashBytes(hash, text, text ? std::strlen(text) : 0);
+	}
+	return hash;
+}
+
+uint64_t programKey(const ShaderSource& vertex, const ShaderSource& fragment) {
+	uint64_t hash = driverHash();
+	hashBytes(hash, vertex.text.data(), vertex.text.size());
+	hashBytes(hash, fragment.text.data(), fragment.text.size());
+	return hash;
+}
+
+unsigned int findProgramVariant(uint64_t key) {
+	auto variant = Variants.find(key);
+	return variant == Variants.end() ? 0 : variant->second;
+}
+
+void addProgramVariant(uint64_t key, unsigned int program) {
+	Variants[key] = program;
+}
+
+void clearProgramVariants() {
+	for (const auto& [key, program] : Variants) glDeleteProgram(program);
+	Variants.clear();
+}
+
+// A saved program is this header & then the driver's binary, exactly as glGetProgramBinary gave it //
+struct ProgramHeader {
+	char magic[4] = {'N', 'E', 'L', 'P'};
+	uint32_t version = 1;
+	uint32_t format = 0;
+	uint32_t length = 0;
+};
+
+static std::string programCachePath(uint64_t key) {
+	std::stringstream name;
+	name << std::hex << key << ".program";
+	return ProgramCacheDirectory + name.str();
+}
+
+bool loadProgramBinary(unsigned int program, uint64_t key) {
+	int formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	if (formatCount == 0) return false;
+
+	std::ifstream file(programCachePath(key), std::ios::binary);
+	ProgramHeader header, expected;
+	if (!file.is_open() || !file.read((char*)&header, sizeof(header))) return false;
+	if (std::string(header.magic, 4) != std::string(expected.magic, 4) || header.version != expected.version) return false;
+	std::vector<char> binary(header.length);
+	if (!file.read(binary.data(), binary.size())) return false;
+
+	// The driver's allowed to turn down a binary it made (after an update, say), which just means compiling it again //
+	glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+	int linkStatus = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+	glGetError();
+	return linkStatus == GL_TRUE;
+}
+
+void saveProgramBinary(unsigned int program, uint64_t key) {
+	int length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	ProgramHeader header;
+	header.format = format;
+	header.length = (uint32_t)length;
+
+	// Written somewhere else first & then moved over, so a half written binary never gets loaded //
+	std::error_code errorCode;
+	std::filesystem::create_directories(ProgramCacheDirectory, errorCode);
+	std::string path = programCachePath(key), temporaryPath = path + ".tmp";
+	std::ofstream file(temporaryPath, std::ios::binary);
+	if (!file.is_open()) { error("Could not write '" + temporaryPath + "'."); return; }
+	file.write((const char*)&header, sizeof(header));
+	file.write(binary.data(), length);
+	file.close();
+	if (!file) { error("Could not write '" + temporaryPath + "'."); return; }
+	std::filesystem::rename(temporaryPath, path, errorCode);
+	if (errorCode) error("Could not write '" + path + "'.");
+}
+
+////////////
+// SPIR-V //
+////////////
+
+// The few bits of SPIR-V that finding names takes (see the SPIR-V spec, section 3) //
+const uint32_t SPIRVMagic = 0x07230203;
+const uint32_t OpName = 5, OpVariable = 59, OpDecorate = 71;
+const uint32_t DecorationSpecId = 1, DecorationLocation = 30;
+const uint32_t StorageUniformConstant = 0;
+
+bool loadSPIRV(std::string path, SPIRVModule& module) {
+	module = SPIRVModule();
+	module.path = path;
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) { error("Could not open SPIR-V module '" + path + "' (CMake only builds it if it can find glslangValidator)."); return false; }
+	size_t size = (size_t)file.tellg();
+	file.seekg(0);
+	module.words.resize(size / 4);
+	if (size % 4 != 0 || size < 20 || !file.read((char*)module.words.data(), size) || module.words[0] != SPIRVMagic) { error("'" + path + "' isn't a SPIR-V module."); return false; }
+
+	// Every instruction starts with its length & opcode, then the header's 5 words are followed by nothing but //
+	// instructions. Names, decorations & variables all come before any code, but going through the lot is quick enough //
+	std::unordered_map<uint32_t, std::string> names;
+	std::unordered_map<uint32_t, uint32_t> locations, constantIDs;
+	std::vector<uint32_t> uniforms;
+	for (size_t i = 5; i < module.words.size();) {
+		uint32_t length = module.words[i] >> 16, opcode = module.words[i] & 0xFFFF;
+		if (length == 0 || i + length > module.words.size()) { error("'" + path + "' has a broken instruction in it."); return false; }
+		const uint32_t* operands = &module.words[i + 1];
+		if (opcode == OpName && length > 2) names[operands[0]] = std::string((const char*)&operands[1], strnlen((const char*)&operands[1], (length - 2) * 4));
+		if (opcode == OpDecorate && length > 3 && operands[1] == DecorationLocation) locations[operands[0]] = operands[2];
+		if (opcode == OpDecorate && length > 3 && operands[1] == DecorationSpecId) constantIDs[operands[0]] = operands[2];
+		if (opcode == OpVariable && length > 3 && operands[2] == StorageUniformConstant) uniforms.push_back(operands[1]);
+		i += length;
+	}
+
+	for (uint32_t uniform : uniforms) {
+		if (names.count(uniform) && locations.count(uniform)) module.uniformLocations[names[uniform]] = (int)locations[uniform];
+	}
+	for (const auto& [id, constantID] : constantIDs) {
+		if (!names.count(id)) { error("'" + path + "' doesn't have names in it, so it can't be specialized (was it stripped?)"); return false; }
+		module.constantIDs[names[id]] = constantID;
+	}
+	return true;
+}
+
+bool spirvSupported() {
+	return GLAD_GL_VERSION_4_6 && glSpecializeShader != nullptr;
+}
+
+bool specializeShader(unsigned int shader, const SPIRVModule& module, const ShaderDefines& defines) {
+	print("Specializing shader '" + module.path + "'...");
+	std::vector<GLuint> ids, values;
+	for (const auto& [name, value] : defines) {
+		auto constant = module.constantIDs.find(name);
+		if (constant == module.constantIDs.end()) continue;
+		ids.push_back(constant->second);
+		values.push_back(value == "true" ? 1 : value == "false" ? 0 : (GLuint)std::stoul(value));
+	}
+
+	glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, module.words.data(), (GLsizei)(module.words.size() * 4));
+	glSpecializeShader(shader, "main", (GLuint)ids.size(), ids.data(), values.data());
+
+	int compileStatus = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+	if (compileStatus == GL_FALSE) {
+		int logLength = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+		std::string log(std::max(logLength, 1), '\0');
+		glGetShaderInfoLog(shader, logLength, nullptr, log.data());
+		print("BEGIN SPIR-V ERROR LOG");
+		std::cout << log.c_str() << std::endl;
+		print("END SPIR-V ERROR LOG");
+		error("Could not specialize '" + module.path + "'.");
+		return false;
+	}
+	return true;
+}
+
+uint64_t programKey(const SPIRVModule& vertex, const SPIRVModule& fragment, const ShaderDefines& defines) {
+	uint64_t hash = driverHash();
+	hashBytes(hash, (const char*)vertex.words.data(), vertex.words.size() * 4);
+	hashBytes(hash, (const char*)fragment.words.data(), fragment.words.size() * 4);
+	for (const auto& [name, value] : defines) hashBytes(hash, (name + "=" + value).data(), name.size() + value.size() + 1);
+	return hash;
+}
\ No newline at end of file
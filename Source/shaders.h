@@ -0,0 +1,86 @@
+#pragma once
+
+#include "scene.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/////////////////////////
+// Shader Preprocessor //
+/////////////////////////
+
+// Shaders go through a (very small) preprocessor of our own before GL ever sees them: //
+// - #include "file" pastes in another file, relative to the one including it (each file only ever gets pasted in once) //
+// - defines get added straight after #version, so one file can be compiled into variants specialized for each scene //
+// Every file gets a number, which #line directives pass on to the driver, so its errors still point at the right line //
+// (files[n] is file n, & the file that was asked for is always 0) //
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+struct ShaderSource {
+	std::string text;
+	std::vector<std::string> files;
+};
+
+// Doesn't need GL, so it can run on any thread //
+bool preprocessShader(std::string path, const ShaderDefines& defines, ShaderSource& source);
+
+// Turns on exactly the parts of Shaders/frag.glsl that the scene needs (see Shaders/specialization.glsl) //
+// Bounce limits go in too, so they have to match what the uniforms would've been //
+ShaderDefines traceDefines(const Scene& scene, const SceneBuffers& buffers, unsigned int minBounces, unsigned int maxBounces);
+
+//////////////////////
+// Program Variants //
+//////////////////////
+
+// Every variant that gets linked sticks around, keyed by a hash of its preprocessed sources (the vertex shader it's //
+// linked with as well as its own) & the driver, so going back to a scene (or layout) that's been seen before doesn't //
+// compile anything. Linked programs also get saved to the cache directory with glGetProgramBinary, so the next run //
+// can usually skip compiling altogether //
+// (Needs GL, since the driver's part of the key) //
+uint64_t programKey(const ShaderSource& vertex, const ShaderSource& fragment);
+
+// 0 if there isn't one yet //
+unsigned int findProgramVariant(uint64_t key);
+void addProgramVariant(uint64_t key, unsigned int program);
+
+// Deletes every variant, for when the shaders get reloaded //
+void clearProgramVariants();
+
+// program has to have GL_PROGRAM_BINARY_RETRIEVABLE_HINT set before it's linked to be saved //
+// Loading returns false (without an error) if there's no usable binary, so the program can be compiled as usual //
+const std::string ProgramCacheDirectory = "../Cache/";
+bool loadProgramBinary(unsigned int program, uint64_t key);
+void saveProgramBinary(unsigned int program, uint64_t key);
+
+////////////
+// SPIR-V //
+////////////
+
+// With --spirv, the trace program gets made from SPIR-V that CMake precompiled with glslang (into Shaders/, next to //
+// nel), so the driver never has to compile any GLSL. Scenes specialize it with specialization constants instead of //
+// defines, which are matched up with traceDefines' by name //
+// GL doesn't have to keep any names from SPIR-V, so modules get looked through here instead, for the names glslang //
+// leaves in: which location each uniform has, & which ID each specialization constant has //
+const std::string SPIRVDirectory = "Shaders/";
+
+struct SPIRVModule {
+	std::string path;
+	std::vector<uint32_t> words;
+	std::unordered_map<std::string, int> uniformLocations;
+	std::unordered_map<std::string, uint32_t> constantIDs;
+};
+
+bool loadSPIRV(std::string path, SPIRVModule& module);
+
+// Needs GL 4.6, which is where glSpecializeShader comes from //
+bool spirvSupported();
+
+// Hands the module to shader & specializes it, with true & false as 1 & 0 (numbers can keep a u on the end) //
+// Defines the module doesn't have a constant for just get left out //
+bool specializeShader(unsigned int shader, const SPIRVModule& module, const ShaderDefines& defines);
+
+// The same as for GLSL, so specialized SPIR-V gets cached as a variant & as a program binary too //
+uint64_t programKey(const SPIRVModule& vertex, const SPIRVModule& fragment, const ShaderDefines& defines);
\ No newline at end of file
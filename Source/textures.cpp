@@ -0,0 +1,661 @@
+#include "textures.h"
+#include "resources.h"
+#include "parallel.h"
+#include "print.h"
+
+#include "../Dependencies/glfw/include/glfw/glfw3.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+////////////////////
+// Scene Textures //
+////////////////////
+
+// Everything below that belongs to one scene's textures lives in here, & works on whichever set's bound //
+const unsigned int NoPage = 0xFFFFFFFFu;
+const int FeedbackBufferCount = 3;
+
+// Which streamed texture & tile each page table entry is, & whether it's already been asked for //
+struct StreamedPage {
+	unsigned int texture, tile, level;
+	bool requested;
+};
+
+// What's in each of the pool's slots, & when it was last wanted //
+struct PoolSlot {
+	unsigned int page = NoPage;
+	unsigned int lastUsed = 0;
+	bool pinned = false;
+};
+
+struct SceneTextures {
+	// Trilinear & repeating, for every material texture whichever way they go //
+	// (Bindless handles bake the sampler in, so the textures themselves never need touching) //
+	unsigned int sampler = 0;
+
+	// Bindless gets a texture & a handle per scene texture, the fallback gets one array texture for the lot //
+	std::vector<unsigned int> textures;
+	std::vector<GLuint64> handles;
+	unsigned int textureArray = 0;
+
+	// Streamed textures' pool, page table & feedback, & what's where (see Streamed Textures) //
+	unsigned int tilePool = 0, poolSampler = 0, pageTable = 0;
+	unsigned int feedbackBuffers[FeedbackBufferCount] = {};
+	GLsync feedbackFences[FeedbackBufferCount] = {};
+	int feedbackIndex = 0;
+	unsigned int generation = 0;
+
+	std::vector<std::string> streamedPaths;
+	unsigned int pageBase = 0;
+	std::vector<StreamedPage> pages;
+	std::vector<unsigned int> pageEntries;
+	std::vector<PoolSlot> poolSlots;
+
+	// Entries that changed since the page table was last uploaded (see flushPageEntries) //
+	std::vector<unsigned int> dirtyPages;
+};
+
+static SceneTextures DefaultTextures;
+static SceneTextures* Bound = &DefaultTextures;
+
+///////////////////////
+// Material Textures //
+///////////////////////
+
+// glad was generated without any extensions, so the bindless functions get looked up by hand //
+typedef GLuint64 (GLAD_API_PTR* GetTextureSamplerHandleFunction)(GLuint texture, GLuint sampler);
+typedef void (GLAD_API_PTR* TextureHandleFunction)(GLuint64 handle);
+static GetTextureSamplerHandleFunction GetTextureSamplerHandle = nullptr;
+static TextureHandleFunction MakeTextureHandleResident = nullptr, MakeTextureHandleNonResident = nullptr;
+
+static bool Bindless = false;
+
+// BC7's been core since 4.2, but BC1 needs S3TC (& sRGB S3TC at that) //
+static bool S3TC = false;
+
+static bool hasExtension(const char* name) {
+	int extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (int i = 0; i < extensionCount; i++) if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
+	return false;
+}
+
+bool initMaterialTextures(bool allowBindless) {
+	bool bindlessExtension = hasExtension("GL_ARB_bindless_texture");
+	Bindless = allowBindless && bindlessExtension;
+	S3TC = hasExtension("GL_EXT_texture_compression_s3tc") && hasExtension("GL_EXT_texture_sRGB");
+
+	if (Bindless) {
+		GetTextureSamplerHandle = (GetTextureSamplerHandleFunction)glfwGetProcAddress("glGetTextureSamplerHandleARB");
+		MakeTextureHandleResident = (TextureHandleFunction)glfwGetProcAddress("glMakeTextureHandleResidentARB");
+		MakeTextureHandleNonResident = (TextureHandleFunction)glfwGetProcAddress("glMakeTextureHandleNonResidentARB");
+		if (!GetTextureSamplerHandle || !MakeTextureHandleResident || !MakeTextureHandleNonResident) { error("The driver has bindless textures, but not the functions that go with them."); return false; }
+	}
+
+	debug("MaterialTextures", std::string(Bindless ? "bindless" : bindlessExtension ? "array (bindless turned off)" : "array (no GL_ARB_bindless_texture)") + (S3TC ? ", BC1 & BC7" : ", BC7 only (no GL_EXT_texture_compression_s3tc)"));
+	return true;
+}
+
+bool bindlessTextures() {
+	return Bindless;
+}
+
+static void releaseMaterialTextures() {
+	for (size_t i = 0; i < Bound->textures.size(); i++) {
+		MakeTextureHandleNonResident(Bound->handles[i]);
+		releaseTexture(Bound->textures[i]);
+	}
+	Bound->textures.clear();
+	Bound->handles.clear();
+	if (Bound->textureArray != 0) releaseTexture(Bound->textureArray);
+	Bound->textureArray = 0;
+}
+
+static GLenum blockFormatGL(BlockFormat format) {
+	return format == BlockFormat::BC1 ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+}
+
+static bool compressedOnGPU(const Texture& texture) {
+	return !texture.compressed.levels.empty() && (texture.compressed.format == BlockFormat::BC7 || S3TC);
+}
+
+// Compressed textures have to go back to plain texels if the GPU can't read them (or they need resizing) //
+static std::vector<MipLevel> decompressTexture(const CompressedTexture& texture) {
+	std::vector<MipLevel> levels;
+	for (const CompressedLevel& level : texture.levels) levels.push_back(decompressLevel(level, texture.format));
+	return levels;
+}
+
+static bool uploadBindless(const std::vector<const Texture*>& textures, std::vector<Material>& materials) {
+	for (const Texture* uploaded : textures) {
+		const Texture& texture = *uploaded;
+		unsigned int id = 0;
+		if (compressedOnGPU(texture)) {
+			const std::vector<CompressedLevel>& levels = texture.compressed.levels;
+			GLenum format = blockFormatGL(texture.compressed.format);
+			id = acquireTexture({(int)levels[0].width, (int)levels[0].height, format, (int)levels.size()}, "Texture " + texture.name);
+			if (id == 0) return false;
+			glBindTexture(GL_TEXTURE_2D, id);
+			for (size_t level = 0; level < levels.size(); level++) {
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, (int)level, 0, 0, levels[level].width, levels[level].height, format, (int)levels[level].blocks.size(), levels[level].blocks.data());
+			}
+		} else {
+			std::vector<MipLevel> decompressed = texture.compressed.levels.empty() ? std::vector<MipLevel>() : decompressTexture(texture.compressed);
+			const std::vector<MipLevel>& levels = decompressed.empty() ? texture.levels : decompressed;
+			id = acquireTexture({(int)levels[0].width, (int)levels[0].height, GL_SRGB8_ALPHA8, (int)levels.size()}, "Texture " + texture.name);
+			if (id == 0) return false;
+			glBindTexture(GL_TEXTURE_2D, id);
+			for (size_t level = 0; level < levels.size(); level++) {
+				glTexSubImage2D(GL_TEXTURE_2D, (int)level, 0, 0, levels[level].width, levels[level].height, GL_RGBA, GL_UNSIGNED_BYTE, levels[level].texels.data());
+			}
+		}
+
+		// Handles only work while they're resident, so they stay that way until the scene goes //
+		GLuint64 handle = GetTextureSamplerHandle(id, Bound->sampler);
+		if (handle == 0) { error("Could not get a bindless handle for texture '" + texture.name + "'."); return false; }
+		MakeTextureHandleResident(handle);
+		Bound->textures.push_back(id);
+		Bound->handles.push_back(handle);
+	}
+
+	for (Material& material : materials) {
+		if (material.texture == NoTexture || (material.texture & StreamedTexture)) continue;
+		material.handle[0] = (unsigned int)Bound->handles[material.texture];
+		material.handle[1] = (unsigned int)(Bound->handles[material.texture] >> 32);
+	}
+	return true;
+}
+
+// Compressed textures can only stay compressed in the array if they're all the same size & format, since there's no //
+// resizing blocks. Otherwise they get decompressed & go in like any other texture //
+static bool uploadCompressedArray(const std::vector<const Texture*>& textures) {
+	const CompressedTexture& first = textures[0]->compressed;
+	GLenum format = blockFormatGL(first.format);
+	Bound->textureArray = acquireTexture({(int)first.levels[0].width, (int)first.levels[0].height, format, (int)first.levels.size(), (int)textures.size()}, "MaterialTextures");
+	if (Bound->textureArray == 0) return false;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, Bound->textureArray);
+	for (size_t i = 0; i < textures.size(); i++) {
+		const std::vector<CompressedLevel>& levels = textures[i]->compressed.levels;
+		for (size_t level = 0; level < levels.size(); level++) {
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (int)level, 0, 0, (int)i, levels[level].width, levels[level].height, 1, format, (int)levels[level].blocks.size(), levels[level].blocks.data());
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return true;
+}
+
+// Every layer's as big as the biggest texture is in each direction (as far as GL allows), so smaller ones get stretched //
+// That wastes memory, but it's only the fallback, & the shader's mip picking means it doesn't cost any bandwidth //
+static bool uploadArray(const std::vector<const Texture*>& textures) {
+	int maxSize = 0, maxLayers = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	if (textures.size() > (size_t)maxLayers) { error("The scene has " + std::to_string(textures.size()) + " textures, but without bindless textures only " + std::to_string(maxLayers) + " fit."); return false; }
+
+	bool compressed = !textures.empty() && compressedOnGPU(*textures[0]);
+	for (size_t i = 1; i < textures.size() && compressed; i++) {
+		const CompressedTexture& first = textures[0]->compressed, & texture = textures[i]->compressed;
+		compressed = compressedOnGPU(*textures[i]) && texture.format == first.format && texture.levels[0].width == first.levels[0].width && texture.levels[0].height == first.levels[0].height;
+	}
+	if (compressed) return uploadCompressedArray(textures);
+
+	std::vector<std::vector<MipLevel>> decompressed(textures.size());
+	parallelFor(textures.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) if (!textures[i]->compressed.levels.empty()) decompressed[i] = decompressTexture(textures[i]->compressed);
+	});
+	auto levelsOf = [&](size_t i) -> const std::vector<MipLevel>& { return decompressed[i].empty() ? textures[i]->levels : decompressed[i]; };
+
+	unsigned int width = 1, height = 1;
+	for (size_t i = 0; i < textures.size(); i++) {
+		width = std::max(width, levelsOf(i)[0].width);
+		height = std::max(height, levelsOf(i)[0].height);
+	}
+	width = std::min(width, (unsigned int)maxSize);
+	height = std::min(height, (unsigned int)maxSize);
+
+	// Anything that's the wrong size gets resized & has its mips built again, all at once like when they were loaded //
+	// (Squashing starts from the smallest mip that's still big enough, so nothing gets skipped over) //
+	std::vector<std::vector<MipLevel>> resized(textures.size());
+	parallelFor(textures.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const std::vector<MipLevel>& levels = levelsOf(i);
+			if (levels[0].width == width && levels[0].height == height) continue;
+			const MipLevel* source = &levels[0];
+			for (const MipLevel& level : levels) if (level.width >= width && level.height >= height) source = &level;
+			resized[i] = {resizeLevel(*source, width, height)};
+			buildMips(resized[i]);
+		}
+	});
+
+	// Scenes without any textures still get a (white, 1x1) layer, so there's always something bound //
+	int levelCount = 1;
+	while (std::max(width, height) >> levelCount) levelCount++;
+	int layers = std::max(1, (int)textures.size());
+	Bound->textureArray = acquireTexture({(int)width, (int)height, GL_SRGB8_ALPHA8, levelCount, layers}, "MaterialTextures");
+	if (Bound->textureArray == 0) return false;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, Bound->textureArray);
+
+	unsigned char white[4] = {255, 255, 255, 255};
+	if (textures.empty()) glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+	for (size_t i = 0; i < textures.size(); i++) {
+		const std::vector<MipLevel>& levels = resized[i].empty() ? levelsOf(i) : resized[i];
+		for (int level = 0; level < levelCount; level++) {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, (int)i, levels[level].width, levels[level].height, 1, GL_RGBA, GL_UNSIGNED_BYTE, levels[level].texels.data());
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return true;
+}
+
+static bool uploadStreamedTextures(const Scene& scene);
+
+bool uploadMaterialTextures(const Scene& scene, std::vector<Material>& materials) {
+	releaseMaterialTextures();
+	if (Bound->sampler == 0) {
+		glGenSamplers(1, &Bound->sampler);
+		glSamplerParameteri(Bound->sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glSamplerParameteri(Bound->sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(Bound->sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glSamplerParameteri(Bound->sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+
+	// Streamed textures get numbered separately, with StreamedTexture set so the shader can tell them apart //
+	std::vector<const Texture*> textures;
+	std::vector<unsigned int> indices;
+	unsigned int streamedCount = 0;
+	for (const Texture& texture : scene.textures) {
+		if (texture.streamed) indices.push_back(StreamedTexture | streamedCount++);
+		else {
+			indices.push_back((unsigned int)textures.size());
+			textures.push_back(&texture);
+		}
+	}
+	for (Material& material : materials) {
+		if (material.texture != NoTexture) material.texture = indices[material.texture];
+	}
+
+	// Every row of RGBA8 is a multiple of 4 bytes, so the default unpacking's fine //
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	bool successState = Bindless ? uploadBindless(textures, materials) : uploadArray(textures);
+	successState &= uploadStreamedTextures(scene);
+	if (!successState) error("Could not upload the scene's textures.");
+	return successState;
+}
+
+static void bindTilePool();
+
+void bindMaterialTextures() {
+	bindTilePool();
+	if (!Bindless) {
+		glActiveTexture(GL_TEXTURE0 + MaterialTextureUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, Bound->textureArray);
+		glBindSampler(MaterialTextureUnit, Bound->sampler);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+///////////////////////
+// Streamed Textures //
+///////////////////////
+
+// Page table entries are 0 for tiles that aren't in the pool, or ResidentPage plus where they are in it //
+// Before the entries, every streamed texture has 4 uints describing it: its width, height, mip count & first entry //
+const unsigned int ResidentPage = 0x80000000u;
+
+// Feedback is a count & then a page table index per entry (only a few pixels write any, see Shaders/frag.glsl) //
+// There's a few of them (see SceneTextures), so the GPU's never waiting on us to read the last one back //
+const unsigned int FeedbackCapacity = 32768;
+
+// Copying tiles in is cheap, but it's not free, & every one restarts the accumulation //
+const unsigned int MaxTileUploadsPerFrame = 16;
+const unsigned int TileLoaderCount = 2;
+
+// Tiles that were wanted this recently never get thrown out, or two bits of the screen could keep swapping each other out //
+const unsigned int RecentFrames = FeedbackBufferCount + 4;
+
+static unsigned int TilePoolSize = 32;
+
+// The loaders read tiles off disk in the background. Everything they touch is in the requests themselves, so a new //
+// scene can't pull anything out from under them, & anything from an old scene gets thrown away by its generation //
+// Every set of scene textures gets a new generation whenever it uploads a scene, & they all share the loaders, so //
+// only live generations get loaded, & each set only ever takes its own tiles back out //
+struct TileRequest {
+	unsigned int generation, page, tile;
+	std::string path;
+};
+struct LoadedTile {
+	unsigned int generation, page;
+	bool loaded;
+	std::vector<unsigned char> texels;
+};
+// (The loaders never stop, so the queues are never destroyed either, since destroying a condition variable //
+// that something's still waiting on never returns) //
+struct TileQueues {
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<TileRequest> requests;
+	std::deque<LoadedTile> loaded;
+	std::unordered_set<unsigned int> live;
+	unsigned int lastGeneration = 0;
+};
+static TileQueues& Queues = *new TileQueues;
+static bool LoadersStarted = false;
+
+// Throws away everything that's queued up for a generation, so it can never come back //
+// (Only with Queues.mutex held) //
+static void retireGeneration(unsigned int generation) {
+	Queues.live.erase(generation);
+	std::erase_if(Queues.requests, [generation](const TileRequest& request) { return request.generation == generation; });
+	std::erase_if(Queues.loaded, [generation](const LoadedTile& tile) { return tile.generation == generation; });
+}
+
+static void loadTiles() {
+	// Each loader keeps its own copy of every cache open, so they never fight over where a file's read from //
+	// They're kept per generation, since a cache can be rebuilt (& renamed over the old one) between scenes, & an open //
+	// stream would keep on reading the old file. Once a generation's retired, its streams get closed //
+	std::map<std::pair<unsigned int, std::string>, std::ifstream> files;
+	while (true) {
+		TileRequest request;
+		{
+			std::unique_lock<std::mutex> lock(Queues.mutex);
+			Queues.wake.wait(lock, [] { return !Queues.requests.empty(); });
+			request = std::move(Queues.requests.front());
+			Queues.requests.pop_front();
+			std::erase_if(files, [](const auto& file) { return !Queues.live.count(file.first.first); });
+			if (!Queues.live.count(request.generation)) continue;
+		}
+
+		std::ifstream& file = files[{request.generation, request.path}];
+		if (!file.is_open()) file.open(request.path, std::ios::binary);
+		LoadedTile tile = {request.generation, request.page, false, std::vector<unsigned char>(TileBytes)};
+		tile.loaded = file.is_open() && readTile(file, request.tile, tile.texels.data());
+
+		std::lock_guard<std::mutex> lock(Queues.mutex);
+		if (Queues.live.count(tile.generation)) Queues.loaded.push_back(std::move(tile));
+	}
+}
+
+void setTilePoolSize(unsigned int tilesAcross) {
+	TilePoolSize = std::clamp(tilesAcross, 1u, 4095u);
+}
+
+unsigned int tilePoolTexture() {
+	return Bound->tilePool;
+}
+
+unsigned int pageTableBuffer() {
+	return Bound->pageTable;
+}
+
+unsigned int feedbackBuffer() {
+	return Bound->feedbackBuffers[Bound->feedbackIndex];
+}
+
+static void bindTilePool() {
+	glActiveTexture(GL_TEXTURE0 + TilePoolUnit);
+	glBindTexture(GL_TEXTURE_2D, Bound->tilePool);
+	glBindSampler(TilePoolUnit, Bound->poolSampler);
+}
+
+static void writePageEntry(unsigned int page, unsigned int entry) {
+	Bound->pageEntries[page] = entry;
+	Bound->dirtyPages.push_back(page);
+}
+
+// Every upload takes up a whole aligned slot of the upload ring (256 bytes on most drivers) & a copy of its own, so a //
+// gap of up to this many entries between two changes is cheaper to upload along with them than to split around //
+const unsigned int PageRunGap = 64;
+
+// Uploads every entry that changed, in as few runs as it takes //
+static void flushPageEntries() {
+	std::vector<unsigned int>& dirty = Bound->dirtyPages;
+	if (dirty.empty()) return;
+	std::sort(dirty.begin(), dirty.end());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+	size_t first = 0;
+	for (size_t i = 1; i <= dirty.size(); i++) {
+		if (i < dirty.size() && dirty[i] - dirty[i - 1] <= PageRunGap) continue;
+		unsigned int start = dirty[first], count = dirty[i - 1] - start + 1;
+		uploadBuffer(Bound->pageTable, start * sizeof(unsigned int), &Bound->pageEntries[start], count * sizeof(unsigned int));
+		first = i;
+	}
+	dirty.clear();
+}
+
+// Puts a tile in a slot, kicking out whatever was there //
+static void placeTile(unsigned int slot, unsigned int page, const unsigned char* texels, unsigned int frame) {
+	PoolSlot& poolSlot = Bound->poolSlots[slot];
+	if (poolSlot.page != NoPage) writePageEntry(poolSlot.page, 0);
+
+	unsigned int x = slot % TilePoolSize, y = slot / TilePoolSize;
+	glBindTexture(GL_TEXTURE_2D, Bound->tilePool);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x * TileSize, y * TileSize, TileSize, TileSize, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	writePageEntry(page, ResidentPage | y << 12 | x);
+
+	poolSlot.page = page;
+	poolSlot.lastUsed = frame;
+}
+
+// Empty slots first, then whichever one's gone unused the longest //
+static unsigned int findSlot(unsigned int frame) {
+	unsigned int best = NoPage;
+	for (unsigned int slot = 0; slot < Bound->poolSlots.size(); slot++) {
+		const PoolSlot& poolSlot = Bound->poolSlots[slot];
+		if (poolSlot.page == NoPage) return slot;
+		if (poolSlot.pinned || poolSlot.lastUsed + RecentFrames >= frame) continue;
+		if (best == NoPage || poolSlot.lastUsed < Bound->poolSlots[best].lastUsed) best = slot;
+	}
+	return best;
+}
+
+static bool uploadStreamedTextures(const Scene& scene) {
+	// Anything still loading for the last scene is no use now //
+	{
+		std::lock_guard<std::mutex> lock(Queues.mutex);
+		retireGeneration(Bound->generation);
+		Bound->generation = ++Queues.lastGeneration;
+		Queues.live.insert(Bound->generation);
+	}
+	if (Bound->tilePool != 0) releaseTexture(Bound->tilePool);
+	if (Bound->pageTable != 0) releaseBuffer(Bound->pageTable);
+	Bound->tilePool = Bound->pageTable = 0;
+	Bound->streamedPaths.clear();
+	Bound->pages.clear();
+	Bound->poolSlots.clear();
+
+	if (Bound->feedbackBuffers[0] == 0) {
+		for (int i = 0; i < FeedbackBufferCount; i++) {
+			Bound->feedbackBuffers[i] = acquireBuffer((FeedbackCapacity + 1) * sizeof(unsigned int), GL_DYNAMIC_READ, "TextureFeedback");
+			if (Bound->feedbackBuffers[i] == 0) return false;
+		}
+		glGenSamplers(1, &Bound->poolSampler);
+		glSamplerParameteri(Bound->poolSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(Bound->poolSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(Bound->poolSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(Bound->poolSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	// Describe every streamed texture, & work out which page is which //
+	std::vector<const Texture*> textures;
+	for (const Texture& texture : scene.textures) if (texture.streamed) textures.push_back(&texture);
+	Bound->pageBase = (unsigned int)textures.size() * 4;
+	Bound->pageEntries.assign(Bound->pageBase, 0);
+	for (unsigned int i = 0; i < textures.size(); i++) {
+		const TileCache& cache = textures[i]->cache;
+		unsigned int description[4] = {cache.width, cache.height, (unsigned int)cache.levels.size(), Bound->pageBase + (unsigned int)Bound->pages.size()};
+		std::copy(description, description + 4, &Bound->pageEntries[i * 4]);
+		for (unsigned int level = 0; level < cache.levels.size(); level++) {
+			const TileLevel& tileLevel = cache.levels[level];
+			for (unsigned int tile = 0; tile < tileLevel.tilesX * tileLevel.tilesY; tile++) Bound->pages.push_back({i, tileLevel.firstTile + tile, level, false});
+		}
+		Bound->streamedPaths.push_back(cache.path);
+	}
+	Bound->pageEntries.resize(Bound->pageBase + Bound->pages.size(), 0);
+
+	// Scenes without any still get a (1x1) pool & a page table, so there's always something bound //
+	if (textures.size() > TilePoolSize * TilePoolSize) { error("The tile pool only has room for " + std::to_string(TilePoolSize * TilePoolSize) + " tiles, but the scene has " + std::to_string(textures.size()) + " streamed textures."); return false; }
+	int poolWidth = textures.empty() ? 1 : (int)(TilePoolSize * TileSize);
+	Bound->tilePool = acquireTexture({poolWidth, poolWidth, GL_SRGB8_ALPHA8}, "TilePool");
+	Bound->pageTable = acquireBuffer(std::max<size_t>(1, Bound->pageEntries.size()) * sizeof(unsigned int), GL_DYNAMIC_DRAW, "PageTable");
+	if (Bound->tilePool == 0 || Bound->pageTable == 0) return false;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, Bound->pageTable);
+	if (!Bound->pageEntries.empty()) glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, Bound->pageEntries.size() * sizeof(unsigned int), Bound->pageEntries.data());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PageTableBinding, Bound->pageTable);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FeedbackBinding, Bound->feedbackBuffers[Bound->feedbackIndex]);
+	if (textures.empty()) return true;
+	Bound->poolSlots.assign(TilePoolSize * TilePoolSize, PoolSlot());
+
+	// Every texture's smallest mip is one tile, & it gets loaded now & stays put, so the shader always has something //
+	std::vector<unsigned char> texels(TileBytes);
+	for (unsigned int i = 0; i < textures.size(); i++) {
+		const TileCache& cache = textures[i]->cache;
+		std::ifstream file(cache.path, std::ios::binary);
+		if (!readTile(file, cache.tileCount - 1, texels.data())) { error("Could not read tile cache '" + cache.path + "'."); return false; }
+		placeTile(i, Bound->pageEntries[i * 4 + 3] + cache.tileCount - 1, texels.data(), 0);
+		Bound->poolSlots[i].pinned = true;
+	}
+	flushPageEntries();
+
+	if (!LoadersStarted) {
+		for (unsigned int i = 0; i < TileLoaderCount; i++) std::thread(loadTiles).detach();
+		LoadersStarted = true;
+	}
+
+	size_t pages = 0;
+	for (const Texture* texture : textures) pages += texture->cache.tileCount;
+	debug("StreamedTextures", std::to_string(textures.size()) + " textures, " + std::to_string(pages) + " tiles, " + std::to_string(Bound->poolSlots.size()) + " slots in the pool");
+	return true;
+}
+
+// Marks every tile in one frame's feedback as wanted, & asks for any that aren't in the pool //
+static void readFeedback(int index, unsigned int frame, std::vector<unsigned int>& requests) {
+	std::vector<unsigned int> feedback(FeedbackCapacity + 1);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, Bound->feedbackBuffers[index]);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, feedback.size() * sizeof(unsigned int), feedback.data());
+	glDeleteSync(Bound->feedbackFences[index]);
+	Bound->feedbackFences[index] = 0;
+
+	unsigned int count = std::min(feedback[0], FeedbackCapacity);
+	for (unsigned int i = 1; i <= count; i++) {
+		unsigned int page = feedback[i];
+		if (page < Bound->pageBase || page >= Bound->pageEntries.size()) continue;
+		unsigned int entry = Bound->pageEntries[page];
+		if (entry != 0) Bound->poolSlots[(entry >> 12 & 0xFFF) * TilePoolSize + (entry & 0xFFF)].lastUsed = frame;
+		else if (!Bound->pages[page - Bound->pageBase].requested) {
+			Bound->pages[page - Bound->pageBase].requested = true;
+			requests.push_back(page);
+		}
+	}
+}
+
+unsigned int updateStreamedTextures(unsigned int frame) {
+	// Feedback that's ready gets read right away, but this frame's buffer has to be ready whatever happens //
+	std::vector<unsigned int> requests;
+	for (int i = 0; i < FeedbackBufferCount; i++) {
+		int index = (Bound->feedbackIndex + 1 + i) % FeedbackBufferCount;
+		if (Bound->feedbackFences[index] == 0) continue;
+		GLenum status = glClientWaitSync(Bound->feedbackFences[index], index == Bound->feedbackIndex ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, index == Bound->feedbackIndex ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) readFeedback(index, frame, requests);
+	}
+
+	unsigned int zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, Bound->feedbackBuffers[Bound->feedbackIndex]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FeedbackBinding, Bound->feedbackBuffers[Bound->feedbackIndex]);
+	if (Bound->poolSlots.empty()) return 0;
+
+	// Coarse tiles first, since they cover the most & everything finer falls back on them //
+	if (!requests.empty()) {
+		std::stable_sort(requests.begin(), requests.end(), [](unsigned int a, unsigned int b) { return Bound->pages[a - Bound->pageBase].level > Bound->pages[b - Bound->pageBase].level; });
+		{
+			std::lock_guard<std::mutex> lock(Queues.mutex);
+			for (unsigned int page : requests) {
+				const StreamedPage& streamedPage = Bound->pages[page - Bound->pageBase];
+				Queues.requests.push_back({Bound->generation, page, streamedPage.tile, Bound->streamedPaths[streamedPage.texture]});
+			}
+		}
+		Queues.wake.notify_all();
+	}
+
+	// Copy in whatever's finished loading (as long as there's somewhere to put it) //
+	unsigned int uploads = 0;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	while (uploads < MaxTileUploadsPerFrame) {
+		LoadedTile tile;
+		{
+			std::lock_guard<std::mutex> lock(Queues.mutex);
+			auto found = std::find_if(Queues.loaded.begin(), Queues.loaded.end(), [](const LoadedTile& loaded) { return loaded.generation == Bound->generation; });
+			if (found == Queues.loaded.end()) break;
+			tile = std::move(*found);
+			Queues.loaded.erase(found);
+		}
+
+		StreamedPage& page = Bound->pages[tile.page - Bound->pageBase];
+		if (!tile.loaded) { error("Could not read tile " + std::to_string(page.tile) + " of '" + Bound->streamedPaths[page.texture] + "'."); page.requested = false; continue; }
+
+		// If everything in the pool's still wanted, it waits until something isn't rather than being read all over again //
+		unsigned int slot = findSlot(frame);
+		if (slot == NoPage) {
+			std::lock_guard<std::mutex> lock(Queues.mutex);
+			Queues.loaded.push_front(std::move(tile));
+			break;
+		}
+		page.requested = false;
+		placeTile(slot, tile.page, tile.texels.data(), frame);
+		uploads++;
+	}
+	flushPageEntries();
+	return uploads;
+}
+
+void fenceTextureFeedback() {
+	// The feedback's written by the shader, but read back with glGetBufferSubData //
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	if (Bound->feedbackFences[Bound->feedbackIndex] != 0) glDeleteSync(Bound->feedbackFences[Bound->feedbackIndex]);
+	Bound->feedbackFences[Bound->feedbackIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	Bound->feedbackIndex = (Bound->feedbackIndex + 1) % FeedbackBufferCount;
+}
+/////////////////////
+// Texture Binding //
+/////////////////////
+
+SceneTextures* newSceneTextures() {
+	return new SceneTextures();
+}
+
+// Gives back everything the set was holding on to, with it bound //
+void deleteSceneTextures(SceneTextures* textures) {
+	SceneTextures* previous = Bound == textures ? &DefaultTextures : Bound;
+	Bound = textures;
+	releaseMaterialTextures();
+	{
+		std::lock_guard<std::mutex> lock(Queues.mutex);
+		retireGeneration(Bound->generation);
+	}
+	if (Bound->tilePool != 0) releaseTexture(Bound->tilePool);
+	if (Bound->pageTable != 0) releaseBuffer(Bound->pageTable);
+	for (int i = 0; i < FeedbackBufferCount; i++) {
+		if (Bound->feedbackBuffers[i] != 0) releaseBuffer(Bound->feedbackBuffers[i]);
+		if (Bound->feedbackFences[i] != 0) glDeleteSync(Bound->feedbackFences[i]);
+	}
+	if (Bound->sampler != 0) glDeleteSamplers(1, &Bound->sampler);
+	if (Bound->poolSampler != 0) glDeleteSamplers(1, &Bound->poolSampler);
+
+	Bound = previous;
+	delete textures;
+}
+
+void bindSceneTextures(SceneTextures* textures) {
+	Bound = textures ? textures : &DefaultTextures;
+}
\ No newline at end of file
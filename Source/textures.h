@@ -0,0 +1,77 @@
+#pragma once
+
+#include "scene.h"
+
+#include <vector>
+
+///////////////////////
+// Material Textures //
+///////////////////////
+
+// Materials' textures get to the shader one of two ways: //
+// - With ARB_bindless_texture, every texture is its own GL texture & its handle goes straight into the material, //
+//   so there's no limit on how many there can be, & nothing ever needs binding //
+// - Without it, they all get stretched to the same size & stacked up as the layers of one array texture //
+// The shader checks for GL_ARB_bindless_texture itself, & gets told ARRAY_TEXTURES when we went with the array anyway //
+// Either way they're 8-bit sRGB with every mip, & the shader picks the mip itself (see hitAlbedo in Shaders/frag.glsl) //
+
+// The array texture's bound here when there's no bindless //
+const int MaterialTextureUnit = 2;
+
+// Works out which way textures are going to go, so it needs a GL context (any will do, since they're all one driver) //
+// SPIR-V can't do bindless, so --spirv turns it off with allowBindless, & the array gets used whatever the driver has //
+bool initMaterialTextures(bool allowBindless);
+bool bindlessTextures();
+
+// Uploads every texture in the scene, replacing whatever the last scene had //
+// materials is the GPU's copy of the scene's materials, which gets the bindless handles filled in //
+bool uploadMaterialTextures(const Scene& scene, std::vector<Material>& materials);
+
+// Binds the array texture (& the sampler that goes with it, though not with bindless textures) & the tile pool //
+void bindMaterialTextures();
+
+///////////////////////
+// Streamed Textures //
+///////////////////////
+
+// Streamed textures (see Source/tiles.h) never get uploaded whole. Instead: //
+// - The shader looks each tile up in a page table, & falls back to coarser mips for any that aren't there yet //
+// - A few pixels a frame write down the tiles they wanted into a feedback buffer, which we read back a few frames later //
+// - Background threads load whatever's missing off disk, & the main thread copies a few into a fixed size pool each frame, //
+//   throwing out whichever tiles have gone unused the longest //
+// So however big the textures are, they only ever take up the pool's worth of GPU memory //
+// (Every texture's smallest mip is always in the pool though, so there's always something to fall back on) //
+
+// The pool's bound here, & the page table & feedback go just after the bounce statistics //
+const int TilePoolUnit = 3;
+const int PageTableBinding = 14;
+const int FeedbackBinding = 15;
+
+// How many tiles go along each side of the pool (so it holds the square of this), for the next scene that loads //
+void setTilePoolSize(unsigned int tilesAcross);
+
+// Reads back whatever feedback's ready, queues up loads for the tiles that were missing, copies in the ones that //
+// have finished loading & binds a feedback buffer for this frame. Returns how many tiles it copied in, since //
+// anything accumulated before then was using coarser mips //
+unsigned int updateStreamedTextures(unsigned int frame);
+
+// Goes right after the trace passes' draws, so we know when their feedback's safe to read //
+void fenceTextureFeedback();
+
+// For the render graph //
+unsigned int tilePoolTexture();
+unsigned int pageTableBuffer();
+unsigned int feedbackBuffer();
+
+/////////////////////
+// Texture Binding //
+/////////////////////
+
+// Everything above that belongs to a scene (its textures, the tile pool, the page table, the feedback, etc.) works on //
+// whichever set of scene textures is bound, so every renderer can have its own scene (see Source/renderer.h) //
+// There's always one bound to start with. Deleting a set needs a context that shares its objects to be current //
+// (The tile loaders are shared by every set, & so is the tile pool size) //
+struct SceneTextures;
+SceneTextures* newSceneTextures();
+void deleteSceneTextures(SceneTextures* textures);
+void bindSceneTextures(SceneTextures* textures);
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "tiles.h"
+#include "print.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <thread>
+
+/////////////////
+// Tile Caches //
+/////////////////
+
+// A cache is a header & then every tile one after another, so finding a tile is just a seek //
+// sourceSize & sourceTime are the image's when the cache was built, so we can tell when it's out of date //
+struct TileCacheHeader {
+	char magic[4] = {'N', 'E', 'L', 'T'};
+	uint32_t version = 1;
+	uint32_t width = 0, height = 0;
+	uint32_t tileSize = TileSize, tileBorder = TileBorder;
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+};
+
+void layoutTiles(TileCache& cache, unsigned int width, unsigned int height) {
+	cache.width = width;
+	cache.height = height;
+	cache.levels.clear();
+	cache.tileCount = 0;
+	for (unsigned int level = 0; ; level++) {
+		TileLevel tileLevel;
+		tileLevel.width = std::max(width >> level, 1u);
+		tileLevel.height = std::max(height >> level, 1u);
+		tileLevel.tilesX = (tileLevel.width + TilePayload - 1) / TilePayload;
+		tileLevel.tilesY = (tileLevel.height + TilePayload - 1) / TilePayload;
+		tileLevel.firstTile = cache.tileCount;
+		cache.levels.push_back(tileLevel);
+		cache.tileCount += tileLevel.tilesX * tileLevel.tilesY;
+		if (tileLevel.width == 1 && tileLevel.height == 1) break;
+	}
+}
+
+// Caches are named after a hash of the image's full path, so two images called the same thing can't collide //
+static std::string cachePath(std::string imagePath) {
+	std::string fullPath = std::filesystem::absolute(imagePath).lexically_normal().string();
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : fullPath) hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+	std::stringstream name;
+	name << std::filesystem::path(imagePath).stem().string() << '-' << std::hex << hash << ".tiles";
+	return TileCacheDirectory + name.str();
+}
+
+// Cuts every mip up into tiles, borders & all. Levels smaller than a tile just repeat to fill it, which is //
+// exactly what wrapping around would read anyway //
+static bool buildTileCache(const TileCache& cache, const Image& image, const TileCacheHeader& header) {
+	std::vector<MipLevel> levels = {encodeLevel(image)};
+	buildMips(levels);
+
+	std::error_code errorCode;
+	std::filesystem::create_directories(TileCacheDirectory, errorCode);
+
+	// Written somewhere else first & then moved over, so a half written cache never looks like a finished one //
+	std::stringstream temporaryPath;
+	temporaryPath << cache.path << '.' << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+	std::ofstream file(temporaryPath.str(), std::ios::binary);
+	if (!file.is_open()) { error("Could not write tile cache '" + temporaryPath.str() + "'."); return false; }
+	file.write((const char*)&header, sizeof(header));
+
+	for (size_t level = 0; level < levels.size(); level++) {
+		const MipLevel& source = levels[level];
+		const TileLevel& tileLevel = cache.levels[level];
+		std::vector<unsigned char> tiles(tileLevel.tilesX * tileLevel.tilesY * TileBytes);
+		parallelFor(tileLevel.tilesX * tileLevel.tilesY, 1, [&](size_t begin, size_t end) {
+			for (size_t tile = begin; tile < end; tile++) {
+				long long left = (long long)(tile % tileLevel.tilesX) * TilePayload - TileBorder;
+				long long top = (long long)(tile / tileLevel.tilesX) * TilePayload - TileBorder;
+				unsigned char* texels = &tiles[tile * TileBytes];
+				for (unsigned int y = 0; y < TileSize; y++) {
+					size_t row = (size_t)(((top + y) % source.height + source.height) % source.height) * source.width;
+					for (unsigned int x = 0; x < TileSize; x++) {
+						size_t column = (size_t)(((left + x) % source.width + source.width) % source.width);
+						std::memcpy(&texels[(y * TileSize + x) * 4], &source.texels[(row + column) * 4], 4);
+					}
+				}
+			}
+		});
+		file.write((const char*)tiles.data(), tiles.size());
+	}
+
+	file.close();
+	if (!file) { error("Could not write tile cache '" + temporaryPath.str() + "'."); return false; }
+	std::filesystem::rename(temporaryPath.str(), cache.path, errorCode);
+	if (errorCode) { error("Could not write tile cache '" + cache.path + "'."); return false; }
+	return true;
+}
+
+bool openTileCache(TileCache& cache, std::string imagePath) {
+	std::error_code errorCode;
+	TileCacheHeader expected;
+	expected.sourceSize = std::filesystem::file_size(imagePath, errorCode);
+	if (errorCode) { error("Could not open image '" + imagePath + "'."); return false; }
+	expected.sourceTime = (int64_t)std::filesystem::last_write_time(imagePath, errorCode).time_since_epoch().count();
+	cache.path = cachePath(imagePath);
+
+	// Anything that doesn't match (including a different tile size from an older build) gets built again //
+	std::ifstream file(cache.path, std::ios::binary);
+	TileCacheHeader header;
+	if (file.is_open() && file.read((char*)&header, sizeof(header))) {
+		layoutTiles(cache, header.width, header.height);
+		bool current = std::memcmp(header.magic, expected.magic, 4) == 0 && header.version == expected.version && header.tileSize == expected.tileSize && header.tileBorder == expected.tileBorder && header.sourceSize == expected.sourceSize && header.sourceTime == expected.sourceTime;
+		if (current && std::filesystem::file_size(cache.path, errorCode) == sizeof(header) + cache.tileCount * TileBytes) return true;
+	}
+	file.close();
+
+	Image image;
+	if (!loadImage(image, imagePath)) return false;
+	expected.width = image.width;
+	expected.height = image.height;
+	layoutTiles(cache, image.width, image.height);
+	debug("TileCache", "Building " + cache.path + " (" + std::to_string(cache.tileCount) + " tiles)");
+	return buildTileCache(cache, image, expected);
+}
+
+bool readTile(std::ifstream& file, unsigned int tile, unsigned char* texels) {
+	file.clear();
+	file.seekg(sizeof(TileCacheHeader) + tile * TileBytes);
+	return (bool)file.read((char*)texels, TileBytes);
+}
+
+bool readTileLevel(const TileCache& cache, unsigned int level, MipLevel& result) {
+	std::ifstream file(cache.path, std::ios::binary);
+	if (!file.is_open()) { error("Could not open tile cache '" + cache.path + "'."); return false; }
+
+	const TileLevel& tileLevel = cache.levels[level];
+	result.width = tileLevel.width;
+	result.height = tileLevel.height;
+	result.texels.resize((size_t)tileLevel.width * tileLevel.height * 4);
+	std::vector<unsigned char> texels(TileBytes);
+	for (unsigned int tileY = 0; tileY < tileLevel.tilesY; tileY++) {
+		for (unsigned int tileX = 0; tileX < tileLevel.tilesX; tileX++) {
+			if (!readTile(file, tileLevel.firstTile + tileY * tileLevel.tilesX + tileX, texels.data())) { error("Tile cache '" + cache.path + "' is cut short."); return false; }
+			unsigned int width = std::min(TilePayload, tileLevel.width - tileX * TilePayload);
+			unsigned int height = std::min(TilePayload, tileLevel.height - tileY * TilePayload);
+			for (unsigned int y = 0; y < height; y++) {
+				size_t row = (size_t)(tileY * TilePayload + y) * tileLevel.width + tileX * TilePayload;
+				std::memcpy(&result.texels[row * 4], &texels[((y + TileBorder) * TileSize + TileBorder) * 4], width * 4);
+			}
+		}
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "image.h"
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/////////////////
+// Tile Caches //
+/////////////////
+
+// Streamed textures live on disk as a grid of square tiles for every mip, so any bit of any mip can be read //
+// without touching the rest. Each tile also has TileBorder texels of its neighbours (wrapping around the //
+// texture's edges) all the way round, so filtering inside a tile never has to reach into another one //
+const unsigned int TileSize = 128;
+const unsigned int TileBorder = 4;
+const unsigned int TilePayload = TileSize - 2 * TileBorder;
+const size_t TileBytes = (size_t)TileSize * TileSize * 4;
+
+// Caches get built the first time an image is streamed, & rebuilt whenever the image changes //
+// (The path's relative to where nel runs from, same as the shaders) //
+const std::string TileCacheDirectory = "../Cache/";
+
+// Tiles are numbered level by level, then row by row //
+struct TileLevel {
+	unsigned int width, height;
+	unsigned int tilesX, tilesY;
+	unsigned int firstTile;
+};
+
+struct TileCache {
+	std::string path;
+	unsigned int width = 0, height = 0;
+	std::vector<TileLevel> levels;
+	unsigned int tileCount = 0;
+};
+
+// Works out where each level's tiles go, for an image of the given size //
+void layoutTiles(TileCache& cache, unsigned int width, unsigned int height);
+
+// Finds the cache for an image, building it first if it's missing or older than the image //
+bool openTileCache(TileCache& cache, std::string imagePath);
+
+// Reads one tile (TileBytes of 8-bit sRGB RGBA, border & all) from an open cache file //
+bool readTile(std::ifstream& file, unsigned int tile, unsigned char* texels);
+
+// Puts a whole level back together from its tiles, for when something really does need all of it //
+bool readTileLevel(const TileCache& cache, unsigned int level, MipLevel& result);
\ No newline at end of file
@@ -0,0 +1,350 @@
+#include "tracer.h"
+#include "parallel.h"
+#include "print.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+////////////////
+// CPU Tracer //
+////////////////
+
+// The scene side mirrors frag.glsl as closely as C++ allows, so if the two disagree, one of them's wrong //
+// The shading doesn't though: it sticks to plain bouncing (no light sampling), so it's an independent check on the shader's sampling //
+const float Infinity = 1e30f;
+const float Epsilon = 1e-4f;
+const float PI = 3.14159265358979f;
+const unsigned int PrimitiveHit = 0xFFFFFFFFu;
+
+struct Hit {
+	float t;
+	unsigned int instance;
+	unsigned int triangle;
+};
+
+// Each thread traces its own rows, so the random state gets passed around instead of being global //
+static unsigned int hash(unsigned int x) {
+	x ^= x >> 16; x *= 0x7feb352du;
+	x ^= x >> 15; x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static float random(unsigned int& state) {
+	state = hash(state);
+	return (float)(state / 4294967296.0);
+}
+
+static Vec3 loadVec3(const float* data) {
+	return {data[0], data[1], data[2]};
+}
+
+static Vec3 sky(const Scene& scene, Vec3 direction) {
+	const Image& image = scene.environment;
+	if (image.width == 0) {
+		float t = 0.5f * direction.y + 0.5f;
+		return Vec3(1, 1, 1) * (1 - t) + Vec3(0.5f, 0.7f, 1) * t;
+	}
+
+	float u = (std::atan2(direction.z, direction.x) + scene.environmentRotation) / (2 * PI);
+	float v = std::acos(std::clamp(direction.y, -1.0f, 1.0f)) / PI;
+	u -= std::floor(u);
+	unsigned int x = std::min((unsigned int)(u * image.width), image.width - 1), y = std::min((unsigned int)(v * image.height), image.height - 1);
+	return loadVec3(&image.pixels[((size_t)y * image.width + x) * 3]);
+}
+
+//////////////////
+// Intersection //
+//////////////////
+
+static float intersectBox(Vec3 origin, Vec3 inverseDirection, const BVHNode& node, float tMax) {
+	float tNear = -Infinity, tFar = Infinity;
+	for (int axis = 0; axis < 3; axis++) {
+		float t0 = (node.min[axis] - origin[axis]) * inverseDirection[axis];
+		float t1 = (node.max[axis] - origin[axis]) * inverseDirection[axis];
+		tNear = std::max(tNear, std::min(t0, t1));
+		tFar = std::min(tFar, std::max(t0, t1));
+	}
+	return (tNear <= tFar && tFar > 0 && tNear < tMax) ? tNear : Infinity;
+}
+
+static float intersectTriangle(const SceneBuffers& buffers, Vec3 origin, Vec3 direction, unsigned int triangle) {
+	const unsigned int* indices = &buffers.triangles[triangle * 4];
+	Vec3 v0 = loadVec3(&buffers.vertices[indices[0] * 4]);
+	Vec3 edge1 = loadVec3(&buffers.vertices[indices[1] * 4]) - v0;
+	Vec3 edge2 = loadVec3(&buffers.vertices[indices[2] * 4]) - v0;
+
+	Vec3 p = cross(direction, edge2);
+	float determinant = dot(edge1, p);
+	if (std::abs(determinant) < 1e-12f) return Infinity;
+	float inverseDeterminant = 1 / determinant;
+
+	Vec3 s = origin - v0;
+	float u = dot(s, p) * inverseDeterminant;
+	if (u < 0 || u > 1) return Infinity;
+	Vec3 q = cross(s, edge1);
+	float v = dot(direction, q) * inverseDeterminant;
+	if (v < 0 || u + v > 1) return Infinity;
+
+	float t = dot(edge2, q) * inverseDeterminant;
+	return t > Epsilon ? t : Infinity;
+}
+
+static float intersectPrimitive(const SceneBuffers& buffers, Vec3 origin, Vec3 direction, unsigned int primitive) {
+	const float* shape = &buffers.primitiveShapes[primitive * 4];
+	const float* extra = &buffers.primitiveExtras[primitive * 4];
+	Vec3 position = loadVec3(shape);
+	unsigned int type = buffers.primitiveKinds[primitive] & 3;
+
+	if (type == SPHERE) {
+		Vec3 offset = origin - position;
+		float b = dot(offset, direction), a = dot(direction, direction);
+		float discriminant = b * b - a * (dot(offset, offset) - shape[3] * shape[3]);
+		if (discriminant < 0) return Infinity;
+		float root = std::sqrt(discriminant);
+		float t = (-b - root) / a;
+		if (t <= Epsilon) t = (-b + root) / a;
+		return t > Epsilon ? t : Infinity;
+	}
+
+	if (type == BOX) {
+		float tNear = -Infinity, tFar = Infinity;
+		for (int axis = 0; axis < 3; axis++) {
+			float t0 = (shape[axis] - origin[axis]) / direction[axis];
+			float t1 = (extra[axis] - origin[axis]) / direction[axis];
+			tNear = std::max(tNear, std::min(t0, t1));
+			tFar = std::min(tFar, std::max(t0, t1));
+		}
+		if (tNear > tFar) return Infinity;
+		if (tNear > Epsilon) return tNear;
+		return tFar > Epsilon ? tFar : Infinity;
+	}
+
+	Vec3 normal = type == PLANE ? position : loadVec3(extra);
+	float denominator = dot(normal, direction);
+	if (std::abs(denominator) < 1e-12f) return Infinity;
+	float offset = type == PLANE ? shape[3] : dot(normal, position);
+	float t = (offset - dot(normal, origin)) / denominator;
+	if (t <= Epsilon) return Infinity;
+	if (type == DISK) {
+		Vec3 fromCentre = origin + direction * t - position;
+		if (dot(fromCentre, fromCentre) > shape[3] * shape[3]) return Infinity;
+	}
+	return t;
+}
+
+// One stack based walk for every binary BVH, with whatever's in the leaves tested by testLeaf //
+template <typename LeafTest>
+static void traverse(const BVHNode* nodes, unsigned int root, Vec3 origin, Vec3 direction, Hit& hit, LeafTest testLeaf) {
+	Vec3 inverseDirection = {1 / direction.x, 1 / direction.y, 1 / direction.z};
+	if (intersectBox(origin, inverseDirection, nodes[root], hit.t) == Infinity) return;
+
+	unsigned int stack[64];
+	int stackSize = 0;
+	unsigned int node = root;
+	while (true) {
+		if (nodes[node].count > 0) {
+			for (unsigned int i = nodes[node].leftOrFirst; i < nodes[node].leftOrFirst + nodes[node].count; i++) testLeaf(i);
+		} else {
+			unsigned int left = nodes[node].leftOrFirst, right = left + 1;
+			float tLeft = intersectBox(origin, inverseDirection, nodes[left], hit.t);
+			float tRight = intersectBox(origin, inverseDirection, nodes[right], hit.t);
+			if (tLeft > tRight) { std::swap(tLeft, tRight); std::swap(left, right); }
+
+			if (tLeft < Infinity) {
+				if (tRight < Infinity && stackSize < 64) stack[stackSize++] = right;
+				node = left;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) break;
+		node = stack[--stackSize];
+	}
+}
+
+static Hit intersectScene(const SceneBuffers& buffers, Vec3 origin, Vec3 direction) {
+	Hit hit = {Infinity, 0, 0};
+
+	// Primitives: planes on their own, then the BVH over the rest //
+	auto testPrimitive = [&](unsigned int i) {
+		float t = intersectPrimitive(buffers, origin, direction, i);
+		if (t < hit.t) hit = {t, PrimitiveHit, i};
+	};
+	for (unsigned int i = 0; i < buffers.planeCount; i++) testPrimitive(i);
+	if (buffers.primitiveKinds.size() > buffers.planeCount) traverse(buffers.nodes.data(), buffers.primitiveRoot, origin, direction, hit, testPrimitive);
+
+	// Then the instances, each in its own object space //
+	if (buffers.instances.empty()) return hit;
+	traverse(buffers.instanceNodes.data(), 0, origin, direction, hit, [&](unsigned int i) {
+		const GPUInstance& instance = buffers.instances[i];
+		Vec3 localOrigin, localDirection;
+		for (int row = 0; row < 3; row++) {
+			const float* m = instance.worldToObject[row];
+			localOrigin[row] = m[0] * origin.x + m[1] * origin.y + m[2] * origin.z + m[3];
+			localDirection[row] = m[0] * direction.x + m[1] * direction.y + m[2] * direction.z;
+		}
+		traverse(buffers.nodes.data(), instance.rootNode, localOrigin, localDirection, hit, [&](unsigned int triangle) {
+			float t = intersectTriangle(buffers, localOrigin, localDirection, triangle);
+			if (t < hit.t) hit = {t, i, triangle};
+		});
+	});
+	return hit;
+}
+
+static unsigned int hitMaterial(const SceneBuffers& buffers, const Hit& hit) {
+	return hit.instance == PrimitiveHit ? buffers.primitiveKinds[hit.triangle] >> 2 : buffers.instances[hit.instance].material;
+}
+
+static Vec3 hitNormal(const SceneBuffers& buffers, const Hit& hit, Vec3 position) {
+	if (hit.instance == PrimitiveHit) {
+		Vec3 first = loadVec3(&buffers.primitiveShapes[hit.triangle * 4]);
+		Vec3 second = loadVec3(&buffers.primitiveExtras[hit.triangle * 4]);
+		unsigned int type = buffers.primitiveKinds[hit.triangle] & 3;
+		if (type == SPHERE) return normalize(position - first);
+		if (type == PLANE) return first;
+		if (type == DISK) return second;
+
+		Vec3 local = position - (first + second) * 0.5f;
+		Vec3 half = (second - first) * 0.5f;
+		int axis = 0;
+		float furthest = -1;
+		for (int i = 0; i < 3; i++) {
+			float distance = std::abs(local[i]) / std::max(half[i], 1e-6f);
+			if (distance > furthest) { furthest = distance; axis = i; }
+		}
+		Vec3 normal;
+		normal[axis] = local[axis] < 0 ? -1.0f : 1.0f;
+		return normal;
+	}
+
+	const unsigned int* indices = &buffers.triangles[hit.triangle * 4];
+	Vec3 v0 = loadVec3(&buffers.vertices[indices[0] * 4]);
+	Vec3 normal = cross(loadVec3(&buffers.vertices[indices[1] * 4]) - v0, loadVec3(&buffers.vertices[indices[2] * 4]) - v0);
+
+	// Through the inverse transpose, i.e. the transpose of the worldToObject we already have //
+	const GPUInstance& instance = buffers.instances[hit.instance];
+	Vec3 world;
+	for (int column = 0; column < 3; column++) {
+		world[column] = instance.worldToObject[0][column] * normal.x + instance.worldToObject[1][column] * normal.y + instance.worldToObject[2][column] * normal.z;
+	}
+	return normalize(world);
+}
+
+/////////////
+// Shading //
+/////////////
+
+// Textures are always read from their biggest mip here, since there's no ray cone to pick a smaller one with //
+// Over enough samples it should average out to the same thing as the shader's filtered reads //
+static Vec3 hitAlbedo(const Scene& scene, const SceneBuffers& buffers, const Material& material, const Hit& hit, Vec3 position) {
+	Vec3 albedo = loadVec3(material.albedo);
+	if (material.texture == NoTexture || hit.instance == PrimitiveHit || scene.textures[material.texture].levels.empty()) return albedo;
+
+	const GPUInstance& instance = buffers.instances[hit.instance];
+	Vec3 local;
+	for (int row = 0; row < 3; row++) {
+		const float* m = instance.worldToObject[row];
+		local[row] = m[0] * position.x + m[1] * position.y + m[2] * position.z + m[3];
+	}
+
+	const unsigned int* indices = &buffers.triangles[hit.triangle * 4];
+	Vec3 a = loadVec3(&buffers.vertices[indices[0] * 4]);
+	Vec3 edge1 = loadVec3(&buffers.vertices[indices[1] * 4]) - a, edge2 = loadVec3(&buffers.vertices[indices[2] * 4]) - a, offset = local - a;
+	float d11 = dot(edge1, edge1), d12 = dot(edge1, edge2), d22 = dot(edge2, edge2);
+	float d1 = dot(offset, edge1), d2 = dot(offset, edge2);
+	float denominator = std::max(d11 * d22 - d12 * d12, 1e-30f);
+	float weights[3] = {0, (d22 * d1 - d12 * d2) / denominator, (d11 * d2 - d12 * d1) / denominator};
+	weights[0] = 1 - weights[1] - weights[2];
+
+	float u = 0, v = 0;
+	for (int corner = 0; corner < 3; corner++) {
+		uint32_t packed;
+		std::memcpy(&packed, &buffers.vertices[indices[corner] * 4 + 3], 4);
+		u += weights[corner] * halfToFloat((uint16_t)(packed & 0xFFFF));
+		v += weights[corner] * halfToFloat((uint16_t)(packed >> 16));
+	}
+
+	float rgba[4];
+	sampleLevel(scene.textures[material.texture].levels[0], u * material.tiling, v * material.tiling, rgba);
+	return albedo * Vec3(rgba[0], rgba[1], rgba[2]);
+}
+
+static Vec3 cosineDirection(Vec3 normal, unsigned int& state) {
+	float r = std::sqrt(random(state)), phi = 2 * PI * random(state);
+	Vec3 tangent = normalize(cross(std::abs(normal.x) > 0.5f ? Vec3(0, 1, 0) : Vec3(1, 0, 0), normal));
+	Vec3 bitangent = cross(normal, tangent);
+	return normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1 - r * r)));
+}
+
+static Vec3 trace(const Scene& scene, const SceneBuffers& buffers, Vec3 origin, Vec3 direction, unsigned int maxBounces, unsigned int& state) {
+	Vec3 color, throughput = {1, 1, 1};
+
+	for (unsigned int bounce = 0; bounce <= maxBounces; bounce++) {
+		Hit hit = intersectScene(buffers, origin, direction);
+		if (hit.t == Infinity) { color = color + throughput * sky(scene, direction); break; }
+
+		const Material& material = scene.materials[hitMaterial(buffers, hit)];
+		color = color + throughput * loadVec3(material.emission);
+
+		Vec3 position = origin + direction * hit.t;
+		Vec3 normal = hitNormal(buffers, hit, position);
+		if (dot(normal, direction) > 0) normal = normal * -1.0f;
+
+		origin = position + normal * Epsilon;
+		direction = cosineDirection(normal, state);
+		throughput = throughput * hitAlbedo(scene, buffers, material, hit, position);
+	}
+
+	return color;
+}
+
+void traceImage(const Scene& scene, const TracerCamera& camera, unsigned int width, unsigned int height, unsigned int samples, unsigned int maxBounces, std::vector<float>& pixels) {
+	// The CPU only knows how to walk the full precision nodes, so it gets its own copy of the buffers //
+	Scene fullScene = scene;
+	fullScene.layout = FULL_NODES;
+	SceneBuffers buffers = buildSceneBuffers(fullScene, camera.position);
+
+	// Streamed & compressed textures only ever read their biggest mip here, so that's all that gets put back together //
+	for (Texture& texture : fullScene.textures) {
+		if (!texture.compressed.levels.empty()) texture.levels = {decompressLevel(texture.compressed.levels[0], texture.compressed.format)};
+		if (!texture.streamed) continue;
+		texture.levels.resize(1);
+		if (!readTileLevel(texture.cache, 0, texture.levels[0])) texture.levels.clear();
+	}
+
+	pixels.assign((size_t)width * height * 3, 0);
+	parallelFor(height, 1, [&](size_t begin, size_t end) {
+		for (unsigned int y = (unsigned int)begin; y < end; y++) {
+			for (unsigned int x = 0; x < width; x++) {
+				// Seeded exactly like the shader seeds gl_FragCoord (well, the frame's always 0 here) //
+				unsigned int state = hash(x + hash(y + hash(0)));
+				Vec3 color;
+				for (unsigned int i = 0; i < samples; i++) {
+					float px = x + 0.5f + random(state) - 0.5f, py = y + 0.5f + random(state) - 0.5f;
+					Vec3 uv = {(px / width) * 2 - 1, (py / height) * 2 - 1, 1};
+					Vec3 local = {uv.x * camera.aspectRatio, uv.y, 1};
+					Vec3 direction;
+					for (int row = 0; row < 3; row++) direction[row] = camera.rotation[row * 3] * local.x + camera.rotation[row * 3 + 1] * local.y + camera.rotation[row * 3 + 2] * local.z;
+					color = color + trace(fullScene, buffers, Vec3(), normalize(direction), maxBounces, state);
+				}
+				for (int channel = 0; channel < 3; channel++) pixels[((size_t)y * width + x) * 3 + channel] = color[channel] / std::max(1u, samples);
+			}
+		}
+	});
+}
+
+bool writePPM(std::string path, const std::vector<float>& pixels, unsigned int width, unsigned int height) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) { error("Could not open '" + path + "' for writing."); return false; }
+
+	// PPMs go top to bottom, which is the other way up from OpenGL //
+	file << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> row(width * 3);
+	for (unsigned int y = height; y-- > 0;) {
+		for (unsigned int i = 0; i < width * 3; i++) row[i] = (unsigned char)(std::clamp(pixels[(size_t)y * width * 3 + i], 0.0f, 1.0f) * 255 + 0.5f);
+		file.write((const char*)row.data(), row.size());
+	}
+	return file.good();
+}
\ No newline at end of file
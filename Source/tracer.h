@@ -0,0 +1,29 @@
+#pragma once
+
+#include "vec.h"
+#include "scene.h"
+
+#include <string>
+#include <vector>
+
+////////////////
+// CPU Tracer //
+////////////////
+
+// Where the camera is & which way it's looking, same as the shader's uniforms //
+// (rotation is row-major, and turns camera space directions into world space) //
+// The scene gets traced with the camera as its origin, the same way the shader does it (see SceneBuffers' origin) //
+struct TracerCamera {
+	DVec3 position;
+	float rotation[9];
+	float aspectRatio;
+};
+
+// Path traces the scene on the CPU, the same way Shaders/frag.glsl does //
+// It's slow, but it's a reference to check the shader against that doesn't need a GPU at all //
+// Paths always go the full maxBounces bounces (no Russian roulette), so they're what the shader's should average out to //
+// pixels gets width * height RGB triples, bottom row first like OpenGL, averaged over every sample //
+void traceImage(const Scene& scene, const TracerCamera& camera, unsigned int width, unsigned int height, unsigned int samples, unsigned int maxBounces, std::vector<float>& pixels);
+
+// Writes traceImage's pixels out as a binary PPM, clamped to [0, 1] like the window does //
+bool writePPM(std::string path, const std::vector<float>& pixels, unsigned int width, unsigned int height);
\ No newline at end of file
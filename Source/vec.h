@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+///////////
+// Maths //
+///////////
+
+// Just enough vector maths for building scenes on the CPU //
+// (Everything here is laid out so it can go straight into a GPU buffer) //
+
+struct Vec3 {
+	float x = 0, y = 0, z = 0;
+
+	Vec3() {}
+	Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+	float& operator[](int axis) { return (&x)[axis]; }
+	float operator[](int axis) const { return (&x)[axis]; }
+
+	Vec3 operator+(const Vec3& other) const { return {x + other.x, y + other.y, z + other.z}; }
+	Vec3 operator-(const Vec3& other) const { return {x - other.x, y - other.y, z - other.z}; }
+	Vec3 operator*(const Vec3& other) const { return {x * other.x, y * other.y, z * other.z}; }
+	Vec3 operator*(float scale) const { return {x * scale, y * scale, z * scale}; }
+	Vec3 operator/(float scale) const { return {x / scale, y / scale, z / scale}; }
+};
+
+inline Vec3 min(const Vec3& a, const Vec3& b) { return {std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)}; }
+inline Vec3 max(const Vec3& a, const Vec3& b) { return {std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)}; }
+inline float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 cross(const Vec3& a, const Vec3& b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+inline float length(const Vec3& v) { return std::sqrt(dot(v, v)); }
+inline Vec3 normalize(const Vec3& v) { float l = length(v); return l > 0 ? v / l : v; }
+
+// World space positions are kept in doubles, so things far from the origin don't wobble (see SceneBuffers' origin) //
+// They only ever turn into floats once they're relative to somewhere nearby //
+struct DVec3 {
+	double x = 0, y = 0, z = 0;
+
+	DVec3() {}
+	DVec3(double x, double y, double z) : x(x), y(y), z(z) {}
+	explicit DVec3(const Vec3& v) : x(v.x), y(v.y), z(v.z) {}
+
+	double& operator[](int axis) { return (&x)[axis]; }
+	double operator[](int axis) const { return (&x)[axis]; }
+
+	DVec3 operator+(const DVec3& other) const { return {x + other.x, y + other.y, z + other.z}; }
+	DVec3 operator-(const DVec3& other) const { return {x - other.x, y - other.y, z - other.z}; }
+	DVec3 operator*(double scale) const { return {x * scale, y * scale, z * scale}; }
+
+	// The subtraction happens in doubles, so the result's as precise as a float can be //
+	Vec3 relativeTo(const DVec3& origin) const { return {(float)(x - origin.x), (float)(y - origin.y), (float)(z - origin.z)}; }
+};
+
+inline double dot(const DVec3& a, const DVec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline double length(const DVec3& v) { return std::sqrt(dot(v, v)); }
+
+//////////
+// AABB //
+//////////
+
+// Starts out "inside out" so growing it by anything gives that thing's bounds //
+struct AABB {
+	Vec3 min = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+	Vec3 max = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+
+	void grow(const Vec3& point) { min = ::min(min, point); max = ::max(max, point); }
+	void grow(const AABB& other) { min = ::min(min, other.min); max = ::max(max, other.max); }
+	bool valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+	Vec3 centre() const { return (min + max) * 0.5f; }
+	Vec3 extent() const { return max - min; }
+
+	// Half the surface area, which is all the SAH needs since it only ever compares them //
+	float halfArea() const {
+		if (!valid()) return 0;
+		Vec3 e = extent();
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+////////////
+// Affine //
+////////////
+
+// A 3x4 row-major affine transform (rotation/scale in the first three columns, translation in the last) //
+struct Affine {
+	float m[3][4] = {
+		{1, 0, 0, 0},
+		{0, 1, 0, 0},
+		{0, 0, 1, 0},
+	};
+
+	Vec3 transformPoint(const Vec3& p) const {
+		return {
+			m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+			m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+			m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3],
+		};
+	}
+
+	Vec3 transformVector(const Vec3& v) const {
+		return {
+			m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+			m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+			m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z,
+		};
+	}
+
+	// Bounds of a transformed box (transforming all 8 corners would work too, this is just faster) //
+	AABB transformBounds(const AABB& box) const {
+		AABB result;
+		for (int row = 0; row < 3; row++) {
+			float low = m[row][3], high = m[row][3];
+			for (int column = 0; column < 3; column++) {
+				float a = m[row][column] * box.min[column], b = m[row][column] * box.max[column];
+				low += std::min(a, b);
+				high += std::max(a, b);
+			}
+			result.min[row] = low;
+			result.max[row] = high;
+		}
+		return result;
+	}
+
+	Affine operator*(const Affine& other) const {
+		Affine result;
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 4; column++) {
+				result.m[row][column] = (column == 3 ? m[row][3] : 0);
+				for (int k = 0; k < 3; k++) result.m[row][column] += m[row][k] * other.m[k][column];
+			}
+		}
+		return result;
+	}
+
+	Affine inverse() const {
+		// Invert the 3x3 part with cofactors, then undo the translation //
+		float a = m[0][0], b = m[0][1], c = m[0][2];
+		float d = m[1][0], e = m[1][1], f = m[1][2];
+		float g = m[2][0], h = m[2][1], i = m[2][2];
+		float determinant = a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+		float s = determinant != 0 ? 1 / determinant : 0;
+
+		Affine result;
+		result.m[0][0] = (e * i - f * h) * s; result.m[0][1] = (c * h - b * i) * s; result.m[0][2] = (b * f - c * e) * s;
+		result.m[1][0] = (f * g - d * i) * s; result.m[1][1] = (a * i - c * g) * s; result.m[1][2] = (c * d - a * f) * s;
+		result.m[2][0] = (d * h - e * g) * s; result.m[2][1] = (b * g - a * h) * s; result.m[2][2] = (a * e - b * d) * s;
+		for (int row = 0; row < 3; row++) {
+			result.m[row][3] = -(result.m[row][0] * m[0][3] + result.m[row][1] * m[1][3] + result.m[row][2] * m[2][3]);
+		}
+		return result;
+	}
+
+	static Affine translation(const Vec3& t) {
+		Affine result;
+		result.m[0][3] = t.x; result.m[1][3] = t.y; result.m[2][3] = t.z;
+		return result;
+	}
+
+	static Affine scale(const Vec3& s) {
+		Affine result;
+		result.m[0][0] = s.x; result.m[1][1] = s.y; result.m[2][2] = s.z;
+		return result;
+	}
+
+	// Rotates around X, then Y, then Z (angles in radians) //
+	static Affine rotation(const Vec3& angles) {
+		float cx = std::cos(angles.x), sx = std::sin(angles.x);
+		float cy = std::cos(angles.y), sy = std::sin(angles.y);
+		float cz = std::cos(angles.z), sz = std::sin(angles.z);
+		Affine x, y, z;
+		x.m[1][1] = cx; x.m[1][2] = -sx; x.m[2][1] = sx; x.m[2][2] = cx;
+		y.m[0][0] = cy; y.m[0][2] = sy; y.m[2][0] = -sy; y.m[2][2] = cy;
+		z.m[0][0] = cz; z.m[0][1] = -sz; z.m[1][0] = sz; z.m[1][1] = cz;
+		return z * y * x;
+	}
+};
+
+// An Affine with its translation in doubles, for placing things in the world //
+// (Rotation & scale don't get any less precise far from the origin, so they can stay floats) //
+struct DAffine {
+	Affine linear;
+	DVec3 translation;
+
+	DAffine() {}
+	DAffine(const Affine& transform) : linear(transform), translation(transform.m[0][3], transform.m[1][3], transform.m[2][3]) {
+		for (int row = 0; row < 3; row++) linear.m[row][3] = 0;
+	}
+
+	static DAffine translate(const DVec3& t, const Affine& transform) {
+		DAffine result(transform);
+		result.translation = result.translation + t;
+		return result;
+	}
+
+	// The same transform, but into a space centred on origin instead //
+	Affine relativeTo(const DVec3& origin) const {
+		Affine result = linear;
+		Vec3 t = translation.relativeTo(origin);
+		result.m[0][3] = t.x; result.m[1][3] = t.y; result.m[2][3] = t.z;
+		return result;
+	}
+};
+
+/////////////////
+// Half Floats //
+/////////////////
+
+// Half floats, widened to floats (denormals, infinities & NaNs included) //
+inline float halfToFloat(uint16_t half) {
+	uint32_t sign = (uint32_t)(half >> 15) << 31, exponent = (half >> 10) & 31, mantissa = half & 1023;
+	if (exponent == 0) {
+		float value = std::ldexp((float)mantissa, -24);
+		return sign ? -value : value;
+	}
+	uint32_t bits = sign | (exponent == 31 ? 255u << 23 : (exponent + 112) << 23) | (mantissa << 13);
+	float value;
+	std::memcpy(&value, &bits, 4);
+	return value;
+}
+
+// Floats, rounded to the nearest half float (too big turns into infinity, too small into zero) //
+inline uint16_t floatToHalf(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, 4);
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	float magnitude = std::abs(value);
+	if (magnitude != magnitude) return sign | 0x7E00;
+	if (magnitude >= 65520.0f) return sign | 0x7C00;
+
+	// Denormals are just a fixed point number, counting in steps of 2^-24 //
+	if (magnitude < 6.103515625e-05f) return sign | (uint16_t)std::nearbyint(magnitude * 16777216.0f);
+
+	// Otherwise drop 13 bits of mantissa, rounding to nearest even (a carry into the exponent is still right) //
+	uint32_t rest = (bits & 0x7FFFFFFF) - (112u << 23);
+	uint32_t half = rest >> 13, dropped = rest & 0x1FFF;
+	if (dropped > 0x1000 || (dropped == 0x1000 && (half & 1))) half++;
+	return sign | (uint16_t)half;
+}
+
+// Two half floats in one 32-bit word, the same as GLSL's packHalf2x16 (x in the low bits) //
+inline uint32_t packHalf2(float x, float y) {
+	return (uint32_t)floatToHalf(x) | (uint32_t)floatToHalf(y) << 16;
+}
\ No newline at end of file
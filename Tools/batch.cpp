@@ -0,0 +1,66 @@
+#include "../Dependencies/glfw/include/glfw/glfw3.h"
+
+#include "../Source/renderer.h"
+#include "../Source/tracer.h"
+#include "../Source/print.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+//////////////
+// nelbatch //
+//////////////
+
+// Renders scenes on the GPU without ever opening a window, & writes them out as PPMs //
+// Run it from the same place as nel (so it can find the shaders): //
+//   nelbatch [--width <n>] [--height <n>] [--samples <n>] <scene.nel> <out.ppm>... //
+// Every scene gets its own renderer, & they're all loaded before any of them renders, so scenes that need the same //
+// trace program only compile it once //
+
+int main(int argc, char** argv) {
+	int width = 640, height = 480;
+	unsigned int samples = 64;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--width" && i + 1 < argc) width = std::max(1, std::atoi(argv[++i]));
+		else if (argument == "--height" && i + 1 < argc) height = std::max(1, std::atoi(argv[++i]));
+		else if (argument == "--samples" && i + 1 < argc) samples = (unsigned int)std::max(1, std::atoi(argv[++i]));
+		else paths.push_back(argument);
+	}
+	if (paths.empty() || paths.size() % 2 != 0) { print("Usage: nelbatch [--width <n>] [--height <n>] [--samples <n>] <scene.nel> <out.ppm>..."); return 1; }
+
+	if (!glfwInit()) { error("Could not initialize GLFW."); return 1; }
+	bool successState = true;
+	{
+		// Every renderer's jobs go in together, so all the scenes load & build at once //
+		std::vector<std::unique_ptr<Renderer>> renderers;
+		// (Nothing returns from in here, so the renderers are always gone before glfwTerminate. Whatever jobs were added //
+		// still get waited on if a context can't be made, since they point at their renderers) //
+		bool loaded = true;
+		for (size_t i = 0; i < paths.size() && loaded; i += 2) {
+			renderers.push_back(std::make_unique<Renderer>());
+			loaded = renderers.back()->createContext(false);
+			if (loaded) renderers.back()->addCreateJobs(paths[i]);
+		}
+		if (!waitForJobs() && loaded) { error("Could not load the scenes."); loaded = false; }
+		successState = loaded;
+
+		std::vector<float> pixels((size_t)width * height * 3);
+		for (size_t i = 0; i < renderers.size() && loaded; i++) {
+			Renderer& renderer = *renderers[i];
+			std::string outputPath = paths[i * 2 + 1];
+			print("Rendering '" + paths[i * 2] + "' (" + std::to_string(width) + "x" + std::to_string(height) + ", " + std::to_string(samples) + " samples)...");
+
+			double start = glfwGetTime();
+			if (!renderer.render(renderer.sceneCamera(), width, height, samples, pixels.data())) { error("Could not render '" + paths[i * 2] + "'."); successState = false; continue; }
+			print("Took " + std::to_string(glfwGetTime() - start) + "s, writing '" + outputPath + "'...");
+			successState &= writePPM(outputPath, pixels, width, height);
+		}
+	}
+
+	glfwTerminate();
+	return successState ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "../Source/compress.h"
+#include "../Source/parallel.h"
+#include "../Source/print.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+/////////////////
+// nelcompress //
+/////////////////
+
+// Compresses textures ahead of time, so nel can load them straight onto the GPU without decoding anything //
+// Run it from the same place as nel (so they agree on where the cache is) on images or whole scenes: //
+//   nelcompress [--bc1 | --bc7] <image | scene.nel>... //
+// Scenes get every texture they use compressed, apart from streamed ones, which have their own tile cache //
+// Anything that's already compressed (in the same format) gets skipped, since the cache goes by the image's contents //
+
+// Every texture line in a scene, with its path made relative to here rather than the scene //
+static bool sceneTextures(std::string path, std::vector<std::string>& images) {
+	std::ifstream fileStream(path);
+	if (!fileStream.is_open()) { error("Could not open scene '" + path + "'."); return false; }
+	std::string directory = std::filesystem::path(path).parent_path().string();
+	if (!directory.empty()) directory += "/";
+
+	std::string line;
+	while (std::getline(fileStream, line)) {
+		line = line.substr(0, line.find('#'));
+		std::stringstream tokens(line);
+		std::string command, name, image, keyword;
+		if (!(tokens >> command) || command != "texture") continue;
+		tokens >> name >> image;
+		if (tokens >> keyword && keyword == "streamed") continue;
+		images.push_back(directory + image);
+	}
+	return true;
+}
+
+// The root mean square error per channel, between what went in & what the GPU will see //
+static double levelError(const MipLevel& original, const MipLevel& decoded) {
+	double total = 0;
+	for (size_t i = 0; i < original.texels.size(); i++) {
+		double difference = (double)original.texels[i] - decoded.texels[i];
+		total += difference * difference;
+	}
+	return std::sqrt(total / std::max<size_t>(1, original.texels.size()));
+}
+
+static bool compressImage(std::string path, BlockFormat format) {
+	uint64_t hash;
+	if (!hashFile(path, hash)) { error("Could not open image '" + path + "'."); return false; }
+	CompressedTexture existing;
+	if (findCompressedTexture(existing, path) && existing.format == format) {
+		print(path + ": already compressed (" + compressedCachePath(hash) + ")");
+		return true;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	Image image;
+	if (!loadImage(image, path)) return false;
+	std::vector<MipLevel> levels = {encodeLevel(image)};
+	buildMips(levels);
+
+	CompressedTexture texture;
+	texture.format = format;
+	size_t uncompressedBytes = 0, compressedBytes = 0;
+	for (const MipLevel& level : levels) {
+		texture.levels.push_back(compressLevel(level, format));
+		uncompressedBytes += level.texels.size();
+		compressedBytes += texture.levels.back().blocks.size();
+	}
+	double rmsError = levelError(levels[0], decompressLevel(texture.levels[0], format));
+	if (!writeCompressedTexture(texture, hash)) return false;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	char summary[256];
+	std::snprintf(summary, sizeof(summary), "%ux%u %s, %zuKiB -> %zuKiB, RMS error %.2f, %.2fs", image.width, image.height, blockFormatName(format), uncompressedBytes / 1024, compressedBytes / 1024, rmsError, seconds);
+	print(path + ": " + summary);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	BlockFormat format = BlockFormat::BC7;
+	std::vector<std::string> images;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--bc1") format = BlockFormat::BC1;
+		else if (argument == "--bc7") format = BlockFormat::BC7;
+		else if (std::filesystem::path(argument).extension() == ".nel") { if (!sceneTextures(argument, images)) return 1; }
+		else images.push_back(argument);
+	}
+	if (images.empty()) { print("Usage: nelcompress [--bc1 | --bc7] <image | scene.nel>..."); return 1; }
+
+	// Each image's blocks get spread over every core, one image after another //
+	debug("Threads", std::to_string(parallelThreadCount()));
+	bool successState = true;
+	for (const std::string& image : images) successState &= compressImage(image, format);
+	return successState ? 0 : 1;
+}
\ No newline at end of file